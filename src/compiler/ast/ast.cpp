@@ -0,0 +1,271 @@
+#include "ast.hpp"
+
+#include <stdio.h>
+#include <algorithm>
+
+using lon::AbstractSourceTree;
+using lon::ExpressionType;
+using lon::NodePool;
+using lon::NodeIndex;
+using lon::Literal;
+using lon::LiteralType;
+using lon::NO_NODE;
+using lon::NodeRange;
+using lon::StatementType;
+using lon::TypeRef;
+
+NodeRange AbstractSourceTree::addList(NodeIndex const* items, uint32_t count) {
+  NodeRange range = { lists.allocate(count), count };
+
+  for (uint32_t i = 0; i < count; ++i)
+    lists[range.first + i] = items[i];
+
+  return range;
+}
+
+// Where nodes and functions of a tree appended to another one went
+struct MergedPart {
+  NodeIndex expressions;
+  NodeIndex expressionsEnd;
+  NodeIndex statements;
+  NodeIndex statementsEnd;
+  size_t functions;
+  size_t functionsEnd;
+};
+
+static MergedPart appendNodes(AbstractSourceTree& tree, AbstractSourceTree&& other) {
+  MergedPart part;
+
+  part.expressions = tree.expressions.append(std::move(other.expressions));
+  part.expressionsEnd = tree.expressions.size();
+  part.statements = tree.statements.append(std::move(other.statements));
+  part.statementsEnd = tree.statements.size();
+
+  part.functions = tree.functions.size();
+  tree.functions.insert(tree.functions.end(), other.functions.begin(), other.functions.end());
+  part.functionsEnd = tree.functions.size();
+
+  return part;
+}
+
+// Adds bases to node indices of the part, fixList(range, base) does the same for lists
+template <typename FixList>
+static void rebase(AbstractSourceTree& tree, MergedPart const& part, FixList&& fixList) {
+  for (NodeIndex i = part.expressions; i < part.expressionsEnd; ++i) {
+    auto& expr = tree.expressions[i];
+    switch (expr.type) {
+      case ExpressionType::CALL:
+        fixList(expr.call.args, part.expressions);
+        break;
+      case ExpressionType::BINARY:
+        expr.binary.lhs += part.expressions;
+        expr.binary.rhs += part.expressions;
+        break;
+      case ExpressionType::UNARY:
+        expr.unary.operand += part.expressions;
+        break;
+      case ExpressionType::LITERAL:
+        break;
+    }
+  }
+
+  for (NodeIndex i = part.statements; i < part.statementsEnd; ++i) {
+    auto& st = tree.statements[i];
+    if (st.type == StatementType::BLOCK)
+      fixList(st.block, part.statements);
+    else
+      st.expression += part.expressions;
+  }
+
+  for (size_t i = part.functions; i < part.functionsEnd; ++i) {
+    auto& func = tree.functions[i];
+    fixList(func.argsTypes, 0); // TypeRefs are global
+    fixList(func.body, part.statements);
+  }
+}
+
+// lists moved whole start at listsBase
+static inline void rebaseList(AbstractSourceTree& tree, NodeRange& range, NodeIndex base, NodeIndex listsBase) {
+  range.first += listsBase;
+  if (base == 0)
+    return;
+
+  for (uint32_t i = 0; i < range.count; ++i)
+    tree.lists[range.first + i] += base;
+}
+
+void AbstractSourceTree::merge(AbstractSourceTree&& other, size_t position) {
+  if (expressions.size() == 0 && statements.size() == 0 && lists.size() == 0) {
+    expressions = std::move(other.expressions);
+    statements = std::move(other.statements);
+    lists = std::move(other.lists);
+    functions.insert(functions.begin() + position, other.functions.begin(), other.functions.end());
+    return;
+  }
+
+  size_t first = functions.size();
+
+  if (other.lists.size() >= NodePool<NodeIndex>::CHUNK_SIZE) {
+    NodeIndex listsBase = lists.appendWhole(std::move(other.lists));
+    MergedPart part = appendNodes(*this, std::move(other));
+
+    rebase(*this, part, [&](NodeRange& range, NodeIndex base) {
+      rebaseList(*this, range, base, listsBase);
+    });
+  }
+  else {
+    MergedPart part = appendNodes(*this, std::move(other));
+
+    // small lists are copied one by one, so none of them is split between chunks
+    rebase(*this, part, [&](NodeRange& range, NodeIndex base) {
+      NodeIndex from = range.first;
+      range.first = lists.allocate(range.count);
+
+      for (uint32_t i = 0; i < range.count; ++i)
+        lists[range.first + i] = other.lists[from + i] + base;
+    });
+  }
+
+  std::rotate(functions.begin() + position, functions.begin() + first, functions.end());
+}
+
+void AbstractSourceTree::mergeAll(std::vector<AbstractSourceTree>&& trees, ThreadPool& pool) {
+  std::vector<MergedPart> parts;
+  std::vector<NodeIndex> listsBases;
+
+  for (auto& tree : trees) {
+    listsBases.push_back(lists.appendWhole(std::move(tree.lists)));
+    parts.push_back(appendNodes(*this, std::move(tree)));
+  }
+
+  pool.parallelFor(parts.size(), [&](size_t i) {
+    rebase(*this, parts[i], [&](NodeRange& range, NodeIndex base) {
+      rebaseList(*this, range, base, listsBases[i]);
+    });
+  });
+
+  trees.clear();
+}
+
+void AbstractSourceTree::clear() {
+  functions.clear();
+  expressions.clear();
+  statements.clear();
+  lists.clear();
+}
+
+static const char* BINARY_OPERATOR_NAMES[] = {
+  " + ", " - ", " * ", " / ", " % ", " == ", " != ", " < ", " <= ", " > ", " >= ", " && ", " || "
+};
+
+static const char* UNARY_OPERATOR_NAMES[] = {
+  "-", "!"
+};
+
+static void printType(AbstractSourceTree const& ast, TypeRef type) {
+  printf("%s", ast.types->name(type).c_str());
+}
+
+static void printLiteral(AbstractSourceTree const& ast, Literal const* lit) {
+  switch (lit->getType()) {
+    case LiteralType::INT:
+      printf("int<%lld>", lit->intValue);
+      break;
+    case LiteralType::STRING:
+      printf("string<%s>", ast.symbols->cname(lit->string));
+      break;
+    case LiteralType::FLOAT:
+      printf("float<%f>", lit->fltValue);
+      break;
+  }
+}
+
+static void printExpr(AbstractSourceTree const& ast, NodeIndex expr, int indent) {
+  // node or text to print, kept on a stack so deep expressions don't recurse
+  struct Item {
+    NodeIndex expr;
+    const char* text; // printed instead of expr if set
+  };
+
+  std::vector<Item> stack = { { expr, nullptr } };
+
+  while (!stack.empty()) {
+    Item item = stack.back();
+    stack.pop_back();
+
+    if (item.text) {
+      printf("%s", item.text);
+      continue;
+    }
+
+    auto& node = ast.expression(item.expr);
+
+    switch (node.getType()) {
+      case ExpressionType::CALL: {
+        printf("call %s (", ast.symbols->cname(node.call.funcName));
+
+        auto args = ast.list(node.call.args);
+        stack.push_back({ NO_NODE, ")" });
+        for (size_t i = args.size(); i-- > 0;) {
+          stack.push_back({ args[i], nullptr });
+          if (i != 0)
+            stack.push_back({ NO_NODE, ", " });
+        }
+      } break;
+      case ExpressionType::LITERAL:
+        printf("literal ");
+        printLiteral(ast, &node.literal);
+        break;
+      case ExpressionType::BINARY:
+        printf("(");
+        stack.push_back({ NO_NODE, ")" });
+        stack.push_back({ node.binary.rhs, nullptr });
+        stack.push_back({ NO_NODE, BINARY_OPERATOR_NAMES[(int)node.binary.op] });
+        stack.push_back({ node.binary.lhs, nullptr });
+        break;
+      case ExpressionType::UNARY:
+        printf("%s(", UNARY_OPERATOR_NAMES[(int)node.unary.op]);
+        stack.push_back({ NO_NODE, ")" });
+        stack.push_back({ node.unary.operand, nullptr });
+        break;
+    }
+  }
+}
+
+static void printBlock(AbstractSourceTree const& ast, NodeRange statements, int indent) {
+  printf("%*c{\n", indent, ' ');
+  indent += 2;
+  for (NodeIndex index : ast.list(statements)) {
+    auto& st = ast.statement(index);
+
+    switch (st.getType()) {
+      case StatementType::EXPR:
+        printf("%*c", indent, ' ');
+        printExpr(ast, st.expression, indent + 2);
+        printf(";\n");
+        break;
+      case StatementType::RETURN:
+        printf("%*creturn ", indent, ' ');
+        printExpr(ast, st.expression, indent + 2);
+        printf(";\n");
+        break;
+      case StatementType::BLOCK:
+        break;
+    }
+  }
+  indent -= 2;
+  printf("%*c}", indent, ' ');
+}
+
+void AbstractSourceTree::debugPrint() const {
+  printf("Parser result:\n");
+
+  printf("  Functions:\n");
+  for (auto const& func : functions) {
+    printf("    Function %s -> ", symbols->cname(func.funcName));
+    printType(*this, func.returnType);
+    printf("\n      Body:\n");
+    printBlock(*this, func.body, 8);
+    printf("\n");
+  }
+}
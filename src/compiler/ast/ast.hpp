@@ -1,15 +1,54 @@
 #pragma once
 
-#include "types.hpp"
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "pool.hpp"
+#include "../thread_pool.hpp"
+#include "../type_table.hpp"
 #include "literals.hpp"
 #include "expressions.hpp"
 #include "statements.hpp"
 
 namespace lon {
 
+  // All nodes live in flat pools and refer to each other by index,
+  // children are contiguous ranges in `lists`
   struct AbstractSourceTree {
     std::string fileName;
-    std::list<FunctionDefinition> functions;
+    SymbolTable* symbols;
+    TypeTable* types;
+
+    // in source order
+    std::vector<FunctionDefinition> functions;
+
+    NodePool<Expression> expressions;
+    NodePool<Statement> statements;
+    NodePool<NodeIndex> lists;
+
+    inline Expression const& expression(NodeIndex index) const { return expressions[index]; }
+    inline Statement const& statement(NodeIndex index) const { return statements[index]; }
+
+    inline NodeList list(NodeRange range) const {
+      if (range.count == 0)
+        return { nullptr, 0 };
+      return { &lists[range.first], range.count };
+    }
+
+    // Copies count indices to lists
+    NodeRange addList(NodeIndex const* items, uint32_t count);
+
+    // Moves nodes of other into this tree and inserts its functions at position
+    void merge(AbstractSourceTree&& other, size_t position);
+
+    // Same as merging trees one by one at the end, nodes are moved without
+    // copying and their indices fixed on pool threads
+    void mergeAll(std::vector<AbstractSourceTree>&& trees, ThreadPool& pool);
+
+    // Drops all nodes and functions
+    void clear();
+
+    void debugPrint() const;
   };
 
-}
+} // namespace lon
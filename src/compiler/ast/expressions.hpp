@@ -1,26 +1,65 @@
 #pragma once
 
-#include <list>
-#include <string>
-#include <variant>
 #include "literals.hpp"
+#include "pool.hpp"
+#include "../symbols.hpp"
 
 namespace lon {
 
   enum class ExpressionType {
     CALL,
-    LITERAL
+    LITERAL,
+    BINARY,
+    UNARY
+  };
+
+  enum class BinaryOperator : uint8_t {
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    EQ,
+    NOT_EQ,
+    LESS,
+    LESS_EQ,
+    GREATER,
+    GREATER_EQ,
+    AND, // short-circuit
+    OR // short-circuit
+  };
+
+  enum class UnaryOperator : uint8_t {
+    NEG,
+    NOT
   };
 
   struct Expression {
     struct Call {
-      std::string funcName;
-      std::list<Expression> args;
+      Symbol funcName;
+      NodeRange args; // expressions
     };
 
-    ExpressionType getType() const noexcept { return (ExpressionType)data.index(); }
+    struct Binary {
+      BinaryOperator op;
+      NodeIndex lhs;
+      NodeIndex rhs;
+    };
+
+    struct Unary {
+      UnaryOperator op;
+      NodeIndex operand;
+    };
+
+    ExpressionType type;
+    union {
+      Call call;
+      Literal literal;
+      Binary binary;
+      Unary unary;
+    };
 
-    std::variant<Call, Literal> data;
+    ExpressionType getType() const noexcept { return type; }
   };
 
 } // namespace lon
@@ -1,7 +1,7 @@
 #pragma once
 
-#include <string>
-#include <variant>
+#include <stdint.h>
+#include "../symbols.hpp"
 
 namespace lon {
 
@@ -12,9 +12,14 @@ namespace lon {
   };
 
   struct Literal {
-    LiteralType getType() const noexcept { return (LiteralType)data.index(); }
+    LiteralType type;
+    union {
+      uint64_t intValue; // INT
+      double fltValue; // FLOAT
+      Symbol string; // STRING, interned
+    };
 
-    std::variant<uint64_t, double, std::string> data;
+    LiteralType getType() const noexcept { return type; }
   };
 
 } // namespace lon
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace lon {
+
+  // Nodes refer to each other by 32-bit index in their pool
+  using NodeIndex = uint32_t;
+
+  constexpr NodeIndex NO_NODE = 0xFFFFFFFF;
+
+  // Children of a node, `count` indices in AbstractSourceTree::lists from `first`
+  struct NodeRange {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  // Bump allocator for plain nodes, addressed by index.
+  // Memory comes in chunks that never move, so references to nodes stay valid
+  // while more are added. Nodes are never freed one by one, the whole pool goes at once
+  template <typename T>
+  class NodePool {
+    static_assert(std::is_trivially_destructible<T>::value, "AST nodes must be plain data");
+
+  public:
+    static constexpr uint32_t CHUNK_BITS = 12;
+    static constexpr uint32_t CHUNK_SIZE = 1 << CHUNK_BITS;
+
+  private:
+    // one pointer per CHUNK_SIZE indices, bigger blocks take several
+    std::vector<T*> m_chunks;
+    std::vector<std::unique_ptr<T[]>> m_blocks;
+    NodeIndex m_size = 0;
+
+  public:
+    inline NodeIndex add(T const& node) {
+      NodeIndex index = allocate(1);
+      (*this)[index] = node;
+      return index;
+    }
+
+    // Space for count adjacent nodes, returns index of the first one
+    NodeIndex allocate(uint32_t count) {
+      size_t capacity = m_chunks.size() << CHUNK_BITS;
+
+      if (m_size + count > capacity) {
+        // skipped tail of the last chunk holds empty nodes
+        for (NodeIndex i = m_size; i < capacity; ++i)
+          (*this)[i] = T{};
+        m_size = (NodeIndex)capacity;
+
+        size_t chunks = count == 0 ? 1 : (count + CHUNK_SIZE - 1) >> CHUNK_BITS;
+        m_blocks.emplace_back(new T[chunks << CHUNK_BITS]);
+
+        for (size_t i = 0; i < chunks; ++i)
+          m_chunks.push_back(m_blocks.back().get() + (i << CHUNK_BITS));
+      }
+
+      NodeIndex index = m_size;
+      m_size += count;
+      return index;
+    }
+
+    inline T& operator[](NodeIndex index) {
+      return m_chunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)];
+    }
+
+    inline T const& operator[](NodeIndex index) const {
+      return m_chunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)];
+    }
+
+    inline NodeIndex size() const { return m_size; }
+
+    // Nodes [i << CHUNK_BITS, (i + 1) << CHUNK_BITS), chunks past size() aren't there
+    inline T const* chunk(size_t i) const { return m_chunks[i]; }
+
+    // Uses size nodes at data in place instead of own memory. Only the last
+    // partial chunk is copied, so adding nodes never writes past data.
+    // data must stay valid while the pool lives, nodes in it may be changed
+    void view(T* data, NodeIndex size) {
+      clear();
+
+      NodeIndex whole = size & ~(CHUNK_SIZE - 1);
+      for (NodeIndex i = 0; i < whole; i += CHUNK_SIZE)
+        m_chunks.push_back(data + i);
+      m_size = whole;
+
+      if (size > whole) {
+        NodeIndex tail = allocate(size - whole);
+        for (NodeIndex i = tail; i < size; ++i)
+          (*this)[i] = data[i];
+      }
+    }
+
+    void clear() {
+      m_chunks.clear();
+      m_blocks.clear();
+      m_size = 0;
+    }
+
+    // Moves all nodes of other to the end, node i of other gets index base + i.
+    // Pools of at least a chunk are moved whole (see appendWhole), smaller
+    // ones are copied node by node, so their adjacent runs may be split
+    NodeIndex append(NodePool&& other) {
+      if (other.m_size >= CHUNK_SIZE)
+        return appendWhole(std::move(other));
+
+      NodeIndex base = m_size;
+      for (NodeIndex i = 0; i < other.m_size; ++i)
+        add(other[i]);
+      return base;
+    }
+
+    // Takes memory of other without copying, its nodes start at the next chunk
+    NodeIndex appendWhole(NodePool&& other) {
+      NodeIndex base = (NodeIndex)(m_chunks.size() << CHUNK_BITS);
+      for (NodeIndex i = m_size; i < base; ++i)
+        (*this)[i] = T{};
+
+      m_chunks.insert(m_chunks.end(), other.m_chunks.begin(), other.m_chunks.end());
+      for (auto& block : other.m_blocks)
+        m_blocks.push_back(std::move(block));
+      m_size = base + other.m_size;
+
+      other.clear();
+      return base;
+    }
+  };
+
+  // View of a NodeRange for range-for
+  struct NodeList {
+    NodeIndex const* items;
+    uint32_t count;
+
+    inline NodeIndex const* begin() const { return items; }
+    inline NodeIndex const* end() const { return items + count; }
+    inline uint32_t size() const { return count; }
+    inline NodeIndex operator[](uint32_t i) const { return items[i]; }
+  };
+
+} // namespace lon
@@ -1,11 +1,9 @@
 #pragma once
 
 #include <stdint.h>
-#include <string>
-#include <list>
-#include <variant>
-#include "expressions.hpp"
-#include "types.hpp"
+#include "pool.hpp"
+#include "../symbols.hpp"
+#include "../type_table.hpp"
 
 namespace lon {
 
@@ -15,23 +13,21 @@ namespace lon {
     BLOCK
   };
 
-  struct FunctionDefinition;
-
   struct Statement {
-    struct Return {
-      Expression value;
+    StatementType type;
+    union {
+      NodeIndex expression; // EXPR, RETURN value
+      NodeRange block; // statements
     };
 
-    StatementType getType() const noexcept { return (StatementType)data.index(); }
-
-    std::variant<Expression, Return, std::list<Statement>> data;
+    StatementType getType() const noexcept { return type; }
   };
 
   struct FunctionDefinition {
-    std::string funcName;
-    std::list<Type> argsTypes;
-    Type returnType;
-    std::list<Statement> body;
+    Symbol funcName;
+    NodeRange argsTypes; // TypeRefs
+    TypeRef returnType;
+    NodeRange body; // statements
   };
 
 } // namespace lon
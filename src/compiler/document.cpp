@@ -0,0 +1,284 @@
+#include "document.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+using lon::Document;
+using lon::Token;
+
+// Lexer may look 2 chars past a token before deciding where it ends ("1e+5"),
+// tokens that close to changed bytes are lexed again
+static constexpr uint32_t LEXER_LOOKAHEAD = 3;
+
+static inline uint32_t tokenEnd(Token const& tk) {
+  return tk.offset + tk.length;
+}
+
+Document::Document(SymbolTable& symbols, TypeTable& types, std::string_view fileName, std::string_view content)
+  : m_lexer(symbols, fileName, SourceBuffer::fromString(content)),
+    m_rebuildSize(0),
+    m_relex(true),
+    m_relexBegin(0),
+    m_relexEnd((uint32_t)content.size()),
+    m_relexToken(0),
+    m_reparse(false),
+    m_reparseBegin(0),
+    m_reparseEnd(0),
+    m_lexedTokens(0),
+    m_parsedDefinitions(0)
+{
+  m_ast.fileName = fileName;
+  m_ast.symbols = &symbols;
+  m_ast.types = &types;
+}
+
+void Document::parse() {
+  update();
+}
+
+void Document::edit(uint32_t offset, uint32_t length, std::string_view text) {
+  size_t size = source().size();
+  if (offset > size || length > size - offset)
+    throw std::out_of_range("Edit is out of document");
+
+  uint32_t oldEnd = offset + length;
+  uint32_t newEnd = offset + (uint32_t)text.size();
+
+  auto move = [&](uint32_t pos) {
+    if (pos < offset)
+      return pos;
+    return pos >= oldEnd ? pos - length + (uint32_t)text.size() : offset;
+  };
+
+  m_lexer.replaceSource(offset, length, text);
+
+  // tokens after the edit move, ones overlapping it are relexed anyway
+  auto after = std::partition_point(m_tokens.begin(), m_tokens.end(), [&](Token const& tk) {
+    return tk.offset < oldEnd;
+  });
+
+  for (auto tk = after; tk != m_tokens.end(); ++tk)
+    tk->offset = move(tk->offset);
+
+  size_t afterToken = after - m_tokens.begin();
+
+  if (m_relex) {
+    m_relexBegin = std::min(move(m_relexBegin), offset);
+    m_relexEnd = std::max(move(m_relexEnd), newEnd);
+    m_relexToken = std::max(m_relexToken, afterToken);
+  }
+  else {
+    m_relex = true;
+    m_relexBegin = offset;
+    m_relexEnd = newEnd;
+    m_relexToken = afterToken;
+  }
+
+  update();
+}
+
+void Document::update() {
+  m_lexedTokens = 0;
+  m_parsedDefinitions = 0;
+
+  if (m_relex)
+    relex();
+
+  if (m_reparse) {
+    reparse();
+    collectGarbage();
+  }
+}
+
+void Document::relex() {
+  // restart right after the last token the changes can't affect
+  auto first = std::partition_point(m_tokens.begin(), m_tokens.begin() + m_relexToken, [&](Token const& tk) {
+    return tokenEnd(tk) + LEXER_LOOKAHEAD <= m_relexBegin;
+  });
+
+  uint32_t restart = first == m_tokens.begin() ? 0 : tokenEnd(first[-1]);
+  size_t begin = first - m_tokens.begin();
+
+  // first old token past the changes
+  size_t old = std::partition_point(m_tokens.begin() + m_relexToken, m_tokens.end(), [&](Token const& tk) {
+    return tk.offset < m_relexEnd;
+  }) - m_tokens.begin();
+
+  std::vector<Token> tokens;
+  m_lexer.seek(restart);
+
+  try {
+    Token tk;
+    while (true) {
+      if (!m_lexer.nextToken(tk)) {
+        old = m_tokens.size();
+        break;
+      }
+
+      // skip old tokens the new one covers
+      while (old < m_tokens.size() && m_tokens[old].offset < tk.offset)
+        ++old;
+
+      // new token starts where an unchanged one did, everything after is the same
+      if (old < m_tokens.size() && m_tokens[old].offset == tk.offset)
+        break;
+
+      tokens.push_back(tk);
+    }
+  }
+  catch (LexerError& error) {
+    // everything up to the error is lexed again on the next edit
+    m_relexBegin = restart;
+    m_relexEnd = std::max(m_relexEnd, std::min(error.offset() + 1, (uint32_t)source().size()));
+
+    while (old < m_tokens.size() && m_tokens[old].offset < m_relexEnd)
+      ++old;
+
+    m_lexedTokens = tokens.size();
+    replaceTokens(begin, old, {});
+    m_relexToken = begin;
+    throw;
+  }
+
+  m_lexedTokens = tokens.size();
+  replaceTokens(begin, old, tokens);
+  m_relex = false;
+}
+
+void Document::reparse() {
+  // parsing starts after the last valid definition before changed tokens
+  size_t first = std::partition_point(m_definitions.begin(), m_definitions.end(), [&](Definition const& def) {
+    return def.firstToken < m_reparseBegin;
+  }) - m_definitions.begin();
+
+  size_t start = first == 0 ? 0 : m_definitions[first - 1].endToken;
+  size_t pos = start;
+
+  // old definitions [first, last) are replaced
+  size_t last = first;
+  std::vector<Definition> parsed;
+
+  Parser parser(m_ast.fileName, *m_ast.symbols, *m_ast.types, m_tokens.data() + start, m_tokens.data() + m_tokens.size());
+
+  auto commit = [&]() {
+    m_ast.functions.erase(m_ast.functions.begin() + first, m_ast.functions.begin() + last);
+    m_ast.merge(parser.takeAST(), first);
+
+    m_definitions.erase(m_definitions.begin() + first, m_definitions.begin() + last);
+    m_definitions.insert(m_definitions.begin() + first, parsed.begin(), parsed.end());
+    m_parsedDefinitions = parsed.size();
+  };
+
+  try {
+    while (true) {
+      while (last < m_definitions.size() && m_definitions[last].firstToken < pos)
+        ++last;
+
+      // got to an unchanged definition, the rest is the same
+      if (pos >= m_reparseEnd && last < m_definitions.size() && m_definitions[last].firstToken == pos)
+        break;
+
+      if (!parser.parseDefinition())
+        break;
+
+      size_t next = start + parser.position();
+      parsed.push_back({ (uint32_t)pos, (uint32_t)next });
+      pos = next;
+    }
+  }
+  catch (ParserError&) {
+    // definitions before the error are fine, the rest is parsed again on the next edit
+    size_t errorToken = std::min(start + parser.position() + 1, m_tokens.size());
+
+    m_reparseBegin = pos;
+    m_reparseEnd = std::max(m_reparseEnd, errorToken);
+
+    while (last < m_definitions.size() && m_definitions[last].firstToken < m_reparseEnd)
+      ++last;
+
+    if (last > first)
+      m_reparseEnd = std::max(m_reparseEnd, (size_t)m_definitions[last - 1].endToken);
+
+    commit();
+    throw;
+  }
+
+  commit();
+  m_reparse = false;
+}
+
+void Document::replaceTokens(size_t begin, size_t end, std::vector<Token> const& tokens) {
+  damage(begin, end);
+
+  size_t common = std::min(end - begin, tokens.size());
+  std::copy(tokens.begin(), tokens.begin() + common, m_tokens.begin() + begin);
+
+  if (tokens.size() > common)
+    m_tokens.insert(m_tokens.begin() + end, tokens.begin() + common, tokens.end());
+  else
+    m_tokens.erase(m_tokens.begin() + begin + common, m_tokens.begin() + end);
+
+  // damage() made the reparse range cover [begin, end), later tokens move
+  size_t newEnd = begin + tokens.size();
+  m_reparseEnd = m_reparseEnd - end + newEnd;
+
+  auto moved = std::partition_point(m_definitions.begin(), m_definitions.end(), [&](Definition const& def) {
+    return def.firstToken < end;
+  });
+
+  for (auto def = moved; def != m_definitions.end(); ++def) {
+    def->firstToken = (uint32_t)(def->firstToken - end + newEnd);
+    def->endToken = (uint32_t)(def->endToken - end + newEnd);
+  }
+}
+
+void Document::damage(size_t begin, size_t end) {
+  auto first = std::partition_point(m_definitions.begin(), m_definitions.end(), [&](Definition const& def) {
+    return def.endToken <= begin;
+  });
+
+  auto last = first;
+  while (last != m_definitions.end() && last->firstToken < end)
+    ++last;
+
+  if (first != last) {
+    begin = std::min(begin, (size_t)first->firstToken);
+    end = std::max(end, (size_t)last[-1].endToken);
+
+    m_ast.functions.erase(
+      m_ast.functions.begin() + (first - m_definitions.begin()),
+      m_ast.functions.begin() + (last - m_definitions.begin())
+    );
+    m_definitions.erase(first, last);
+  }
+
+  if (m_reparse) {
+    m_reparseBegin = std::min(m_reparseBegin, begin);
+    m_reparseEnd = std::max(m_reparseEnd, end);
+  }
+  else {
+    m_reparse = true;
+    m_reparseBegin = begin;
+    m_reparseEnd = end;
+  }
+}
+
+static size_t nodesCount(lon::AbstractSourceTree const& ast) {
+  return ast.expressions.size() + ast.statements.size() + ast.lists.size();
+}
+
+void Document::collectGarbage() {
+  if (m_rebuildSize == 0)
+    m_rebuildSize = nodesCount(m_ast);
+
+  if (m_reparse || nodesCount(m_ast) <= 2 * m_rebuildSize + 4096)
+    return;
+
+  // every token is in a valid definition, so parsing them again can't fail
+  m_definitions.clear();
+  m_ast.clear();
+  damage(0, m_tokens.size());
+  reparse();
+
+  m_rebuildSize = nodesCount(m_ast);
+}
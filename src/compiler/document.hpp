@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "ast/ast.hpp"
+
+namespace lon {
+
+  // Source file open in an editor.
+  // Every edit relexes only the tokens around it, until the new tokens line up
+  // with the old ones again, then reparses only the function definitions
+  // that contain changed tokens.
+  // Parts that failed to lex or parse are remembered and retried on the next
+  // edit, so the document stays usable while the code is broken
+  class Document {
+  private:
+    struct Definition {
+      uint32_t firstToken;
+      uint32_t endToken;
+    };
+
+    Lexer m_lexer;
+    std::vector<Token> m_tokens;
+
+    // sorted by tokens, every token is in one of them or in the reparse range.
+    // Goes along with m_ast.functions
+    std::vector<Definition> m_definitions;
+    AbstractSourceTree m_ast;
+
+    // nodes of replaced definitions stay in m_ast until it's rebuilt,
+    // when it gets twice as big as after the last rebuild
+    size_t m_rebuildSize;
+
+    // source bytes without tokens, tokens at m_relexToken and later are after them
+    bool m_relex;
+    uint32_t m_relexBegin;
+    uint32_t m_relexEnd;
+    size_t m_relexToken;
+
+    // tokens not covered by definitions
+    bool m_reparse;
+    size_t m_reparseBegin;
+    size_t m_reparseEnd;
+
+    // work done by the last update
+    size_t m_lexedTokens;
+    size_t m_parsedDefinitions;
+
+  public:
+    Document(SymbolTable& symbols, TypeTable& types, std::string_view fileName, std::string_view content);
+
+  public:
+    // Lexes and parses the whole document, throws LexerError or ParserError
+    void parse();
+
+    // Replaces length bytes at offset with text and updates tokens and AST.
+    // Throws LexerError or ParserError, the document is still usable after that
+    void edit(uint32_t offset, uint32_t length, std::string_view text);
+
+    std::vector<Token> const& tokens() const { return m_tokens; }
+    AbstractSourceTree const& getAST() const { return m_ast; }
+    SourceBuffer const& source() const { return m_lexer.source(); }
+
+    size_t lexedTokens() const { return m_lexedTokens; }
+    size_t parsedDefinitions() const { return m_parsedDefinitions; }
+
+  private:
+    void update();
+    void relex();
+    void reparse();
+    void collectGarbage();
+
+    // replaces tokens [begin, end), definitions that used them are parsed again
+    void replaceTokens(size_t begin, size_t end, std::vector<Token> const& tokens);
+
+    // definitions with tokens in [begin, end) must be parsed again
+    void damage(size_t begin, size_t end);
+  };
+
+} // namespace lon
@@ -0,0 +1,433 @@
+#include "encoder.hpp"
+
+#include <algorithm>
+
+using lon::LabelRef;
+using lon::MachineCode;
+using lon::MachineInstruction;
+using lon::Mnemonic;
+using lon::ObjectCode;
+using lon::Operand;
+using lon::Relocation;
+using lon::SectionId;
+
+void ObjectCode::define(LabelRef label, SectionId section, uint32_t offset) {
+  if (labels.size() <= label)
+    labels.resize(label + 1, { SECTION_NONE, 0 });
+  labels[label] = { section, offset };
+}
+
+namespace lon {
+
+  class Encoder {
+  private:
+    // displacement of a jump or call, patched once labels are placed
+    struct Fixup {
+      uint32_t offset; // of the displacement
+      uint8_t size; // 1 or 4
+      LabelRef label;
+      size_t inst;
+    };
+
+    MachineCode const& m_code;
+    ObjectCode& m_object;
+    std::vector<uint8_t>& m_bytes;
+
+    std::vector<uint8_t> m_near; // jumps that need 32-bit displacements
+
+    // of the last pass
+    std::vector<Fixup> m_fixups;
+    std::vector<Relocation> m_relocations;
+    std::vector<std::string> m_errors;
+
+    size_t m_inst; // being encoded
+
+  public:
+    Encoder(MachineCode const& code, ObjectCode& object)
+      : m_code(code), m_object(object), m_bytes(object.sections[SECTION_TEXT].bytes) {}
+
+    void run() {
+      m_object.labels.resize(std::max(m_object.labels.size(), m_code.labels.size()), { SECTION_NONE, 0 });
+      m_near.assign(m_code.insts.size(), 0);
+
+      for (;;) {
+        encodeAll();
+        if (!grow())
+          break;
+      }
+
+      for (auto const& fixup : m_fixups)
+        patch(fixup);
+
+      m_object.relocations.insert(m_object.relocations.end(), m_relocations.begin(), m_relocations.end());
+      m_object.errors.insert(m_object.errors.end(), m_errors.begin(), m_errors.end());
+    }
+
+  private:
+    void encodeAll() {
+      m_bytes.clear();
+      m_fixups.clear();
+      m_relocations.clear();
+      m_errors.clear();
+
+      for (m_inst = 0; m_inst < m_code.insts.size(); ++m_inst)
+        encode(m_code.insts[m_inst]);
+    }
+
+    // Marks short jumps out of reach near, true if any was
+    bool grow() {
+      bool grown = false;
+
+      for (auto const& fixup : m_fixups) {
+        if (fixup.size != 1)
+          continue;
+
+        auto const& target = m_object.labels[fixup.label];
+        int64_t distance = (int64_t)target.offset - (fixup.offset + 1);
+        if (target.section == SECTION_TEXT && (distance < -128 || distance > 127)) {
+          m_near[fixup.inst] = 1;
+          grown = true;
+        }
+      }
+
+      return grown;
+    }
+
+    void patch(Fixup const& fixup) {
+      auto const& target = m_object.labels[fixup.label];
+      if (target.section != SECTION_TEXT) {
+        error("undefined label " + m_code.labels[fixup.label]);
+        return;
+      }
+
+      int32_t distance = (int32_t)(target.offset - (fixup.offset + fixup.size));
+      for (uint8_t i = 0; i < fixup.size; ++i)
+        m_bytes[fixup.offset + i] = (uint8_t)(distance >> (i * 8));
+    }
+
+    void error(std::string message) {
+      m_errors.push_back(std::move(message));
+    }
+
+    static bool fitsByte(Operand const& op) {
+      return op.label == NO_LABEL && op.value >= -128 && op.value <= 127;
+    }
+
+    void byte(uint8_t value) {
+      m_bytes.push_back(value);
+    }
+
+    void word(uint16_t value) {
+      byte((uint8_t)value);
+      byte((uint8_t)(value >> 8));
+    }
+
+    void dword(uint32_t value) {
+      word((uint16_t)value);
+      word((uint16_t)(value >> 16));
+    }
+
+    // value of op plus address of its label, if any
+    void immediate(Operand const& op, uint8_t size) {
+      if (op.label != NO_LABEL)
+        m_relocations.push_back({ SECTION_TEXT, (uint32_t)m_bytes.size(), op.label });
+
+      if (size == 1)
+        byte((uint8_t)op.value);
+      else if (size == 2)
+        word((uint16_t)op.value);
+      else
+        dword((uint32_t)op.value);
+    }
+
+    void prefix(uint8_t size) {
+      if (size == 2)
+        byte(0x66);
+    }
+
+    // ModRM byte and what follows it, reg is a register or opcode extension
+    void modrm(uint8_t reg, Operand const& rm) {
+      if (rm.kind == Operand::REGISTER) {
+        byte(0xC0 | reg << 3 | rm.reg);
+        return;
+      }
+
+      if (rm.reg == REG_NONE) {
+        byte(0x05 | reg << 3);
+        immediate(rm, 4);
+        return;
+      }
+
+      // ebp with mod 00 means no base, esp means a SIB byte follows
+      uint8_t mod = rm.value == 0 && rm.reg != REG_EBP ? 0 : fitsByte(rm) ? 1 : 2;
+      byte(mod << 6 | reg << 3 | rm.reg);
+      if (rm.reg == REG_ESP)
+        byte(0x24);
+
+      if (mod == 1)
+        byte((uint8_t)rm.value);
+      else if (mod == 2)
+        dword((uint32_t)rm.value);
+    }
+
+    void jump(LabelRef label, uint8_t size) {
+      m_fixups.push_back({ (uint32_t)m_bytes.size(), size, label, m_inst });
+      if (size == 1)
+        byte(0);
+      else
+        dword(0);
+    }
+
+    // ADD, SUB, XOR, CMP: ext is both the opcode row and the extension
+    void arithmetic(uint8_t ext, Operand const& a, Operand const& b) {
+      uint8_t wide = a.size != 1;
+      prefix(a.size);
+
+      if (b.is(Operand::IMMEDIATE)) {
+        if (wide && fitsByte(b)) {
+          byte(0x83);
+          modrm(ext, a);
+          byte((uint8_t)b.value);
+        }
+        else if (a.isRegister(REG_EAX)) {
+          byte(ext << 3 | 4 | wide);
+          immediate(b, a.size);
+        }
+        else {
+          byte(0x80 | wide);
+          modrm(ext, a);
+          immediate(b, a.size);
+        }
+      }
+      else if (b.is(Operand::REGISTER)) {
+        byte(ext << 3 | wide);
+        modrm(b.reg, a);
+      }
+      else if (a.is(Operand::REGISTER)) {
+        byte(ext << 3 | 2 | wide);
+        modrm(a.reg, b);
+      }
+      else {
+        invalid();
+      }
+    }
+
+    // NEG, DIV, IDIV and the like: opcode F7 or FF
+    void unary(uint8_t opcode, uint8_t ext, Operand const& a) {
+      prefix(a.size);
+      byte(a.size == 1 ? opcode - 1 : opcode);
+      modrm(ext, a);
+    }
+
+    void invalid() {
+      error(std::string("can't encode ") + mnemonicName(m_code.insts[m_inst].op));
+    }
+
+    void encode(MachineInstruction const& inst) {
+      Operand const& a = inst.ops[0];
+      Operand const& b = inst.ops[1];
+
+      switch (inst.op) {
+        case Mnemonic::NONE:
+          break;
+
+        case Mnemonic::ERROR:
+          error(m_code.errors[a.value]);
+          break;
+
+        case Mnemonic::LABEL:
+          m_object.define(a.label, SECTION_TEXT, (uint32_t)m_bytes.size());
+          break;
+
+        case Mnemonic::MOV:
+          if (a.is(Operand::REGISTER) && b.is(Operand::IMMEDIATE)) {
+            prefix(a.size);
+            byte((a.size == 1 ? 0xB0 : 0xB8) + a.reg);
+            immediate(b, a.size);
+          }
+          else if (b.is(Operand::IMMEDIATE)) {
+            prefix(a.size);
+            byte(a.size == 1 ? 0xC6 : 0xC7);
+            modrm(0, a);
+            immediate(b, a.size);
+          }
+          else if (a.isRegister(REG_EAX) && b.is(Operand::MEMORY) && b.reg == REG_NONE) {
+            prefix(a.size);
+            byte(a.size == 1 ? 0xA0 : 0xA1);
+            immediate(b, 4);
+          }
+          else if (b.isRegister(REG_EAX) && a.is(Operand::MEMORY) && a.reg == REG_NONE) {
+            prefix(b.size);
+            byte(b.size == 1 ? 0xA2 : 0xA3);
+            immediate(a, 4);
+          }
+          else if (b.is(Operand::REGISTER)) {
+            prefix(b.size);
+            byte(b.size == 1 ? 0x88 : 0x89);
+            modrm(b.reg, a);
+          }
+          else if (a.is(Operand::REGISTER)) {
+            prefix(a.size);
+            byte(a.size == 1 ? 0x8A : 0x8B);
+            modrm(a.reg, b);
+          }
+          else {
+            invalid();
+          }
+          break;
+
+        case Mnemonic::MOVZX:
+        case Mnemonic::MOVSX:
+          byte(0x0F);
+          byte((inst.op == Mnemonic::MOVZX ? 0xB6 : 0xBE) | (b.size == 2));
+          modrm(a.reg, b);
+          break;
+
+        case Mnemonic::ADD: arithmetic(0, a, b); break;
+        case Mnemonic::SUB: arithmetic(5, a, b); break;
+        case Mnemonic::XOR: arithmetic(6, a, b); break;
+        case Mnemonic::CMP: arithmetic(7, a, b); break;
+
+        case Mnemonic::IMUL:
+          if (b.is(Operand::IMMEDIATE)) {
+            bool small = fitsByte(b);
+            byte(small ? 0x6B : 0x69);
+            modrm(a.reg, a);
+            immediate(b, small ? 1 : 4);
+          }
+          else {
+            byte(0x0F);
+            byte(0xAF);
+            modrm(a.reg, b);
+          }
+          break;
+
+        case Mnemonic::TEST: {
+          // commutative, the register goes to the reg field
+          Operand const& rm = b.is(Operand::MEMORY) ? b : a;
+          Operand const& other = b.is(Operand::MEMORY) ? a : b;
+          prefix(rm.size);
+
+          if (other.is(Operand::IMMEDIATE) && rm.isRegister(REG_EAX)) {
+            byte(rm.size == 1 ? 0xA8 : 0xA9);
+            immediate(other, rm.size);
+          }
+          else if (other.is(Operand::IMMEDIATE)) {
+            byte(rm.size == 1 ? 0xF6 : 0xF7);
+            modrm(0, rm);
+            immediate(other, rm.size);
+          }
+          else {
+            byte(rm.size == 1 ? 0x84 : 0x85);
+            modrm(other.reg, rm);
+          }
+        } break;
+
+        case Mnemonic::NEG: unary(0xF7, 3, a); break;
+        case Mnemonic::DIV: unary(0xF7, 6, a); break;
+        case Mnemonic::IDIV: unary(0xF7, 7, a); break;
+
+        case Mnemonic::INC:
+        case Mnemonic::DEC:
+          if (a.is(Operand::REGISTER) && a.size == 4)
+            byte((inst.op == Mnemonic::INC ? 0x40 : 0x48) + a.reg);
+          else
+            unary(0xFF, inst.op == Mnemonic::INC ? 0 : 1, a);
+          break;
+
+        case Mnemonic::CDQ:
+          byte(0x99);
+          break;
+
+        case Mnemonic::SETCC:
+          byte(0x0F);
+          byte(0x90 | inst.cond);
+          modrm(0, a);
+          break;
+
+        case Mnemonic::PUSH:
+          if (a.is(Operand::REGISTER)) {
+            byte(0x50 + a.reg);
+          }
+          else if (a.is(Operand::IMMEDIATE)) {
+            bool small = fitsByte(a);
+            byte(small ? 0x6A : 0x68);
+            immediate(a, small ? 1 : 4);
+          }
+          else {
+            byte(0xFF);
+            modrm(6, a);
+          }
+          break;
+
+        case Mnemonic::POP:
+          if (a.is(Operand::REGISTER)) {
+            byte(0x58 + a.reg);
+          }
+          else {
+            byte(0x8F);
+            modrm(0, a);
+          }
+          break;
+
+        case Mnemonic::CALL:
+          if (a.is(Operand::LABEL)) {
+            byte(0xE8);
+            jump(a.label, 4);
+          }
+          else {
+            byte(0xFF);
+            modrm(2, a);
+          }
+          break;
+
+        case Mnemonic::JMP:
+          if (!a.is(Operand::LABEL)) {
+            byte(0xFF);
+            modrm(4, a);
+          }
+          else if (m_near[m_inst]) {
+            byte(0xE9);
+            jump(a.label, 4);
+          }
+          else {
+            byte(0xEB);
+            jump(a.label, 1);
+          }
+          break;
+
+        case Mnemonic::JCC:
+          if (m_near[m_inst]) {
+            byte(0x0F);
+            byte(0x80 | inst.cond);
+            jump(a.label, 4);
+          }
+          else {
+            byte(0x70 | inst.cond);
+            jump(a.label, 1);
+          }
+          break;
+
+        case Mnemonic::RET:
+          if (a.is(Operand::IMMEDIATE) && a.value != 0) {
+            byte(0xC2);
+            word((uint16_t)a.value);
+          }
+          else {
+            byte(0xC3);
+          }
+          break;
+
+        case Mnemonic::REP_MOVSB:
+          byte(0xF3);
+          byte(0xA4);
+          break;
+      }
+    }
+  };
+
+} // namespace lon
+
+void lon::encode(MachineCode const& code, ObjectCode& object) {
+  Encoder(code, object).run();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "machine.hpp"
+
+namespace lon {
+
+  enum SectionId : uint8_t {
+    SECTION_TEXT,
+    SECTION_RDATA,
+    SECTION_DATA,
+    SECTION_IDATA, // import tables, built by the linker
+
+    SECTION_COUNT,
+    SECTION_NONE = 0xFF // label isn't defined
+  };
+
+  struct Section {
+    std::vector<uint8_t> bytes;
+    uint32_t reserved = 0; // zeroed bytes after bytes, not stored in the file
+  };
+
+  struct LabelDefinition {
+    SectionId section;
+    uint32_t offset;
+  };
+
+  // Absolute 32-bit address of label is added to the value at offset
+  struct Relocation {
+    SectionId section;
+    uint32_t offset;
+    LabelRef label;
+  };
+
+  struct Import {
+    std::string library;
+    std::string procedure;
+    LabelRef label; // of its entry in the address table, defined by the linker
+  };
+
+  // Sections of a program before addresses are known
+  struct ObjectCode {
+    Section sections[SECTION_COUNT];
+    std::vector<LabelDefinition> labels; // by LabelRef
+    std::vector<Relocation> relocations;
+    std::vector<Import> imports;
+    std::vector<std::string> errors;
+    LabelRef entry = NO_LABEL;
+
+    void define(LabelRef label, SectionId section, uint32_t offset);
+  };
+
+  // Encodes instructions of code into the text section of object and
+  // defines labels between them. Jumps start short and only grow to near
+  // ones that can't reach their targets, until sizes settle. Jumps and calls
+  // within the code are resolved, other uses of labels become relocations.
+  // Encodings are the shortest ones, as GNU as picks them
+  void encode(MachineCode const& code, ObjectCode& object);
+
+} // namespace lon
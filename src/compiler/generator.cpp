@@ -2,72 +2,113 @@
 
 #include <stdarg.h>
 #include <algorithm>
+#include <iterator>
+#include "peephole.hpp"
 
+using lon::BlockRef;
+using lon::Condition;
 using lon::Generator;
-
-enum {
-  DEST_NONE,
-  DEST_REG_A,
-  DEST_REG_B,
-  DEST_REG_C,
-  DEST_REG_D,
-
-  DEST_RETURN = DEST_REG_A
-};
-
-// ecx - string pointer
-// edx - string length
-static const char* __builtin_print =
-  "__builtin_print: ; builtin\n"
-  "  push -11\n"
-  "  call [GetStdHandle]\n"
-  "  push 0\n"
-  "  push 0\n"
-  "  push edx\n"
-  "  push ecx\n"
-  "  push eax\n"
-  "  call [WriteConsoleA]\n"
-  "  ret\n";
+using lon::IRFunction;
+using lon::LabelRef;
+using lon::Location;
+using lon::Mnemonic;
+using lon::Move;
+using lon::Opcode;
+using lon::Operand;
+using lon::Section;
+using lon::Type;
+using lon::TypeRef;
+using lon::ValueRef;
 
 Generator::Generator() = default;
 Generator::~Generator() = default;
 
-void Generator::generate(AbstractSourceTree const& ast, FILE* outFile) {
+void Generator::generate(IRModule const& module, FILE* outFile, bool optimize) {
   m_outFile = outFile;
+  m_code = MachineCode();
+  m_object = ObjectCode();
+  m_rewrites = 0;
+  m_module = &module;
+  m_symbols = module.symbols;
+  m_types = module.types;
 
   m_data.clear();
+  m_literals.clear();
   m_imports.clear();
-  m_stringsCount = 0;
+  m_functions.clear();
+  m_globals.clear();
 
   importProc("KERNEL32.DLL", "ExitProcess");
   importProc("KERNEL32.DLL", "GetStdHandle");
   importProc("KERNEL32.DLL", "WriteConsoleA");
 
+  // functions may call ones defined later
+  for (auto const& func : module.functions)
+    m_functions[func.name] = m_code.label(m_symbols->cname(func.name));
+
+  bool prints = false;
+  for (auto const& func : module.functions) {
+    for (auto const& inst : func.insts)
+      prints = prints || (inst.op == Opcode::CALL && inst.call.callee == SYM_PRINT);
+  }
+
+  if (prints)
+    genBuiltins();
+
+  for (auto const& func : module.functions)
+    genFunction(func);
+
+  // entry point
+  LabelRef die = global("__die");
+  m_code.emit(Mnemonic::LABEL, Operand::target(global("__entry")));
+  if (prints) {
+    m_code.emit(Mnemonic::PUSH, Operand::imm(-11));
+    m_code.emit(Mnemonic::CALL, Operand::global(global("GetStdHandle")));
+    m_code.emit(Mnemonic::MOV, Operand::global(global("__output_handle")), Operand::reg32(REG_EAX));
+  }
+  auto main = m_functions.find(m_symbols->find("main"));
+  m_code.emit(Mnemonic::CALL, Operand::target(main != m_functions.end() ? main->second : global("main")));
+  m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EBX), Operand::reg32(REG_EAX));
+  m_code.emit(Mnemonic::LABEL, Operand::target(die));
+  if (prints)
+    m_code.emit(Mnemonic::CALL, Operand::target(global("__builtin_flush")));
+  m_code.emit(Mnemonic::PUSH, Operand::reg32(REG_EBX));
+  m_code.emit(Mnemonic::CALL, Operand::global(global("ExitProcess")));
+  m_code.emit(Mnemonic::JMP, Operand::target(die));
+
+  if (optimize)
+    m_rewrites = peephole(m_code);
+
+  m_literals.layout();
+  encode(m_code, m_object);
+  placeData();
+
+  if (!m_outFile)
+    return;
+
   out(";\n");
   out("; lon generated assembly\n");
   out(";\n");
   out("format PE console\n");
   out("entry __entry\n");
   out("section '.text' code readable executable\n");
+  m_code.print(m_outFile);
 
-  out("%s", __builtin_print);
-
-  for (auto const& func : ast.functions)
-    genFunction(&func);
-
-  // entry point
-  out("__entry: ; ENTRY POINT\n");
-  out("  call main\n");
-  out("  mov ebx, eax\n");
-  out("__die:\n");
-  out("  push ebx\n");
-  out("  call [ExitProcess]\n");
-  out("  jmp __die\n");
+  if (!m_literals.empty()) {
+    out("section '.rdata' data readable\n");
+    m_literals.print(m_code, m_outFile);
+  }
 
   // data segment
-  out("section '.data' data readable writeable\n");
+  if (!m_data.empty())
+    out("section '.data' data readable writeable\n");
 
   for (auto const& item : m_data) {
+    if (item.data.empty()) {
+      out("%s rb %u\n", item.name.c_str(), item.reserved);
+      continue;
+    }
+
     out("%s db ", item.name.c_str());
 
     int first = 1;
@@ -109,111 +150,629 @@ void Generator::generate(AbstractSourceTree const& ast, FILE* outFile) {
   }
 }
 
-void Generator::genCall(const char* name, std::list<Expression> const& args, int dest) {
-  if (strcmp(name, "print") == 0) {
-    int idx = DEST_REG_C;
+// fastcall
+// ecx - string pointer
+// edx - string length
+void Generator::genBuiltins() {
+  // the handle is fetched once at entry, the buffer is flushed at exit
+  static const uint32_t zero = 0;
+  useData("__output_handle", &zero, 4);
+  useData("__output_used", &zero, 4);
+  reserveData("__output_buffer", OUTPUT_BUFFER_SIZE);
+
+  Operand handle = Operand::global(global("__output_handle"));
+  Operand used = Operand::global(global("__output_used"));
+  Operand buffer = Operand::address(global("__output_buffer"));
+  Operand size = Operand::imm(OUTPUT_BUFFER_SIZE);
+  LabelRef flush = global("__builtin_flush");
+
+  // ecx - string pointer, edx - length
+  LabelRef copy = m_code.label(".copy");
+  m_code.emit(Mnemonic::LABEL, Operand::target(global("__builtin_print")));
+  m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EAX), used);
+  m_code.emit(Mnemonic::ADD, Operand::reg32(REG_EAX), Operand::reg32(REG_EDX));
+  m_code.emit(Mnemonic::CMP, Operand::reg32(REG_EAX), size);
+  m_code.emit(Mnemonic::JCC, CC_BE, Operand::target(copy));
+  m_code.emit(Mnemonic::PUSH, Operand::reg32(REG_ECX));
+  m_code.emit(Mnemonic::PUSH, Operand::reg32(REG_EDX));
+  m_code.emit(Mnemonic::CALL, Operand::target(flush));
+  m_code.emit(Mnemonic::POP, Operand::reg32(REG_EDX));
+  m_code.emit(Mnemonic::POP, Operand::reg32(REG_ECX));
+  m_code.emit(Mnemonic::CMP, Operand::reg32(REG_EDX), size);
+  m_code.emit(Mnemonic::JCC, CC_BE, Operand::target(copy));
+
+  // doesn't fit even alone
+  m_code.emit(Mnemonic::PUSH, Operand::imm(0));
+  m_code.emit(Mnemonic::PUSH, Operand::imm(0));
+  m_code.emit(Mnemonic::PUSH, Operand::reg32(REG_EDX));
+  m_code.emit(Mnemonic::PUSH, Operand::reg32(REG_ECX));
+  m_code.emit(Mnemonic::PUSH, handle);
+  m_code.emit(Mnemonic::CALL, Operand::global(global("WriteConsoleA")));
+  m_code.emit(Mnemonic::RET);
+
+  m_code.emit(Mnemonic::LABEL, Operand::target(copy));
+  m_code.emit(Mnemonic::PUSH, Operand::reg32(REG_ESI));
+  m_code.emit(Mnemonic::PUSH, Operand::reg32(REG_EDI));
+  m_code.emit(Mnemonic::MOV, Operand::reg32(REG_ESI), Operand::reg32(REG_ECX));
+  m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EDI), used);
+  m_code.emit(Mnemonic::ADD, Operand::reg32(REG_EDI), buffer);
+  m_code.emit(Mnemonic::ADD, used, Operand::reg32(REG_EDX));
+  m_code.emit(Mnemonic::MOV, Operand::reg32(REG_ECX), Operand::reg32(REG_EDX));
+  m_code.emit(Mnemonic::REP_MOVSB);
+  m_code.emit(Mnemonic::POP, Operand::reg32(REG_EDI));
+  m_code.emit(Mnemonic::POP, Operand::reg32(REG_ESI));
+  m_code.emit(Mnemonic::RET);
+
+  // keeps ebx, the exit code
+  LabelRef done = m_code.label(".done");
+  m_code.emit(Mnemonic::LABEL, Operand::target(flush));
+  m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EAX), used);
+  m_code.emit(Mnemonic::TEST, Operand::reg32(REG_EAX), Operand::reg32(REG_EAX));
+  m_code.emit(Mnemonic::JCC, CC_E, Operand::target(done));
+  m_code.emit(Mnemonic::PUSH, Operand::imm(0));
+  m_code.emit(Mnemonic::PUSH, Operand::imm(0));
+  m_code.emit(Mnemonic::PUSH, Operand::reg32(REG_EAX));
+  m_code.emit(Mnemonic::PUSH, buffer);
+  m_code.emit(Mnemonic::PUSH, handle);
+  m_code.emit(Mnemonic::CALL, Operand::global(global("WriteConsoleA")));
+  m_code.emit(Mnemonic::XOR, Operand::reg32(REG_EAX), Operand::reg32(REG_EAX));
+  m_code.emit(Mnemonic::MOV, used, Operand::reg32(REG_EAX));
+  m_code.emit(Mnemonic::LABEL, Operand::target(done));
+  m_code.emit(Mnemonic::RET);
+}
 
-    if (args.size() != 1) {
-      out("ERROR >> INVALID ARGUMENTS COUNT FOR PRINT CALL\n");
-      return;
-    }
+void Generator::genFunction(IRFunction const& func) {
+  m_func = &func;
+  m_preds = func.predecessors();
+  m_strings.clear();
+  m_alloc = allocateRegisters(func);
+  m_saved = m_alloc.usedRegisters & CALLEE_SAVED_REGISTERS;
+  m_tailCalled = false;
+
+  m_code.emit(Mnemonic::LABEL, Operand::target(m_functions[func.name]));
+
+  // local to the function in fasm
+  m_blockLabels.resize(func.blocks.size());
+  for (BlockRef block = 0; block < func.blocks.size(); ++block)
+    m_blockLabels[block] = m_code.label(".B" + std::to_string(block));
+
+  if (m_alloc.slotsCount != 0) {
+    m_code.emit(Mnemonic::PUSH, Operand::reg32(REG_EBP));
+    m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EBP), Operand::reg32(REG_ESP));
+    m_code.emit(Mnemonic::SUB, Operand::reg32(REG_ESP), Operand::imm(m_alloc.slotsCount * 4));
+  }
 
-    auto& arg = *args.begin();
-    if (arg.getType() != ExpressionType::LITERAL) {
-      out("ERROR >> INVALID ARGUMENT FOR PRINT CALL\n");
-      return;
-    }
+  for (uint8_t reg = 0; reg < REG_COUNT; ++reg) {
+    if (m_saved & (1 << reg))
+      m_code.emit(Mnemonic::PUSH, Operand::reg32(reg));
+  }
 
-    auto& lit = std::get<Literal>(arg.data);
-    if (lit.getType() != LiteralType::STRING) {
-      out("ERROR >> INVALID ARGUMENT FOR PRINT CALL\n");
-      return;
-    }
+  for (BlockRef block = 0; block < func.blocks.size(); ++block) {
+    if (!m_preds[block].empty())
+      m_code.emit(Mnemonic::LABEL, Operand::target(m_blockLabels[block]));
+
+    auto const& bb = func.blocks[block];
+    for (ValueRef value = bb.first; value < bb.first + bb.count; ++value)
+      genInstruction(value, block);
+  }
+}
+
+void Generator::genEpilogue() {
+  genFrameExit();
+
+  // callee pops arguments that didn't fit in registers
+  int32_t stackArgs = stackArgsSize(m_func->params.size());
+  if (stackArgs != 0)
+    m_code.emit(Mnemonic::RET, Operand::imm(stackArgs));
+  else
+    m_code.emit(Mnemonic::RET);
+}
+
+void Generator::genFrameExit() {
+  for (uint8_t reg = REG_COUNT; reg-- > 0;) {
+    if (m_saved & (1 << reg))
+      m_code.emit(Mnemonic::POP, Operand::reg32(reg));
+  }
+
+  if (m_alloc.slotsCount != 0) {
+    m_code.emit(Mnemonic::MOV, Operand::reg32(REG_ESP), Operand::reg32(REG_EBP));
+    m_code.emit(Mnemonic::POP, Operand::reg32(REG_EBP));
+  }
+}
+
+int32_t Generator::stackArgsSize(size_t count) {
+  return (int32_t)(count - std::min(count, std::size(ARGUMENT_REGISTERS))) * 4;
+}
+
+Operand Generator::incoming(int32_t offset) const {
+  if (m_alloc.slotsCount != 0)
+    return Operand::mem(REG_EBP, offset + 4);
+
+  int32_t saved = 0;
+  for (uint8_t reg = 0; reg < REG_COUNT; ++reg) {
+    if (m_saved & (1 << reg))
+      saved += 4;
+  }
+  return Operand::mem(REG_ESP, offset + saved);
+}
+
+void Generator::genInstruction(ValueRef value, BlockRef block) {
+  auto const& inst = m_func->insts[value];
+  Location const& dst = location(value);
+  BlockRef next = block + 1;
+
+  // pure and unused, only seen without optimizations
+  bool unused = dst.kind == Location::NONE && inst.type != TYPE_VOID;
+
+  Mnemonic mnemonic;
+  Condition cond;
+  bool isUnsigned = false;
+
+  switch (inst.op) {
+    // constants are used where they are needed, phis are set by predecessors
+    case Opcode::CONST_INT:
+    case Opcode::CONST_FLOAT:
+    case Opcode::CONST_STRING:
+    case Opcode::PHI:
+      break;
+
+    case Opcode::ADD:
+    case Opcode::SUB:
+    case Opcode::MUL: {
+      if (unused)
+        break;
+
+      ValueRef a = inst.args[0];
+      ValueRef b = inst.args[1];
+      if (inst.op != Opcode::SUB && location(b) == dst)
+        std::swap(a, b);
+
+      switch (inst.op) {
+        case Opcode::ADD: mnemonic = Mnemonic::ADD; break;
+        case Opcode::SUB: mnemonic = Mnemonic::SUB; break;
+        default: mnemonic = Mnemonic::IMUL; break;
+      }
+
+      // computed in place unless that overwrites the other operand
+      uint8_t reg = dst.kind == Location::REGISTER && location(b) != dst ? dst.reg : REG_EAX;
+      load(reg, a);
+      m_code.emit(mnemonic, Operand::reg32(reg), operand(b));
+      normalize(reg, inst.type);
+      store(dst, reg);
+    } break;
+
+    case Opcode::DIV:
+    case Opcode::MOD:
+      // registers live here are never ecx or edx, see allocateRegisters
+      load(REG_EAX, inst.args[0]);
+      if (isSigned(inst.type))
+        m_code.emit(Mnemonic::CDQ);
+      else
+        m_code.emit(Mnemonic::XOR, Operand::reg32(REG_EDX), Operand::reg32(REG_EDX));
+
+      mnemonic = isSigned(inst.type) ? Mnemonic::IDIV : Mnemonic::DIV;
+      if (location(inst.args[1]).kind == Location::NONE) {
+        load(REG_ECX, inst.args[1]);
+        m_code.emit(mnemonic, Operand::reg32(REG_ECX));
+      }
+      else {
+        m_code.emit(mnemonic, operand(inst.args[1]));
+      }
+
+      if (inst.op == Opcode::MOD)
+        m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EAX), Operand::reg32(REG_EDX));
+      normalize(REG_EAX, inst.type);
+      store(dst, REG_EAX);
+      break;
+
+    case Opcode::CMP_EQ:
+    case Opcode::CMP_NE:
+    case Opcode::CMP_LT:
+    case Opcode::CMP_LE:
+    case Opcode::CMP_GT:
+    case Opcode::CMP_GE: {
+      if (unused)
+        break;
+
+      isUnsigned = !isSigned(m_func->insts[inst.args[0]].type);
+      switch (inst.op) {
+        case Opcode::CMP_EQ: cond = CC_E; break;
+        case Opcode::CMP_NE: cond = CC_NE; break;
+        case Opcode::CMP_LT: cond = isUnsigned ? CC_B : CC_L; break;
+        case Opcode::CMP_LE: cond = isUnsigned ? CC_BE : CC_LE; break;
+        case Opcode::CMP_GT: cond = isUnsigned ? CC_A : CC_G; break;
+        default: cond = isUnsigned ? CC_AE : CC_GE; break;
+      }
+
+      Location const& lhs = location(inst.args[0]);
+      uint8_t reg = lhs.kind == Location::REGISTER ? lhs.reg : REG_EAX;
+      load(reg, inst.args[0]);
+      m_code.emit(Mnemonic::CMP, Operand::reg32(reg), operand(inst.args[1]));
+      m_code.emit(Mnemonic::SETCC, cond, Operand::reg8(REG_EAX));
+
+      reg = dst.kind == Location::REGISTER ? dst.reg : REG_EAX;
+      m_code.emit(Mnemonic::MOVZX, Operand::reg32(reg), Operand::reg8(REG_EAX));
+      store(dst, reg);
+    } break;
+
+    case Opcode::NEG:
+    case Opcode::NOT:
+    case Opcode::CAST: {
+      if (unused)
+        break;
+
+      uint8_t reg = dst.kind == Location::REGISTER ? dst.reg : REG_EAX;
+      load(reg, inst.args[0]);
+
+      // values are kept extended to 32 bits, so casts only narrow
+      if (inst.op == Opcode::NEG)
+        m_code.emit(Mnemonic::NEG, Operand::reg32(reg));
+      else if (inst.op == Opcode::NOT)
+        m_code.emit(Mnemonic::XOR, Operand::reg32(reg), Operand::imm(1));
+
+      if (inst.op != Opcode::NOT)
+        normalize(reg, inst.type);
+      store(dst, reg);
+    } break;
+
+    case Opcode::CALL: {
+      // returning what the call returns, or nothing
+      auto const& ret = m_func->insts[value + 1];
+      bool tail = ret.op == Opcode::RET && (ret.args[0] == value || ret.args[0] == NO_VALUE);
+
+      if (!(tail && genTailCall(value)))
+        genCall(value);
+    } break;
+
+    case Opcode::RET:
+      if (m_tailCalled) {
+        m_tailCalled = false;
+        break;
+      }
+
+      if (inst.args[0] != NO_VALUE)
+        load(REG_EAX, inst.args[0]);
+      genEpilogue();
+      break;
+
+    case Opcode::BR: {
+      auto moves = phiMoves(block, inst.branch.target);
+      genBranch(moves, inst.branch.target, next);
+    } break;
+
+    case Opcode::BR_COND: {
+      BlockRef target = inst.branch.target;
+      BlockRef otherwise = inst.branch.otherwise;
+
+      Location const& cond = location(inst.branch.cond);
+      if (cond.kind == Location::REGISTER) {
+        m_code.emit(Mnemonic::TEST, Operand::reg32(cond.reg), Operand::reg32(cond.reg));
+      }
+      else if (cond.kind == Location::STACK) {
+        m_code.emit(Mnemonic::CMP, locationOperand(cond), Operand::imm(0));
+      }
+      else {
+        load(REG_EAX, inst.branch.cond);
+        m_code.emit(Mnemonic::TEST, Operand::reg32(REG_EAX), Operand::reg32(REG_EAX));
+      }
+
+      // an edge with phi copies gets a stub of its own
+      auto targetMoves = phiMoves(block, target);
+      auto otherwiseMoves = phiMoves(block, otherwise);
+
+      if (targetMoves.empty()) {
+        m_code.emit(Mnemonic::JCC, CC_NE, Operand::target(m_blockLabels[target]));
+        genBranch(otherwiseMoves, otherwise, next);
+      }
+      else if (otherwiseMoves.empty()) {
+        m_code.emit(Mnemonic::JCC, CC_E, Operand::target(m_blockLabels[otherwise]));
+        genBranch(targetMoves, target, next);
+      }
+      else {
+        LabelRef stub = m_code.label(".E" + std::to_string(block) + "_" + std::to_string(otherwise));
+        m_code.emit(Mnemonic::JCC, CC_E, Operand::target(stub));
+        genBranch(targetMoves, target, next);
+        m_code.emit(Mnemonic::LABEL, Operand::target(stub));
+        genBranch(otherwiseMoves, otherwise, next);
+      }
+    } break;
+  }
+}
 
-    genExpression(&arg, DEST_REG_C);
+void Generator::genCall(ValueRef value) {
+  auto const& inst = m_func->insts[value];
+  auto const& args = inst.call.args;
+  std::vector<Move> moves;
 
-    out("  mov edx, %d\n", std::get<std::string>(lit.data).length());
-    out("  call __builtin_print\n");
-    switch (dest) {
-      case DEST_REG_B: out("  mov ebx, eax\n"); break;
-      case DEST_REG_C: out("  mov ecx, eax\n"); break;
-      case DEST_REG_D: out("  mov edx, eax\n"); break;
+  if (inst.call.callee == SYM_PRINT) {
+    ValueRef arg = m_func->operand(args, 0);
+    auto const& str = m_func->insts[arg];
+
+    // length is only known for constants
+    if (str.op != Opcode::CONST_STRING) {
+      m_code.error("INVALID ARGUMENT FOR PRINT CALL");
+      return;
     }
 
+    // fastcall: string in ecx, length in edx
+    Location none = { Location::NONE, REG_NONE, 0 };
+    int32_t length = (int32_t)m_symbols->name(str.string).size();
+    moves.push_back({ { Location::REGISTER, REG_ECX, 0 }, none, constant(arg) });
+    moves.push_back({ { Location::REGISTER, REG_EDX, 0 }, none, Operand::imm(length) });
+    genMoves(moves);
+    m_code.emit(Mnemonic::CALL, Operand::target(global("__builtin_print")));
     return;
   }
 
-  printf("Unknown function %s\n", name);
+  uint32_t inRegisters = std::min(args.count, (uint32_t)std::size(ARGUMENT_REGISTERS));
+  for (uint32_t i = args.count; i-- > inRegisters;)
+    m_code.emit(Mnemonic::PUSH, operand(m_func->operand(args, i)));
+
+  for (uint32_t i = 0; i < inRegisters; ++i) {
+    ValueRef arg = m_func->operand(args, i);
+    Location const& src = location(arg);
+    moves.push_back({
+      { Location::REGISTER, ARGUMENT_REGISTERS[i], 0 }, src,
+      src.kind == Location::NONE ? constant(arg) : Operand()
+    });
+  }
+
+  genMoves(moves);
+  m_code.emit(Mnemonic::CALL, Operand::target(m_functions[inst.call.callee]));
+  store(location(value), REG_EAX);
 }
 
-void Generator::genLiteral(Literal const* lit, int dest) {
-  if (
-    lit->getType() == LiteralType::INT &&
-    std::get<uint64_t>(lit->data) == 0
-  ) {
-    switch (dest) {
-      case DEST_REG_A: out("  xor eax, eax\n"); break;
-      case DEST_REG_B: out("  xor ebx, ebx\n"); break;
-      case DEST_REG_C: out("  xor ecx, ecx\n"); break;
-      case DEST_REG_D: out("  xor edx, edx\n"); break;
+// The callee returns right where this function would, so it's jumped to.
+// Its stack arguments take place of ours before the frame is left, and if
+// it pops less of them the return address moves up by the difference.
+// Always works for recursion, false if the callee needs more stack
+bool Generator::genTailCall(ValueRef value) {
+  auto const& inst = m_func->insts[value];
+  auto const& args = inst.call.args;
+  bool print = inst.call.callee == SYM_PRINT;
+
+  if (print && m_func->insts[m_func->operand(args, 0)].op != Opcode::CONST_STRING)
+    return false;
+
+  int32_t ours = stackArgsSize(m_func->params.size());
+  int32_t theirs = print ? 0 : stackArgsSize(args.count);
+  if (theirs > ours)
+    return false;
+
+  int32_t shift = ours - theirs;
+  uint32_t inRegisters = std::min(args.count, (uint32_t)std::size(ARGUMENT_REGISTERS));
+  std::vector<Move> moves;
+
+  // parameters aren't readable in bodies, so nothing reads our arguments
+  for (uint32_t i = inRegisters; i < args.count; ++i) {
+    Operand dst = incoming(shift + 4 + (int32_t)(i - inRegisters) * 4);
+    Operand src = operand(m_func->operand(args, i));
+
+    if (src.kind == Operand::MEMORY) {
+      m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EAX), src);
+      src = Operand::reg32(REG_EAX);
     }
-    return;
+    m_code.emit(Mnemonic::MOV, dst, src);
   }
 
-  switch (dest) {
-    case DEST_REG_A: out("  mov eax, "); break;
-    case DEST_REG_B: out("  mov ebx, "); break;
-    case DEST_REG_C: out("  mov ecx, "); break;
-    case DEST_REG_D: out("  mov edx, "); break;
+  LabelRef target;
+  if (print) {
+    ValueRef arg = m_func->operand(args, 0);
+    int32_t length = (int32_t)m_symbols->name(m_func->insts[arg].string).size();
+    Location none = { Location::NONE, REG_NONE, 0 };
+    moves.push_back({ { Location::REGISTER, REG_ECX, 0 }, none, constant(arg) });
+    moves.push_back({ { Location::REGISTER, REG_EDX, 0 }, none, Operand::imm(length) });
+    target = global("__builtin_print");
+  }
+  else {
+    for (uint32_t i = 0; i < inRegisters; ++i) {
+      ValueRef arg = m_func->operand(args, i);
+      Location const& src = location(arg);
+      moves.push_back({
+        { Location::REGISTER, ARGUMENT_REGISTERS[i], 0 }, src,
+        src.kind == Location::NONE ? constant(arg) : Operand()
+      });
+    }
+    target = m_functions[inst.call.callee];
   }
 
-  switch (lit->getType()) {
-    case LiteralType::INT:
-      out("%lld\n", std::get<uint64_t>(lit->data)); break;
-    case LiteralType::STRING: {
-      auto& str = std::get<std::string>(lit->data);
-      int id = m_stringsCount++;
-      char buffer[32];
-      sprintf(buffer, "str%d", id);
-      useData(buffer, str.data(), str.length() + 1);
-      out("%s\n", buffer);
-    } break;
-    case LiteralType::FLOAT:
-      break;
+  // ecx and edx aren't restored by leaving the frame
+  genMoves(moves);
+  genFrameExit();
+
+  if (shift != 0) {
+    m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EAX), Operand::mem(REG_ESP, 0));
+    m_code.emit(Mnemonic::MOV, Operand::mem(REG_ESP, shift), Operand::reg32(REG_EAX));
+    m_code.emit(Mnemonic::ADD, Operand::reg32(REG_ESP), Operand::imm(shift));
   }
+
+  m_code.emit(Mnemonic::JMP, Operand::target(target));
+  m_tailCalled = true;
+  return true;
 }
 
-void Generator::genExpression(Expression const* expr, int dest) {
-  switch (expr->getType()) {
-    case ExpressionType::CALL: {
-      auto& call = std::get<Expression::Call>(expr->data);
-      genCall(call.funcName.c_str(), call.args, dest);
-    } break;
-    case ExpressionType::LITERAL: {
-      genLiteral(&std::get<Literal>(expr->data), dest);
-    } break;
+void Generator::genBranch(std::vector<Move>& moves, BlockRef to, BlockRef next) {
+  genMoves(moves);
+
+  if (to != next)
+    m_code.emit(Mnemonic::JMP, Operand::target(m_blockLabels[to]));
+}
+
+std::vector<Move> Generator::phiMoves(BlockRef from, BlockRef to) {
+  auto const& bb = m_func->blocks[to];
+  std::vector<Move> moves;
+
+  for (ValueRef phi = bb.first; m_func->insts[phi].op == Opcode::PHI; ++phi) {
+    auto const& list = m_func->insts[phi].list;
+    if (location(phi).kind == Location::NONE)
+      continue;
+
+    for (uint32_t i = 0; i < list.count; i += 2) {
+      if (m_func->operand(list, i) != from)
+        continue;
+
+      ValueRef value = m_func->operand(list, i + 1);
+      Location const& src = location(value);
+      if (src.kind == Location::NONE || src != location(phi))
+        moves.push_back({ location(phi), src, src.kind == Location::NONE ? constant(value) : Operand() });
+    }
   }
+
+  return moves;
 }
 
-void Generator::genFunction(FunctionDefinition const* func) {
-  out("%s: ; func\n", func->funcName.c_str());
+// Moves happen at once, so one whose destination is still to be read waits.
+// When all wait, they form cycles: one destination is put aside in eax
+void Generator::genMoves(std::vector<Move>& moves) {
+  moves.erase(
+    std::remove_if(moves.begin(), moves.end(), [](Move const& move) {
+      return move.src.kind != Location::NONE && move.src == move.dst;
+    }),
+    moves.end()
+  );
 
-  for (auto& st : func->body) {
-    switch (st.getType()) {
-      case StatementType::RETURN:
-        genExpression(&std::get<Statement::Return>(st.data).value, DEST_RETURN);
-        out("  ret\n");
-        break;
-      case StatementType::EXPR:
-        genExpression(&std::get<Expression>(st.data), DEST_NONE);
-        break;
-      case StatementType::BLOCK:
-        //todo
-        break;
+  while (!moves.empty()) {
+    auto ready = std::find_if(moves.begin(), moves.end(), [&moves](Move const& move) {
+      return std::none_of(moves.begin(), moves.end(), [&move](Move const& other) {
+        return &other != &move && other.src.kind != Location::NONE && other.src == move.dst;
+      });
+    });
+
+    if (ready == moves.end()) {
+      Location saved = moves.front().dst;
+      m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EAX), locationOperand(saved));
+
+      for (auto& move : moves) {
+        if (move.src.kind != Location::NONE && move.src == saved)
+          move.src = { Location::REGISTER, REG_EAX, 0 };
+      }
+      continue;
+    }
+
+    Move move = *ready;
+    moves.erase(ready);
+
+    Operand dst = locationOperand(move.dst);
+    if (move.src.kind == Location::NONE) {
+      m_code.emit(Mnemonic::MOV, dst, move.constant);
+    }
+    else if (move.src.kind == Location::STACK && move.dst.kind == Location::STACK) {
+      m_code.emit(Mnemonic::PUSH, locationOperand(move.src));
+      m_code.emit(Mnemonic::POP, dst);
+    }
+    else {
+      m_code.emit(Mnemonic::MOV, dst, locationOperand(move.src));
+    }
+  }
+}
+
+Operand Generator::operand(ValueRef value) {
+  Location const& loc = location(value);
+  if (loc.kind == Location::NONE)
+    return constant(value);
+  return locationOperand(loc);
+}
+
+Operand Generator::constant(ValueRef value) {
+  auto const& inst = m_func->insts[value];
+
+  switch (inst.op) {
+    case Opcode::CONST_INT: {
+      Type type = m_types->get(inst.type);
+      if (type.id == TID_NUMBER && type.number.width == 3)
+        m_code.error("64-BIT VALUES ARE NOT SUPPORTED");
+
+      return Operand::imm((int32_t)(uint32_t)inst.intValue);
     }
+
+    case Opcode::CONST_STRING: {
+      auto it = m_strings.find(value);
+      if (it == m_strings.end()) {
+        // zero terminated for imports that take C strings
+        std::string bytes(m_symbols->name(inst.string));
+        bytes.push_back('\0');
+        it = m_strings.emplace(value, m_literals.add(m_code, std::move(bytes))).first;
+      }
+      return Operand::address(it->second);
+    }
+
+    case Opcode::CONST_FLOAT:
+      m_code.error("FLOATS ARE NOT SUPPORTED");
+      return Operand::imm(0);
+
+    default:
+      // unused value, only seen without optimizations
+      return Operand::imm(0);
   }
 }
 
+Operand Generator::locationOperand(Location const& location) const {
+  if (location.kind == Location::REGISTER)
+    return Operand::reg32(location.reg);
+  return Operand::mem(REG_EBP, -(int32_t)(location.slot + 1) * 4);
+}
+
+void Generator::load(uint8_t reg, ValueRef value) {
+  Location const& loc = location(value);
+  if (loc.kind == Location::REGISTER && loc.reg == reg)
+    return;
+
+  m_code.emit(Mnemonic::MOV, Operand::reg32(reg), operand(value));
+}
+
+void Generator::store(Location const& dst, uint8_t reg) {
+  if (dst.kind == Location::NONE || (dst.kind == Location::REGISTER && dst.reg == reg))
+    return;
+
+  m_code.emit(Mnemonic::MOV, locationOperand(dst), Operand::reg32(reg));
+}
+
+void Generator::normalize(uint8_t reg, TypeRef type) {
+  Type info = m_types->get(type);
+
+  if (info.id == TID_FLOAT) {
+    m_code.error("FLOATS ARE NOT SUPPORTED");
+    return;
+  }
+
+  if (info.id != TID_NUMBER)
+    return;
+
+  Mnemonic extend = info.number.isSigned ? Mnemonic::MOVSX : Mnemonic::MOVZX;
+
+  switch (info.number.width) {
+    case 0:
+      // esi and edi have no byte parts
+      if (reg <= REG_EBX) {
+        m_code.emit(extend, Operand::reg32(reg), Operand::reg8(reg));
+      }
+      else {
+        m_code.emit(Mnemonic::MOV, Operand::reg32(REG_EAX), Operand::reg32(reg));
+        m_code.emit(extend, Operand::reg32(REG_EAX), Operand::reg8(REG_EAX));
+        m_code.emit(Mnemonic::MOV, Operand::reg32(reg), Operand::reg32(REG_EAX));
+      }
+      break;
+    case 1:
+      m_code.emit(extend, Operand::reg32(reg), Operand::reg16(reg));
+      break;
+    case 3:
+      m_code.error("64-BIT VALUES ARE NOT SUPPORTED");
+      break;
+  }
+}
+
+bool Generator::isSigned(TypeRef type) const {
+  Type info = m_types->get(type);
+  return info.id == TID_NUMBER && info.number.isSigned;
+}
+
+LabelRef Generator::global(std::string const& name) {
+  auto it = m_globals.find(name);
+  if (it == m_globals.end())
+    it = m_globals.emplace(name, m_code.label(name)).first;
+  return it->second;
+}
+
 void Generator::importProc(const char* libName, const char* procName) {
   std::string name = libName;
   std::transform(name.begin(), name.end(), name.begin(), toupper);
@@ -240,8 +799,38 @@ void Generator::importProc(const char* libName, const char* procName) {
     it->procedures.emplace_back(procName);
 }
 
+void Generator::placeData() {
+  m_literals.place(m_object, SECTION_RDATA);
+
+  // zeroes of reserved data only stay out of the file at the end
+  Section& data = m_object.sections[SECTION_DATA];
+  uint32_t reserved = 0;
+  for (auto const& item : m_data) {
+    if (!item.data.empty()) {
+      data.bytes.resize(data.bytes.size() + reserved, 0);
+      reserved = 0;
+    }
+
+    m_object.define(global(item.name), SECTION_DATA, (uint32_t)data.bytes.size() + reserved);
+    data.bytes.insert(data.bytes.end(), item.data.begin(), item.data.end());
+    reserved += item.reserved;
+  }
+  data.reserved = reserved;
+
+  for (auto const& lib : m_imports) {
+    for (auto const& procName : lib.procedures)
+      m_object.imports.push_back({ lib.libName, procName, global(procName) });
+  }
+
+  m_object.entry = global("__entry");
+}
+
 void Generator::useData(const char* name, const void* data, int length) {
-  m_data.push_back({ name, std::vector<uint8_t>((uint8_t*)data, ((uint8_t*)data) + length) });
+  m_data.push_back({ name, std::vector<uint8_t>((uint8_t*)data, ((uint8_t*)data) + length), 0 });
+}
+
+void Generator::reserveData(const char* name, int length) {
+  m_data.push_back({ name, {}, (uint32_t)length });
 }
 
 void Generator::out(const char* fmt, ...) {
@@ -1,8 +1,15 @@
 #pragma once
 
 #include <stdio.h>
+#include <list>
+#include <string>
+#include <unordered_map>
 #include <vector>
-#include "ast/ast.hpp"
+#include "encoder.hpp"
+#include "ir/ir.hpp"
+#include "literal_pool.hpp"
+#include "machine.hpp"
+#include "regalloc.hpp"
 
 namespace lon {
 
@@ -15,34 +22,106 @@ namespace lon {
   struct BinaryData {
     std::string name;
     std::vector<uint8_t> data;
+    uint32_t reserved; // zeroed bytes after data, not stored in the file
+  };
+
+  // One of moves that happen at once, src is NONE for constants
+  struct Move {
+    Location dst;
+    Location src;
+    Operand constant;
   };
 
   class Generator {
   private:
+    // of the program, print writes to the console when it fills up
+    static constexpr int32_t OUTPUT_BUFFER_SIZE = 4096;
+
     FILE* m_outFile;
+    MachineCode m_code;
+    ObjectCode m_object;
+    uint32_t m_rewrites; // by peephole
+    IRModule const* m_module;
+    SymbolTable const* m_symbols;
+    TypeTable const* m_types;
+
+    // current function
+    IRFunction const* m_func;
+    Allocation m_alloc;
+    std::vector<std::vector<BlockRef>> m_preds;
+    RegisterMask m_saved; // callee-saved registers it uses
+    bool m_tailCalled; // the return after a call was done by the callee
+    std::vector<LabelRef> m_blockLabels;
 
-    std::list<BinaryData> m_data;
+    std::unordered_map<Symbol, LabelRef> m_functions;
+    std::unordered_map<std::string, LabelRef> m_globals; // builtins and imports
+
+    std::list<BinaryData> m_data; // writable
+    LiteralPool m_literals; // read-only
     std::list<ImportLibrary> m_imports;
-    int m_stringsCount;
+
+    // string constants of the function in literals, by value
+    std::unordered_map<ValueRef, LabelRef> m_strings;
 
   public:
     Generator();
     ~Generator();
 
   public:
+    // Peephole optimizes instructions before writing them if optimize.
+    // The program is also encoded to object(), assembly is only written
+    // if outFile isn't null
     void generate(
-      AbstractSourceTree const& ast,
-      FILE* outFile
+      IRModule const& module,
+      FILE* outFile,
+      bool optimize = true
     );
 
+    inline uint32_t peepholeRewrites() const { return m_rewrites; }
+    inline ObjectCode const& object() const { return m_object; }
+
   private:
-    void genCall(const char* name, std::list<Expression> const& args, int dest);
-    void genLiteral(Literal const* lit, int dest);
-    void genExpression(Expression const* expr, int dest);
-    void genFunction(FunctionDefinition const* func);
+    // Output buffering, if print is used
+    void genBuiltins();
+    void genFunction(IRFunction const& func);
+    void genInstruction(ValueRef value, BlockRef block);
+    void genCall(ValueRef value);
+    bool genTailCall(ValueRef value);
+    void genBranch(std::vector<Move>& moves, BlockRef to, BlockRef next);
 
+    // Copies to phis of to on the edge from, without the ones already in place
+    std::vector<Move> phiMoves(BlockRef from, BlockRef to);
+    void genMoves(std::vector<Move>& moves);
+    void genEpilogue();
+    void genFrameExit();
+
+    // Bytes of arguments of a call that go on the stack
+    static int32_t stackArgsSize(size_t count);
+
+    // Argument or return address slot of the caller, offset from where
+    // the stack pointer was on entry
+    Operand incoming(int32_t offset) const;
+
+    // Register, stack slot or constant, as an instruction operand
+    Operand operand(ValueRef value);
+    Operand constant(ValueRef value);
+    Operand locationOperand(Location const& location) const;
+    inline Location const& location(ValueRef value) const { return m_alloc.locations[value]; }
+
+    void load(uint8_t reg, ValueRef value);
+    void store(Location const& dst, uint8_t reg);
+
+    // Brings reg back to the range of type after arithmetic
+    void normalize(uint8_t reg, TypeRef type);
+    bool isSigned(TypeRef type) const;
+
+    LabelRef global(std::string const& name);
     void importProc(const char* libName, const char* procName);
     void useData(const char* name, const void* data, int length);
+    void reserveData(const char* name, int length);
+
+    // Data, imports and entry point to m_object, after literals are laid out
+    void placeData();
     void out(const char* fmt, ...);
   };
 
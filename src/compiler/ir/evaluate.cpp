@@ -0,0 +1,440 @@
+#include "evaluate.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+using lon::BlockRef;
+using lon::EvaluationStats;
+using lon::Instruction;
+using lon::IRFunction;
+using lon::IRModule;
+using lon::Opcode;
+using lon::Symbol;
+using lon::ValueRef;
+
+namespace lon {
+
+  class Evaluator {
+  private:
+    // Functions take no parameters yet, so one run of a callee stands for
+    // all of its calls
+    struct Result {
+      enum State : uint8_t { UNKNOWN, DONE, FAILED };
+
+      State state;
+      uint64_t value; // canonical, 0 in void functions
+      std::vector<Symbol> prints; // arguments of print, in order
+    };
+
+    IRModule& m_module;
+
+    std::unordered_map<Symbol, uint32_t> m_index; // functions by name
+    std::vector<Result> m_results;
+    std::vector<uint8_t> m_evaluated;
+
+    // of the current run, except total
+    uint64_t m_steps = 0;
+    uint64_t m_total = 0;
+    size_t m_memory = 0;
+    bool m_limited = false; // failed on a limit, not on what the code does
+
+    std::vector<uint64_t> m_incoming; // phi values of the block entered
+
+    EvaluationStats m_stats = { 0, 0 };
+
+  public:
+    Evaluator(IRModule& module) : m_module(module) {}
+
+    EvaluationStats run() {
+      auto& functions = m_module.functions;
+      size_t count = functions.size();
+
+      for (uint32_t i = 0; i < count; ++i)
+        m_index[functions[i].name] = i;
+
+      m_results.assign(count, { Result::UNKNOWN, 0, {} });
+      m_evaluated.assign(count, 0);
+
+      // callees first, so a caller runs on their results instead of again
+      // through a whole chain of calls
+      for (uint32_t func : postOrder())
+        evaluate(func);
+
+      for (auto& func : functions) {
+        std::vector<uint32_t> targets(func.insts.size(), NO_VALUE);
+        bool any = false;
+
+        for (ValueRef value = 0; value < func.insts.size(); ++value) {
+          auto const& inst = func.insts[value];
+          uint32_t callee = inst.op == Opcode::CALL ? lookup(inst.call.callee) : NO_VALUE;
+          if (callee == NO_VALUE)
+            continue;
+
+          Result const& result = evaluate(callee);
+          if (result.state != Result::DONE || result.prints.size() > EVALUATION_PRINTS)
+            continue;
+
+          targets[value] = callee;
+          m_evaluated[callee] = 1;
+          m_stats.evaluated++;
+          any = true;
+        }
+
+        if (any)
+          replace(func, targets);
+      }
+
+      removeUnused();
+      return m_stats;
+    }
+
+  private:
+    uint32_t lookup(Symbol name) const {
+      auto it = m_index.find(name);
+      return it == m_index.end() ? NO_VALUE : it->second;
+    }
+
+    // Functions after all they call, except calls back up a cycle
+    std::vector<uint32_t> postOrder() const {
+      auto const& functions = m_module.functions;
+      size_t count = functions.size();
+
+      std::vector<uint32_t> order;
+      std::vector<uint8_t> seen(count, 0);
+      std::vector<std::pair<uint32_t, ValueRef>> stack; // function, next instruction
+
+      for (uint32_t root = 0; root < count; ++root) {
+        if (seen[root])
+          continue;
+        seen[root] = 1;
+        stack.push_back({ root, 0 });
+
+        while (!stack.empty()) {
+          uint32_t func = stack.back().first;
+          auto const& insts = functions[func].insts;
+          ValueRef& next = stack.back().second;
+
+          uint32_t callee = NO_VALUE;
+          while (next < insts.size() && callee == NO_VALUE) {
+            auto const& inst = insts[next++];
+            if (inst.op == Opcode::CALL) {
+              callee = lookup(inst.call.callee);
+              if (callee != NO_VALUE && seen[callee])
+                callee = NO_VALUE;
+            }
+          }
+
+          if (callee == NO_VALUE) {
+            order.push_back(func);
+            stack.pop_back();
+            continue;
+          }
+
+          seen[callee] = 1;
+          stack.push_back({ callee, 0 });
+        }
+      }
+
+      return order;
+    }
+
+    // Runs func with fresh limits unless it already ran
+    Result const& evaluate(uint32_t func) {
+      Result& result = m_results[func];
+      if (result.state != Result::UNKNOWN || m_total >= EVALUATION_TOTAL_STEPS)
+        return result;
+
+      m_steps = 0;
+      m_memory = 0;
+      m_limited = false;
+
+      uint64_t value;
+      std::vector<Symbol> prints;
+      if (!call(func, 0, value, prints))
+        result.state = Result::FAILED;
+      return result;
+    }
+
+    bool limit() {
+      m_limited = true;
+      return false;
+    }
+
+    // Result of func, its prints added to prints. Remembers how it ended
+    // unless that depends on limits left by the callers
+    bool call(uint32_t index, uint32_t depth, uint64_t& value, std::vector<Symbol>& prints) {
+      Result& result = m_results[index];
+
+      if (result.state == Result::FAILED)
+        return false;
+
+      if (result.state == Result::DONE) {
+        m_memory += result.prints.size();
+        if (m_memory > EVALUATION_MEMORY)
+          return limit();
+
+        prints.insert(prints.end(), result.prints.begin(), result.prints.end());
+        value = result.value;
+        return true;
+      }
+
+      if (depth >= EVALUATION_DEPTH)
+        return limit();
+
+      auto const& func = m_module.functions[index];
+      size_t size = func.insts.size();
+      if (m_memory + size > EVALUATION_MEMORY)
+        return limit();
+
+      m_memory += size;
+      std::vector<uint64_t> values(size, 0);
+      std::vector<Symbol> own;
+      bool ok = execute(func, depth, values, value, own);
+      m_memory -= size;
+
+      if (!ok) {
+        if (!m_limited)
+          result.state = Result::FAILED;
+        return false;
+      }
+
+      prints.insert(prints.end(), own.begin(), own.end());
+      result = { Result::DONE, value, std::move(own) };
+      return true;
+    }
+
+    bool execute(IRFunction const& func, uint32_t depth, std::vector<uint64_t>& values, uint64_t& returned, std::vector<Symbol>& prints) {
+      BlockRef block = 0;
+      BlockRef from = NO_VALUE;
+
+      for (;;) {
+        auto const& bb = func.blocks[block];
+        ValueRef value = bb.first;
+        ValueRef end = bb.first + bb.count;
+
+        // all phis read the values from before any of them is set
+        m_incoming.clear();
+        for (; value < end && func.insts[value].op == Opcode::PHI; ++value) {
+          auto const& list = func.insts[value].list;
+          uint32_t i = 0;
+          while (i < list.count && func.operand(list, i) != from)
+            i += 2;
+          if (i >= list.count)
+            return false;
+          m_incoming.push_back(values[func.operand(list, i + 1)]);
+        }
+        std::copy(m_incoming.begin(), m_incoming.end(), values.begin() + bb.first);
+
+        for (; value < end; ++value) {
+          if (++m_steps > EVALUATION_STEPS || ++m_total > EVALUATION_TOTAL_STEPS)
+            return limit();
+
+          auto const& inst = func.insts[value];
+          switch (inst.op) {
+            case Opcode::CONST_INT:
+              values[value] = inst.intValue;
+              break;
+
+            case Opcode::CONST_STRING:
+              values[value] = inst.string;
+              break;
+
+            case Opcode::CALL: {
+              if (inst.call.callee == SYM_PRINT) {
+                if (++m_memory > EVALUATION_MEMORY)
+                  return limit();
+                prints.push_back((Symbol)values[func.operand(inst.call.args, 0)]);
+                break;
+              }
+
+              uint32_t callee = lookup(inst.call.callee);
+              if (callee == NO_VALUE || !call(callee, depth + 1, values[value], prints))
+                return false;
+            } break;
+
+            case Opcode::RET:
+              returned = inst.args[0] != NO_VALUE ? values[inst.args[0]] : 0;
+              return true;
+
+            case Opcode::BR:
+              from = block;
+              block = inst.branch.target;
+              break;
+
+            case Opcode::BR_COND:
+              from = block;
+              block = values[inst.branch.cond] ? inst.branch.target : inst.branch.otherwise;
+              break;
+
+            case Opcode::CONST_FLOAT:
+            case Opcode::PHI:
+              return false;
+
+            default: {
+              // strings are compared by address at run time
+              if (func.insts[inst.args[0]].type == TYPE_STRING)
+                return false;
+
+              bool binary = inst.op >= Opcode::ADD && inst.op <= Opcode::CMP_GE;
+              uint64_t b = binary ? values[inst.args[1]] : 0;
+              if (!fold(*m_module.types, func, inst, values[inst.args[0]], b, values[value]))
+                return false;
+            } break;
+          }
+        }
+      }
+    }
+
+    // Rebuilds func with results in place of calls. Blocks stay, so only
+    // values are renumbered
+    void replace(IRFunction& func, std::vector<uint32_t> const& targets) {
+      std::vector<ValueRef> newIndex(func.insts.size(), NO_VALUE);
+      ValueRef count = 0;
+
+      for (ValueRef value = 0; value < func.insts.size(); ++value) {
+        if (targets[value] == NO_VALUE) {
+          newIndex[value] = count++;
+          continue;
+        }
+
+        count += 2 * (ValueRef)m_results[targets[value]].prints.size();
+        if (func.insts[value].type != TYPE_VOID)
+          newIndex[value] = count++;
+      }
+
+      std::vector<Instruction> insts;
+      insts.reserve(count);
+
+      for (auto& bb : func.blocks) {
+        ValueRef first = bb.first;
+        ValueRef end = bb.first + bb.count;
+        bb.first = (uint32_t)insts.size();
+
+        for (ValueRef value = first; value < end; ++value) {
+          Instruction inst = func.insts[value];
+
+          if (targets[value] == NO_VALUE) {
+            remap(func, inst, newIndex);
+            insts.push_back(inst);
+            continue;
+          }
+
+          for (Symbol string : m_results[targets[value]].prints) {
+            Instruction constant;
+            constant.op = Opcode::CONST_STRING;
+            constant.type = TYPE_STRING;
+            constant.string = string;
+            insts.push_back(constant);
+
+            Instruction print;
+            print.op = Opcode::CALL;
+            print.type = TYPE_VOID;
+            print.call = { SYM_PRINT, { (uint32_t)func.operands.size(), 1 } };
+            func.operands.push_back((ValueRef)insts.size() - 1);
+            insts.push_back(print);
+          }
+
+          if (inst.type != TYPE_VOID) {
+            Instruction constant;
+            constant.op = Opcode::CONST_INT;
+            constant.type = inst.type;
+            constant.intValue = m_results[targets[value]].value;
+            insts.push_back(constant);
+          }
+        }
+
+        bb.count = (uint32_t)insts.size() - bb.first;
+      }
+
+      func.insts.swap(insts);
+    }
+
+    // Points values inst uses at their new numbers, lists are changed in place
+    static void remap(IRFunction& func, Instruction& inst, std::vector<ValueRef> const& newIndex) {
+      switch (inst.op) {
+        case Opcode::CONST_INT:
+        case Opcode::CONST_FLOAT:
+        case Opcode::CONST_STRING:
+        case Opcode::BR:
+          break;
+
+        case Opcode::PHI:
+          for (uint32_t i = 1; i < inst.list.count; i += 2)
+            func.operands[inst.list.first + i] = newIndex[func.operands[inst.list.first + i]];
+          break;
+
+        case Opcode::CALL:
+          for (uint32_t i = 0; i < inst.call.args.count; ++i)
+            func.operands[inst.call.args.first + i] = newIndex[func.operands[inst.call.args.first + i]];
+          break;
+
+        case Opcode::BR_COND:
+          inst.branch.cond = newIndex[inst.branch.cond];
+          break;
+
+        case Opcode::RET:
+          if (inst.args[0] != NO_VALUE)
+            inst.args[0] = newIndex[inst.args[0]];
+          break;
+
+        case Opcode::NEG:
+        case Opcode::NOT:
+        case Opcode::CAST:
+          inst.args[0] = newIndex[inst.args[0]];
+          break;
+
+        default:
+          inst.args[0] = newIndex[inst.args[0]];
+          inst.args[1] = newIndex[inst.args[1]];
+          break;
+      }
+    }
+
+    // Evaluated functions stay while something still calls them
+    void removeUnused() {
+      auto& functions = m_module.functions;
+      size_t count = functions.size();
+      Symbol main = m_module.symbols->find("main");
+
+      std::vector<uint8_t> kept(count, 0);
+      std::vector<uint32_t> work;
+
+      for (uint32_t i = 0; i < count; ++i) {
+        if (!m_evaluated[i] || functions[i].name == main) {
+          kept[i] = 1;
+          work.push_back(i);
+        }
+      }
+
+      while (!work.empty()) {
+        uint32_t func = work.back();
+        work.pop_back();
+
+        for (auto const& inst : functions[func].insts) {
+          uint32_t callee = inst.op == Opcode::CALL ? lookup(inst.call.callee) : NO_VALUE;
+          if (callee != NO_VALUE && !kept[callee]) {
+            kept[callee] = 1;
+            work.push_back(callee);
+          }
+        }
+      }
+
+      size_t next = 0;
+      for (uint32_t i = 0; i < count; ++i) {
+        if (!kept[i]) {
+          m_stats.removed++;
+          continue;
+        }
+        if (next != i)
+          functions[next] = std::move(functions[i]);
+        next++;
+      }
+      functions.resize(next);
+    }
+  };
+
+} // namespace lon
+
+EvaluationStats lon::evaluateCalls(IRModule& module) {
+  return Evaluator(module).run();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ir.hpp"
+
+namespace lon {
+
+  // Limits of running one call at compile time, a call past them stays
+  constexpr uint64_t EVALUATION_STEPS = 1 << 20; // instructions executed
+  constexpr uint32_t EVALUATION_DEPTH = 256; // nested calls
+  constexpr size_t EVALUATION_MEMORY = 1 << 20; // values and prints held at once
+  constexpr uint32_t EVALUATION_PRINTS = 16; // replayed in place of a call
+
+  // Of all calls together, so many slow calls can't stall compilation
+  constexpr uint64_t EVALUATION_TOTAL_STEPS = 1 << 24;
+
+  struct EvaluationStats {
+    uint32_t evaluated; // calls replaced by results
+    uint32_t removed; // functions left without calls
+  };
+
+  // Runs callees at compile time in an interpreter over the IR and replaces
+  // every call that finishes within the limits with the constant it
+  // returned. Strings it printed are printed in place of the call, in the
+  // same order. Calls of functions that use floats, trap or recurse past the
+  // limits stay. Evaluated functions nothing calls anymore are removed,
+  // except main
+  EvaluationStats evaluateCalls(IRModule& module);
+
+} // namespace lon
@@ -0,0 +1,443 @@
+#include "inline.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+using lon::BlockRef;
+using lon::Instruction;
+using lon::InliningStats;
+using lon::IRFunction;
+using lon::IRModule;
+using lon::Opcode;
+using lon::Symbol;
+using lon::ValueRef;
+
+namespace lon {
+
+  class Inliner {
+  private:
+    // callers grow to at most this many times the threshold
+    static constexpr uint64_t CALLER_BUDGET = 64;
+
+    // of a function after its own calls were inlined
+    struct Summary {
+      uint32_t cost; // instructions, constants are free
+      uint32_t rets;
+      bool leaf; // calls only builtins
+    };
+
+    IRModule& m_module;
+    uint32_t m_threshold;
+
+    std::unordered_map<Symbol, uint32_t> m_index; // functions by name
+    std::vector<std::vector<uint32_t>> m_callees; // distinct
+
+    // strongly connected components of the call graph, a component comes
+    // after every component it calls
+    std::vector<uint32_t> m_component;
+    std::vector<uint32_t> m_order;
+
+    std::vector<uint32_t> m_sites; // calls of every function
+    std::vector<Summary> m_summaries;
+    std::vector<uint8_t> m_inlined;
+
+    InliningStats m_stats = { 0, 0 };
+
+  public:
+    Inliner(IRModule& module, uint32_t threshold) : m_module(module), m_threshold(threshold) {}
+
+    InliningStats run() {
+      buildCallGraph();
+      findComponents();
+
+      for (uint32_t func : m_order) {
+        inlineInto(func);
+        m_summaries[func] = summarize(m_module.functions[func]);
+      }
+
+      removeUnused();
+      return m_stats;
+    }
+
+  private:
+    uint32_t lookup(Symbol name) const {
+      auto it = m_index.find(name);
+      return it == m_index.end() ? NO_VALUE : it->second;
+    }
+
+    void buildCallGraph() {
+      auto const& functions = m_module.functions;
+      size_t count = functions.size();
+
+      for (uint32_t i = 0; i < count; ++i)
+        m_index[functions[i].name] = i;
+
+      m_callees.assign(count, {});
+      m_sites.assign(count, 0);
+      m_summaries.assign(count, { 0, 0, false });
+      m_inlined.assign(count, 0);
+
+      for (uint32_t i = 0; i < count; ++i) {
+        for (auto const& inst : functions[i].insts) {
+          uint32_t callee = inst.op == Opcode::CALL ? lookup(inst.call.callee) : NO_VALUE;
+          if (callee == NO_VALUE)
+            continue;
+
+          m_sites[callee]++;
+          m_callees[i].push_back(callee);
+        }
+
+        auto& callees = m_callees[i];
+        std::sort(callees.begin(), callees.end());
+        callees.erase(std::unique(callees.begin(), callees.end()), callees.end());
+      }
+    }
+
+    // Tarjan, with an explicit stack for long call chains
+    void findComponents() {
+      size_t count = m_module.functions.size();
+      std::vector<uint32_t> index(count, NO_VALUE);
+      std::vector<uint32_t> low(count, 0);
+      std::vector<uint8_t> onStack(count, 0);
+      std::vector<uint32_t> stack;
+      std::vector<std::pair<uint32_t, size_t>> frames;
+      uint32_t clock = 0;
+      uint32_t components = 0;
+
+      m_component.assign(count, NO_VALUE);
+      m_order.clear();
+
+      auto visit = [&](uint32_t func) {
+        index[func] = low[func] = clock++;
+        stack.push_back(func);
+        onStack[func] = 1;
+        frames.push_back({ func, 0 });
+      };
+
+      for (uint32_t root = 0; root < count; ++root) {
+        if (index[root] != NO_VALUE)
+          continue;
+        visit(root);
+
+        while (!frames.empty()) {
+          uint32_t func = frames.back().first;
+          auto const& callees = m_callees[func];
+
+          if (frames.back().second < callees.size()) {
+            uint32_t callee = callees[frames.back().second++];
+            if (index[callee] == NO_VALUE)
+              visit(callee);
+            else if (onStack[callee])
+              low[func] = std::min(low[func], index[callee]);
+            continue;
+          }
+
+          frames.pop_back();
+          if (!frames.empty())
+            low[frames.back().first] = std::min(low[frames.back().first], low[func]);
+
+          if (low[func] != index[func])
+            continue;
+
+          uint32_t member;
+          do {
+            member = stack.back();
+            stack.pop_back();
+            onStack[member] = 0;
+            m_component[member] = components;
+            m_order.push_back(member);
+          } while (member != func);
+          components++;
+        }
+      }
+    }
+
+    Summary summarize(IRFunction const& func) const {
+      Summary result = { 0, 0, true };
+
+      for (auto const& inst : func.insts) {
+        if (inst.op > Opcode::CONST_STRING)
+          result.cost++;
+        if (inst.op == Opcode::RET)
+          result.rets++;
+        if (inst.op == Opcode::CALL && lookup(inst.call.callee) != NO_VALUE)
+          result.leaf = false;
+      }
+
+      return result;
+    }
+
+    void inlineInto(uint32_t caller) {
+      auto& func = m_module.functions[caller];
+      uint64_t cost = summarize(func).cost;
+      uint64_t budget = (uint64_t)m_threshold * CALLER_BUDGET;
+
+      // callee of every inlined call
+      std::vector<uint32_t> targets(func.insts.size(), NO_VALUE);
+      bool any = false;
+
+      for (ValueRef value = 0; value < func.insts.size(); ++value) {
+        auto const& inst = func.insts[value];
+        uint32_t callee = inst.op == Opcode::CALL ? lookup(inst.call.callee) : NO_VALUE;
+        if (callee == NO_VALUE || m_component[callee] == m_component[caller])
+          continue;
+
+        // a function that never returns has nothing to continue with
+        Summary const& summary = m_summaries[callee];
+        if (summary.rets == 0)
+          continue;
+
+        bool small = summary.leaf && summary.cost <= m_threshold;
+        bool single = m_sites[callee] == 1;
+        if (!(small || single) || cost + summary.cost > budget)
+          continue;
+
+        targets[value] = callee;
+        cost += summary.cost;
+        any = true;
+
+        // its calls are now made from here too
+        m_sites[callee]--;
+        for (auto const& calleeInst : m_module.functions[callee].insts) {
+          uint32_t called = calleeInst.op == Opcode::CALL ? lookup(calleeInst.call.callee) : NO_VALUE;
+          if (called != NO_VALUE)
+            m_sites[called]++;
+        }
+
+        m_inlined[callee] = 1;
+        m_stats.inlined++;
+      }
+
+      if (any)
+        splice(func, targets);
+    }
+
+    // Copy of inst with lists moved to operands, values and blocks mapped
+    template <typename Values, typename Targets, typename Preds>
+    static Instruction copy(
+      IRFunction const& from, Instruction inst, std::vector<uint32_t>& operands,
+      Values value, Targets target, Preds pred
+    ) {
+      switch (inst.op) {
+        case Opcode::CONST_INT:
+        case Opcode::CONST_FLOAT:
+        case Opcode::CONST_STRING:
+          break;
+
+        case Opcode::PHI: {
+          Instruction::List list = { (uint32_t)operands.size(), inst.list.count };
+          for (uint32_t i = 0; i < inst.list.count; i += 2) {
+            operands.push_back(pred(from.operand(inst.list, i)));
+            operands.push_back(value(from.operand(inst.list, i + 1)));
+          }
+          inst.list = list;
+        } break;
+
+        case Opcode::CALL: {
+          Instruction::List args = { (uint32_t)operands.size(), inst.call.args.count };
+          for (uint32_t i = 0; i < inst.call.args.count; ++i)
+            operands.push_back(value(from.operand(inst.call.args, i)));
+          inst.call.args = args;
+        } break;
+
+        case Opcode::RET:
+          if (inst.args[0] != NO_VALUE)
+            inst.args[0] = value(inst.args[0]);
+          break;
+
+        case Opcode::BR:
+          inst.branch.target = target(inst.branch.target);
+          break;
+
+        case Opcode::BR_COND:
+          inst.branch.cond = value(inst.branch.cond);
+          inst.branch.target = target(inst.branch.target);
+          inst.branch.otherwise = target(inst.branch.otherwise);
+          break;
+
+        case Opcode::NEG:
+        case Opcode::NOT:
+        case Opcode::CAST:
+          inst.args[0] = value(inst.args[0]);
+          break;
+
+        default:
+          inst.args[0] = value(inst.args[0]);
+          inst.args[1] = value(inst.args[1]);
+          break;
+      }
+
+      return inst;
+    }
+
+    // Rebuilds func with bodies in place of calls. A block with a call ends
+    // with a jump to the copied body, whose returns jump to a new block with
+    // the rest. Arguments are left to dead code elimination, bodies can't
+    // refer to parameters yet
+    void splice(IRFunction& func, std::vector<uint32_t> const& targets) {
+      auto const& functions = m_module.functions;
+      size_t blocksCount = func.blocks.size();
+
+      // numbers first, then instructions, so operands can refer forward.
+      // Jumps go to the first part of a split block, phis come from its last
+      std::vector<BlockRef> firstPart(blocksCount);
+      std::vector<BlockRef> lastPart(blocksCount);
+      std::vector<ValueRef> newIndex(func.insts.size(), NO_VALUE);
+      ValueRef count = 0;
+      BlockRef blocks = 0;
+
+      for (BlockRef block = 0; block < blocksCount; ++block) {
+        auto const& bb = func.blocks[block];
+        firstPart[block] = blocks++;
+
+        for (ValueRef value = bb.first; value < bb.first + bb.count; ++value) {
+          if (targets[value] == NO_VALUE) {
+            newIndex[value] = count++;
+            continue;
+          }
+
+          auto const& callee = functions[targets[value]];
+          ValueRef base = count + 1;
+          count = base + (ValueRef)callee.insts.size();
+          blocks += (BlockRef)callee.blocks.size() + 1;
+
+          if (callee.returnType == TYPE_VOID)
+            continue;
+
+          // one return gives its value directly, more meet in a phi
+          if (m_summaries[targets[value]].rets == 1) {
+            auto it = std::find_if(callee.insts.begin(), callee.insts.end(),
+              [](Instruction const& inst) { return inst.op == Opcode::RET; });
+            newIndex[value] = base + it->args[0];
+          }
+          else {
+            newIndex[value] = count++;
+          }
+        }
+
+        lastPart[block] = blocks - 1;
+      }
+
+      std::vector<Instruction> insts;
+      std::vector<BasicBlock> newBlocks;
+      std::vector<uint32_t> operands;
+      insts.reserve(count);
+      newBlocks.reserve(blocks);
+
+      for (BlockRef block = 0; block < blocksCount; ++block) {
+        auto const& bb = func.blocks[block];
+        newBlocks.push_back({ (uint32_t)insts.size(), 0 });
+
+        for (ValueRef value = bb.first; value < bb.first + bb.count; ++value) {
+          if (targets[value] == NO_VALUE) {
+            insts.push_back(copy(func, func.insts[value], operands,
+              [&](ValueRef used) { return newIndex[used]; },
+              [&](BlockRef to) { return firstPart[to]; },
+              [&](BlockRef from) { return lastPart[from]; }));
+            newBlocks.back().count++;
+            continue;
+          }
+
+          auto const& callee = functions[targets[value]];
+          ValueRef base = (ValueRef)insts.size() + 1;
+          BlockRef blockBase = (BlockRef)newBlocks.size();
+          BlockRef rest = blockBase + (BlockRef)callee.blocks.size();
+
+          Instruction jump;
+          jump.op = Opcode::BR;
+          jump.type = TYPE_VOID;
+          jump.branch = { NO_VALUE, blockBase, NO_VALUE };
+          insts.push_back(jump);
+          newBlocks.back().count++;
+
+          auto offsetValue = [&](ValueRef used) { return base + used; };
+          auto offsetBlock = [&](BlockRef other) { return blockBase + other; };
+          std::vector<uint32_t> returned; // (block, value) pairs
+
+          for (BlockRef calleeBlock = 0; calleeBlock < callee.blocks.size(); ++calleeBlock) {
+            auto const& calleeBB = callee.blocks[calleeBlock];
+            newBlocks.push_back({ base + calleeBB.first, calleeBB.count });
+
+            for (ValueRef calleeValue = calleeBB.first; calleeValue < calleeBB.first + calleeBB.count; ++calleeValue) {
+              Instruction inst = copy(callee, callee.insts[calleeValue], operands, offsetValue, offsetBlock, offsetBlock);
+
+              if (inst.op == Opcode::RET) {
+                if (inst.args[0] != NO_VALUE) {
+                  returned.push_back(blockBase + calleeBlock);
+                  returned.push_back(inst.args[0]);
+                }
+                inst.op = Opcode::BR;
+                inst.branch = { NO_VALUE, rest, NO_VALUE };
+              }
+
+              insts.push_back(inst);
+            }
+          }
+
+          newBlocks.push_back({ (uint32_t)insts.size(), 0 });
+
+          if (returned.size() > 2) {
+            Instruction phi;
+            phi.op = Opcode::PHI;
+            phi.type = callee.returnType;
+            phi.list = { (uint32_t)operands.size(), (uint32_t)returned.size() };
+            operands.insert(operands.end(), returned.begin(), returned.end());
+            insts.push_back(phi);
+            newBlocks.back().count++;
+          }
+        }
+      }
+
+      func.insts.swap(insts);
+      func.blocks.swap(newBlocks);
+      func.operands.swap(operands);
+    }
+
+    // Functions calls were inlined from stay while something still calls them
+    void removeUnused() {
+      auto& functions = m_module.functions;
+      size_t count = functions.size();
+      Symbol main = m_module.symbols->find("main");
+
+      std::vector<uint8_t> kept(count, 0);
+      std::vector<uint32_t> work;
+
+      for (uint32_t i = 0; i < count; ++i) {
+        if (!m_inlined[i] || functions[i].name == main) {
+          kept[i] = 1;
+          work.push_back(i);
+        }
+      }
+
+      while (!work.empty()) {
+        uint32_t func = work.back();
+        work.pop_back();
+
+        for (auto const& inst : functions[func].insts) {
+          uint32_t callee = inst.op == Opcode::CALL ? lookup(inst.call.callee) : NO_VALUE;
+          if (callee != NO_VALUE && !kept[callee]) {
+            kept[callee] = 1;
+            work.push_back(callee);
+          }
+        }
+      }
+
+      size_t next = 0;
+      for (uint32_t i = 0; i < count; ++i) {
+        if (!kept[i]) {
+          m_stats.removed++;
+          continue;
+        }
+        if (next != i)
+          functions[next] = std::move(functions[i]);
+        next++;
+      }
+      functions.resize(next);
+    }
+  };
+
+} // namespace lon
+
+InliningStats lon::inlineCalls(IRModule& module, uint32_t threshold) {
+  return Inliner(module, threshold).run();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "ir.hpp"
+
+namespace lon {
+
+  // Default of --inline-threshold, in instructions
+  constexpr uint32_t DEFAULT_INLINE_THRESHOLD = 24;
+
+  struct InliningStats {
+    uint32_t inlined; // calls replaced by bodies
+    uint32_t removed; // functions left without calls
+  };
+
+  // Replaces calls with bodies of callees, bottom-up over the call graph, so
+  // a callee already has its own calls inlined. Callees without calls of
+  // their own up to threshold instructions are inlined everywhere, callees
+  // called once regardless of size. Callers don't grow past 64 times the
+  // threshold, calls inside a cycle of the call graph (recursion) stay.
+  // Inlined functions nothing calls anymore are removed, except main
+  InliningStats inlineCalls(IRModule& module, uint32_t threshold);
+
+} // namespace lon
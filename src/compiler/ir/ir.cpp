@@ -0,0 +1,250 @@
+#include "ir.hpp"
+
+#include <inttypes.h>
+
+using lon::BlockRef;
+using lon::Instruction;
+using lon::IRFunction;
+using lon::IRModule;
+using lon::Opcode;
+using lon::Type;
+using lon::TypeRef;
+using lon::TypeTable;
+
+int IRFunction::successors(BlockRef block, BlockRef out[2]) const {
+  BasicBlock const& bb = blocks[block];
+  if (bb.count == 0)
+    return 0;
+
+  Instruction const& last = insts[bb.first + bb.count - 1];
+
+  switch (last.op) {
+    case Opcode::BR:
+      out[0] = last.branch.target;
+      return 1;
+    case Opcode::BR_COND:
+      out[0] = last.branch.target;
+      out[1] = last.branch.otherwise;
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+std::vector<std::vector<BlockRef>> IRFunction::predecessors() const {
+  std::vector<std::vector<BlockRef>> result(blocks.size());
+
+  for (BlockRef block = 0; block < blocks.size(); ++block) {
+    BlockRef targets[2];
+    int count = successors(block, targets);
+
+    for (int i = 0; i < count; ++i) {
+      // both edges of a branch may go to the same block, that's one predecessor
+      if (i == 1 && targets[1] == targets[0])
+        break;
+      result[targets[i]].push_back(block);
+    }
+  }
+
+  return result;
+}
+
+std::string lon::irTypeName(TypeTable const& types, TypeRef type) {
+  Type info = types.get(type);
+
+  switch (info.id) {
+    case TID_VOID: return "void";
+    case TID_BOOLEAN: return "bool";
+    case TID_STRING: return "string";
+    case TID_CHAR: return "char";
+    case TID_FLOAT: return "f" + std::to_string(8 << info.number.width);
+    case TID_NUMBER:
+      return (info.number.isSigned ? "i" : "u") + std::to_string(8 << info.number.width);
+  }
+
+  return types.name(type);
+}
+
+uint64_t lon::canonicalInt(uint64_t value, Type const& type) {
+  if (type.id == TID_BOOLEAN)
+    return value != 0;
+
+  int bits = 8 << type.number.width;
+  if (bits == 64)
+    return value;
+
+  uint64_t mask = (1ull << bits) - 1;
+  value &= mask;
+  if (type.number.isSigned && (value >> (bits - 1)))
+    value |= ~mask;
+  return value;
+}
+
+bool lon::fold(TypeTable const& types, IRFunction const& func, Instruction const& inst, uint64_t a, uint64_t b, uint64_t& result) {
+  Type type = types.get(inst.type);
+  if (type.id == TID_FLOAT)
+    return false;
+
+  bool isSigned = type.id == TID_NUMBER && type.number.isSigned;
+
+  switch (inst.op) {
+    case Opcode::ADD: result = canonicalInt(a + b, type); return true;
+    case Opcode::SUB: result = canonicalInt(a - b, type); return true;
+    case Opcode::MUL: result = canonicalInt(a * b, type); return true;
+    case Opcode::NEG: result = canonicalInt(0 - a, type); return true;
+    case Opcode::NOT: result = a ^ 1; return true;
+
+    case Opcode::DIV:
+    case Opcode::MOD:
+      // both trap at run time
+      if (b == 0)
+        return false;
+      if (isSigned && (int64_t)b == -1 && a == canonicalInt(1ull << ((8 << type.number.width) - 1), type))
+        return false;
+
+      if (isSigned) {
+        int64_t x = (int64_t)a, y = (int64_t)b;
+        result = canonicalInt(inst.op == Opcode::DIV ? x / y : x % y, type);
+      }
+      else {
+        result = inst.op == Opcode::DIV ? a / b : a % b;
+      }
+      return true;
+
+    case Opcode::CAST: {
+      Type source = types.get(func.insts[inst.args[0]].type);
+      if (source.id == TID_FLOAT)
+        return false;
+      result = canonicalInt(a, type);
+    } return true;
+
+    default:
+      break;
+  }
+
+  // comparisons
+  Type operands = types.get(func.insts[inst.args[0]].type);
+  if (operands.id == TID_FLOAT)
+    return false;
+
+  bool less, equal = a == b;
+  if (operands.id == TID_NUMBER && operands.number.isSigned)
+    less = (int64_t)a < (int64_t)b;
+  else
+    less = a < b;
+
+  switch (inst.op) {
+    case Opcode::CMP_EQ: result = equal; break;
+    case Opcode::CMP_NE: result = !equal; break;
+    case Opcode::CMP_LT: result = less; break;
+    case Opcode::CMP_LE: result = less || equal; break;
+    case Opcode::CMP_GT: result = !less && !equal; break;
+    case Opcode::CMP_GE: result = !less; break;
+    default: return false;
+  }
+
+  return true;
+}
+
+const char* lon::opcodeName(Opcode op) {
+  switch (op) {
+    case Opcode::CONST_INT: return "const";
+    case Opcode::CONST_FLOAT: return "const";
+    case Opcode::CONST_STRING: return "const";
+    case Opcode::ADD: return "add";
+    case Opcode::SUB: return "sub";
+    case Opcode::MUL: return "mul";
+    case Opcode::DIV: return "div";
+    case Opcode::MOD: return "mod";
+    case Opcode::CMP_EQ: return "eq";
+    case Opcode::CMP_NE: return "ne";
+    case Opcode::CMP_LT: return "lt";
+    case Opcode::CMP_LE: return "le";
+    case Opcode::CMP_GT: return "gt";
+    case Opcode::CMP_GE: return "ge";
+    case Opcode::NEG: return "neg";
+    case Opcode::NOT: return "not";
+    case Opcode::CAST: return "cast";
+    case Opcode::PHI: return "phi";
+    case Opcode::CALL: return "call";
+    case Opcode::RET: return "ret";
+    case Opcode::BR: return "br";
+    case Opcode::BR_COND: return "br";
+  }
+
+  return "?";
+}
+
+void IRModule::dump(FILE* out) const {
+  for (auto const& func : functions) {
+    fprintf(out, "function %s(", symbols->cname(func.name));
+    for (size_t i = 0; i < func.params.size(); ++i)
+      fprintf(out, "%s%s", i == 0 ? "" : ", ", irTypeName(*types, func.params[i]).c_str());
+    fprintf(out, ") -> %s {\n", irTypeName(*types, func.returnType).c_str());
+
+    for (BlockRef block = 0; block < func.blocks.size(); ++block) {
+      fprintf(out, "b%u:\n", block);
+
+      BasicBlock const& bb = func.blocks[block];
+      for (uint32_t value = bb.first; value < bb.first + bb.count; ++value) {
+        Instruction const& inst = func.insts[value];
+
+        fprintf(out, "  ");
+        if (inst.type != TYPE_VOID)
+          fprintf(out, "%%%u = %s ", value, irTypeName(*types, inst.type).c_str());
+        fprintf(out, "%s", opcodeName(inst.op));
+
+        switch (inst.op) {
+          case Opcode::CONST_INT:
+            fprintf(out, " %" PRId64, (int64_t)inst.intValue);
+            break;
+          case Opcode::CONST_FLOAT:
+            fprintf(out, " %g", inst.fltValue);
+            break;
+          case Opcode::CONST_STRING:
+            fprintf(out, " \"%s\"", symbols->cname(inst.string));
+            break;
+
+          case Opcode::PHI:
+            for (uint32_t i = 0; i < inst.list.count; i += 2) {
+              fprintf(out, "%s [b%u, %%%u]", i == 0 ? "" : ",",
+                func.operand(inst.list, i), func.operand(inst.list, i + 1));
+            }
+            break;
+
+          case Opcode::CALL:
+            fprintf(out, " %s(", symbols->cname(inst.call.callee));
+            for (uint32_t i = 0; i < inst.call.args.count; ++i)
+              fprintf(out, "%s%%%u", i == 0 ? "" : ", ", func.operand(inst.call.args, i));
+            fprintf(out, ")");
+            break;
+
+          case Opcode::RET:
+            if (inst.args[0] != NO_VALUE)
+              fprintf(out, " %%%u", inst.args[0]);
+            break;
+          case Opcode::BR:
+            fprintf(out, " b%u", inst.branch.target);
+            break;
+          case Opcode::BR_COND:
+            fprintf(out, " %%%u, b%u, b%u", inst.branch.cond, inst.branch.target, inst.branch.otherwise);
+            break;
+
+          case Opcode::NEG:
+          case Opcode::NOT:
+          case Opcode::CAST:
+            fprintf(out, " %%%u", inst.args[0]);
+            break;
+
+          default:
+            fprintf(out, " %%%u, %%%u", inst.args[0], inst.args[1]);
+            break;
+        }
+
+        fprintf(out, "\n");
+      }
+    }
+
+    fprintf(out, "}\n");
+  }
+}
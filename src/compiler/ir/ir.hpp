@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "../symbols.hpp"
+#include "../type_table.hpp"
+
+namespace lon {
+
+  // SSA value, index of the instruction that defines it in IRFunction::insts
+  using ValueRef = uint32_t;
+
+  // Index in IRFunction::blocks
+  using BlockRef = uint32_t;
+
+  constexpr ValueRef NO_VALUE = 0xFFFFFFFF;
+
+  enum class Opcode : uint8_t {
+    CONST_INT, // intValue
+    CONST_FLOAT, // fltValue
+    CONST_STRING, // string
+
+    // args[0], args[1], operands and result have the same type
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+
+    // args[0], args[1] of the same type, boolean result
+    CMP_EQ,
+    CMP_NE,
+    CMP_LT,
+    CMP_LE,
+    CMP_GT,
+    CMP_GE,
+
+    NEG, // args[0] number
+    NOT, // args[0] boolean
+    CAST, // args[0] to any other number or from boolean
+
+    PHI, // list of (block, value) pairs, one per predecessor
+    CALL, // call.callee, list of arguments
+
+    // terminators, last instruction of every block
+    RET, // args[0] or NO_VALUE in void functions
+    BR, // branch.target
+    BR_COND, // branch.cond, branch.target if true, branch.otherwise if false
+  };
+
+  struct Instruction {
+    struct List {
+      uint32_t first; // in IRFunction::operands
+      uint32_t count;
+    };
+
+    struct Call {
+      Symbol callee;
+      List args;
+    };
+
+    struct Branch {
+      ValueRef cond;
+      BlockRef target;
+      BlockRef otherwise;
+    };
+
+    Opcode op;
+    TypeRef type; // TYPE_VOID if instruction has no value
+    union {
+      ValueRef args[2];
+      uint64_t intValue;
+      double fltValue;
+      Symbol string;
+      List list; // PHI
+      Call call;
+      Branch branch;
+    };
+
+    bool isTerminator() const noexcept { return op >= Opcode::RET; }
+  };
+
+  // Instructions [first, first + count) of the function, phis go first.
+  // Blocks don't interleave, so a function is one array walked in order
+  struct BasicBlock {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  struct IRFunction {
+    Symbol name;
+    TypeRef returnType;
+    std::vector<TypeRef> params;
+
+    std::vector<Instruction> insts;
+    std::vector<BasicBlock> blocks; // entry first
+    std::vector<uint32_t> operands; // variable length lists of instructions
+
+    inline Instruction const& inst(ValueRef value) const { return insts[value]; }
+    inline uint32_t operand(Instruction::List list, uint32_t i) const { return operands[list.first + i]; }
+
+    // Calls fn(ValueRef) for every value inst uses, all phi values included
+    template <typename Fn>
+    void forEachOperand(Instruction const& inst, Fn&& fn) const {
+      switch (inst.op) {
+        case Opcode::CONST_INT:
+        case Opcode::CONST_FLOAT:
+        case Opcode::CONST_STRING:
+        case Opcode::BR:
+          break;
+        case Opcode::PHI:
+          for (uint32_t i = 1; i < inst.list.count; i += 2)
+            fn(operand(inst.list, i));
+          break;
+        case Opcode::CALL:
+          for (uint32_t i = 0; i < inst.call.args.count; ++i)
+            fn(operand(inst.call.args, i));
+          break;
+        case Opcode::BR_COND:
+          fn(inst.branch.cond);
+          break;
+        case Opcode::RET:
+          if (inst.args[0] != NO_VALUE)
+            fn(inst.args[0]);
+          break;
+        case Opcode::NEG:
+        case Opcode::NOT:
+        case Opcode::CAST:
+          fn(inst.args[0]);
+          break;
+        default:
+          fn(inst.args[0]);
+          fn(inst.args[1]);
+          break;
+      }
+    }
+
+    // Blocks a terminator may jump to, returns their count (0 to 2)
+    int successors(BlockRef block, BlockRef out[2]) const;
+
+    // Predecessors of every block, in order of blocks
+    std::vector<std::vector<BlockRef>> predecessors() const;
+  };
+
+  struct IRModule {
+    SymbolTable* symbols;
+    TypeTable* types;
+
+    // in source order
+    std::vector<IRFunction> functions;
+
+    // Textual form, for debugging
+    void dump(FILE* out) const;
+  };
+
+  // Short type name for dumps and diagnostics ("i32", "bool")
+  std::string irTypeName(TypeTable const& types, TypeRef type);
+
+  const char* opcodeName(Opcode op);
+
+  // Integer constant in the form values of type have: truncated to its width,
+  // then sign or zero extended to 64 bits. Booleans are 0 or 1
+  uint64_t canonicalInt(uint64_t value, Type const& type);
+
+  // Computes an arithmetic, comparison, negation or cast instruction of func
+  // on canonical constants like the machine would. False if it can't be done
+  // at compile time: floats and divisions that trap
+  bool fold(TypeTable const& types, IRFunction const& func, Instruction const& inst, uint64_t a, uint64_t b, uint64_t& result);
+
+} // namespace lon
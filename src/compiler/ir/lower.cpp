@@ -0,0 +1,475 @@
+#include "lower.hpp"
+
+using lon::BinaryOperator;
+using lon::BlockRef;
+using lon::ExpressionType;
+using lon::FunctionDefinition;
+using lon::Instruction;
+using lon::IRFunction;
+using lon::IRModule;
+using lon::Literal;
+using lon::LiteralType;
+using lon::Lowering;
+using lon::LoweringError;
+using lon::NodeIndex;
+using lon::Opcode;
+using lon::StatementType;
+using lon::Symbol;
+using lon::Type;
+using lon::TypeRef;
+using lon::UnaryOperator;
+using lon::ValueRef;
+
+// same order as BinaryOperator
+static const char* BINARY_NAMES[] = {
+  "+", "-", "*", "/", "%", "==", "!=", "<", "<=", ">", ">=", "&&", "||"
+};
+
+static inline bool isNumeric(Type const& type) {
+  return type.id == lon::TID_NUMBER || type.id == lon::TID_FLOAT;
+}
+
+Lowering::Lowering() = default;
+Lowering::~Lowering() = default;
+
+IRModule Lowering::lower(AbstractSourceTree const& ast) {
+  m_ast = &ast;
+  m_types = ast.types;
+  m_definitions.clear();
+
+  IRModule module = { ast.symbols, ast.types, {} };
+
+  for (auto const& def : ast.functions) {
+    if (def.funcName == SYM_PRINT)
+      throw LoweringError("Function print is builtin and can't be redefined");
+
+    if (!m_definitions.emplace(def.funcName, &def).second)
+      throw LoweringError("Function " + std::string(ast.symbols->name(def.funcName)) + " is defined more than once");
+  }
+
+  module.functions.resize(ast.functions.size());
+
+  for (size_t i = 0; i < ast.functions.size(); ++i) {
+    auto const& def = ast.functions[i];
+
+    try {
+      lowerFunction(def, module.functions[i]);
+    }
+    catch (LoweringError& error) {
+      throw LoweringError("In function " + std::string(ast.symbols->name(def.funcName)) + ": " + error.what());
+    }
+  }
+
+  return module;
+}
+
+void Lowering::lowerFunction(FunctionDefinition const& def, IRFunction& func) {
+  func.name = def.funcName;
+  func.returnType = declaredType(def.returnType);
+  for (NodeIndex param : m_ast->list(def.argsTypes))
+    func.params.push_back(declaredType(param));
+
+  m_func = &func;
+  m_frames.clear();
+  m_values.clear();
+  startBlock();
+
+  // statement lists being walked, blocks nest without recursion
+  std::vector<NodeList> lists = { m_ast->list(def.body) };
+
+  while (!lists.empty()) {
+    NodeList& list = lists.back();
+    if (list.count == 0) {
+      lists.pop_back();
+      continue;
+    }
+
+    auto const& st = m_ast->statement(list.items[0]);
+    list.items++;
+    list.count--;
+
+    // code after return is still checked, the optimizer drops it
+    if (m_block == NO_BLOCK && st.getType() != StatementType::BLOCK)
+      startBlock();
+
+    switch (st.getType()) {
+      case StatementType::EXPR:
+        lowerExpression(st.expression);
+        break;
+
+      case StatementType::RETURN: {
+        ValueRef value = lowerExpression(st.expression);
+
+        if (func.returnType == TYPE_VOID) {
+          if (typeOf(value) != TYPE_VOID)
+            throw LoweringError("Function returns void, but the value is " + typeName(typeOf(value)));
+          value = NO_VALUE;
+        }
+        else {
+          value = convert(value, func.returnType);
+        }
+
+        emit(Opcode::RET, TYPE_VOID, value);
+        m_block = NO_BLOCK;
+      } break;
+
+      case StatementType::BLOCK:
+        lists.push_back(m_ast->list(st.block));
+        break;
+    }
+  }
+
+  // falling off the end returns zero
+  if (m_block != NO_BLOCK) {
+    if (func.returnType == TYPE_VOID)
+      emit(Opcode::RET, TYPE_VOID);
+    else
+      emit(Opcode::RET, TYPE_VOID, emitInt(func.returnType, 0));
+  }
+}
+
+ValueRef Lowering::lowerExpression(NodeIndex expr) {
+  m_frames.push_back({ expr, 0, 0, 0 });
+
+  while (!m_frames.empty()) {
+    // copy, pushing children moves frames
+    Frame frame = m_frames.back();
+    m_frames.back().stage++;
+
+    auto const& node = m_ast->expression(frame.expr);
+
+    switch (node.getType()) {
+      case ExpressionType::LITERAL:
+        m_frames.pop_back();
+        m_values.push_back(lowerLiteral(node.literal));
+        break;
+
+      case ExpressionType::CALL:
+        if (frame.stage < node.call.args.count) {
+          NodeIndex arg = m_ast->list(node.call.args)[frame.stage];
+          m_frames.push_back({ arg, 0, 0, 0 });
+          break;
+        }
+
+        m_frames.pop_back();
+        m_values.push_back(lowerCall(node.call.funcName, node.call.args.count));
+        break;
+
+      case ExpressionType::UNARY:
+        if (frame.stage == 0) {
+          m_frames.push_back({ node.unary.operand, 0, 0, 0 });
+          break;
+        }
+
+        m_frames.pop_back();
+        m_values.back() = lowerUnary(node.unary.op, m_values.back());
+        break;
+
+      case ExpressionType::BINARY: {
+        BinaryOperator op = node.binary.op;
+
+        if (frame.stage == 0) {
+          m_frames.push_back({ node.binary.lhs, 0, 0, 0 });
+          break;
+        }
+
+        if (op != BinaryOperator::AND && op != BinaryOperator::OR) {
+          if (frame.stage == 1) {
+            m_frames.push_back({ node.binary.rhs, 0, 0, 0 });
+            break;
+          }
+
+          ValueRef rhs = m_values.back();
+          m_values.pop_back();
+
+          m_frames.pop_back();
+          m_values.back() = lowerBinary(op, m_values.back(), rhs);
+          break;
+        }
+
+        // short-circuit: rhs gets a block of its own, both paths meet in a phi
+        if (frame.stage == 1) {
+          ValueRef lhs = toBool(m_values.back());
+          m_values.back() = lhs;
+
+          ValueRef branch = emit(Opcode::BR_COND, TYPE_VOID);
+          BlockRef rhsBlock = (BlockRef)m_func->blocks.size();
+          Instruction& inst = m_func->insts[branch];
+          inst.branch.cond = lhs;
+          inst.branch.target = op == BinaryOperator::AND ? rhsBlock : NO_BLOCK;
+          inst.branch.otherwise = op == BinaryOperator::AND ? NO_BLOCK : rhsBlock;
+
+          m_frames.back().branch = branch;
+          m_frames.back().block = m_block;
+
+          startBlock();
+          m_frames.push_back({ node.binary.rhs, 0, 0, 0 });
+          break;
+        }
+
+        ValueRef rhs = toBool(m_values.back());
+        m_values.pop_back();
+        BlockRef rhsEnd = m_block;
+
+        BlockRef merge = (BlockRef)m_func->blocks.size();
+        ValueRef jump = emit(Opcode::BR, TYPE_VOID);
+        m_func->insts[jump].branch.target = merge;
+
+        Instruction& branch = m_func->insts[frame.branch];
+        if (op == BinaryOperator::AND)
+          branch.branch.otherwise = merge;
+        else
+          branch.branch.target = merge;
+
+        startBlock();
+        uint32_t incoming[] = { frame.block, m_values.back(), rhsEnd, rhs };
+        ValueRef phi = emit(Opcode::PHI, TYPE_BOOLEAN);
+        m_func->insts[phi].list = addOperands(incoming, 4);
+
+        m_frames.pop_back();
+        m_values.back() = phi;
+      } break;
+    }
+  }
+
+  ValueRef result = m_values.back();
+  m_values.pop_back();
+  return result;
+}
+
+ValueRef Lowering::lowerLiteral(Literal const& lit) {
+  switch (lit.getType()) {
+    case LiteralType::INT: {
+      // negative literals are stored in two's complement
+      int64_t value = (int64_t)lit.intValue;
+      bool fits = value >= INT32_MIN && value <= INT32_MAX;
+      return emitInt(fits ? TYPE_INT32 : TYPE_INT64, lit.intValue);
+    }
+
+    case LiteralType::FLOAT: {
+      ValueRef value = emit(Opcode::CONST_FLOAT, TYPE_FLOAT64);
+      m_func->insts[value].fltValue = lit.fltValue;
+      return value;
+    }
+
+    case LiteralType::STRING: {
+      ValueRef value = emit(Opcode::CONST_STRING, TYPE_STRING);
+      m_func->insts[value].string = lit.string;
+      return value;
+    }
+  }
+
+  throw LoweringError("Unknown literal");
+}
+
+ValueRef Lowering::lowerBinary(BinaryOperator op, ValueRef lhs, ValueRef rhs) {
+  TypeRef type = TYPE_INVALID;
+
+  bool equality = op == BinaryOperator::EQ || op == BinaryOperator::NOT_EQ;
+  if (equality && typeOf(lhs) == TYPE_BOOLEAN && typeOf(rhs) == TYPE_BOOLEAN)
+    type = TYPE_BOOLEAN;
+  else
+    type = unify(typeOf(lhs), typeOf(rhs));
+
+  if (type == TYPE_INVALID || (op == BinaryOperator::MOD && type == TYPE_FLOAT64)) {
+    throw LoweringError(
+      std::string("Invalid operands of ") + BINARY_NAMES[(int)op] + ": " +
+      typeName(typeOf(lhs)) + " and " + typeName(typeOf(rhs))
+    );
+  }
+
+  lhs = convert(lhs, type);
+  rhs = convert(rhs, type);
+
+  switch (op) {
+    case BinaryOperator::ADD: return emit(Opcode::ADD, type, lhs, rhs);
+    case BinaryOperator::SUB: return emit(Opcode::SUB, type, lhs, rhs);
+    case BinaryOperator::MUL: return emit(Opcode::MUL, type, lhs, rhs);
+    case BinaryOperator::DIV: return emit(Opcode::DIV, type, lhs, rhs);
+    case BinaryOperator::MOD: return emit(Opcode::MOD, type, lhs, rhs);
+    case BinaryOperator::EQ: return emit(Opcode::CMP_EQ, TYPE_BOOLEAN, lhs, rhs);
+    case BinaryOperator::NOT_EQ: return emit(Opcode::CMP_NE, TYPE_BOOLEAN, lhs, rhs);
+    case BinaryOperator::LESS: return emit(Opcode::CMP_LT, TYPE_BOOLEAN, lhs, rhs);
+    case BinaryOperator::LESS_EQ: return emit(Opcode::CMP_LE, TYPE_BOOLEAN, lhs, rhs);
+    case BinaryOperator::GREATER: return emit(Opcode::CMP_GT, TYPE_BOOLEAN, lhs, rhs);
+    case BinaryOperator::GREATER_EQ: return emit(Opcode::CMP_GE, TYPE_BOOLEAN, lhs, rhs);
+    default: break;
+  }
+
+  throw LoweringError("Unknown binary operator");
+}
+
+ValueRef Lowering::lowerUnary(UnaryOperator op, ValueRef operand) {
+  if (op == UnaryOperator::NOT)
+    return emit(Opcode::NOT, TYPE_BOOLEAN, toBool(operand));
+
+  if (typeOf(operand) == TYPE_BOOLEAN)
+    operand = convert(operand, TYPE_INT32);
+
+  if (!isNumeric(m_types->get(typeOf(operand))))
+    throw LoweringError("Invalid operand of unary -: " + typeName(typeOf(operand)));
+
+  return emit(Opcode::NEG, typeOf(operand), operand);
+}
+
+ValueRef Lowering::lowerCall(Symbol name, uint32_t argsCount) {
+  ValueRef* args = m_values.data() + m_values.size() - argsCount;
+  std::string funcName(m_ast->symbols->name(name));
+  TypeRef type = TYPE_VOID;
+
+  if (name == SYM_PRINT) {
+    if (argsCount != 1)
+      throw LoweringError("print takes 1 argument, but " + std::to_string(argsCount) + " given");
+    if (typeOf(args[0]) != TYPE_STRING)
+      throw LoweringError("print argument must be a string, but it's " + typeName(typeOf(args[0])));
+  }
+  else {
+    auto it = m_definitions.find(name);
+    if (it == m_definitions.end())
+      throw LoweringError("Unknown function " + funcName);
+
+    FunctionDefinition const* def = it->second;
+    NodeList params = m_ast->list(def->argsTypes);
+    if (argsCount != params.size()) {
+      throw LoweringError(
+        funcName + " takes " + std::to_string(params.size()) + " arguments, but " +
+        std::to_string(argsCount) + " given"
+      );
+    }
+
+    for (uint32_t i = 0; i < argsCount; ++i)
+      args[i] = convert(args[i], declaredType(params[i]));
+
+    type = declaredType(def->returnType);
+  }
+
+  ValueRef call = emit(Opcode::CALL, type);
+  m_func->insts[call].call.callee = name;
+  m_func->insts[call].call.args = addOperands(args, argsCount);
+
+  m_values.resize(m_values.size() - argsCount);
+  return call;
+}
+
+ValueRef Lowering::convert(ValueRef value, TypeRef type) {
+  TypeRef from = typeOf(value);
+  if (from == type)
+    return value;
+
+  Type source = m_types->get(from);
+  Type target = m_types->get(type);
+
+  if (target.id == TID_BOOLEAN && isNumeric(source))
+    return toBool(value);
+
+  bool fromNumber = isNumeric(source) || source.id == TID_BOOLEAN;
+  if (!fromNumber || !isNumeric(target))
+    throw LoweringError("Can't convert " + typeName(from) + " to " + typeName(type));
+
+  // a constant nothing refers to yet takes the new type itself
+  Instruction& last = m_func->insts.back();
+  if (value == m_func->insts.size() - 1 && last.op == Opcode::CONST_INT && target.id == TID_NUMBER) {
+    last.type = type;
+    last.intValue = canonicalInt(last.intValue, target);
+    return value;
+  }
+
+  return emit(Opcode::CAST, type, value);
+}
+
+ValueRef Lowering::toBool(ValueRef value) {
+  TypeRef type = typeOf(value);
+  if (type == TYPE_BOOLEAN)
+    return value;
+
+  Type info = m_types->get(type);
+  if (!isNumeric(info))
+    throw LoweringError("Can't use " + typeName(type) + " as a condition");
+
+  Instruction& last = m_func->insts.back();
+  if (value == m_func->insts.size() - 1 && last.op == Opcode::CONST_INT) {
+    last.type = TYPE_BOOLEAN;
+    last.intValue = last.intValue != 0;
+    return value;
+  }
+
+  ValueRef zero;
+  if (info.id == TID_FLOAT) {
+    zero = emit(Opcode::CONST_FLOAT, type);
+    m_func->insts[zero].fltValue = 0.0;
+  }
+  else {
+    zero = emitInt(type, 0);
+  }
+
+  return emit(Opcode::CMP_NE, TYPE_BOOLEAN, value, zero);
+}
+
+TypeRef Lowering::unify(TypeRef a, TypeRef b) {
+  // booleans are 0 and 1 in arithmetic
+  if (a == TYPE_BOOLEAN)
+    a = TYPE_INT32;
+  if (b == TYPE_BOOLEAN)
+    b = TYPE_INT32;
+
+  if (a == b)
+    return isNumeric(m_types->get(a)) ? a : TYPE_INVALID;
+
+  Type x = m_types->get(a);
+  Type y = m_types->get(b);
+  if (!isNumeric(x) || !isNumeric(y))
+    return TYPE_INVALID;
+
+  if (x.id == TID_FLOAT || y.id == TID_FLOAT)
+    return TYPE_FLOAT64;
+
+  // wider wins, unsigned wins at the same width
+  if (x.number.width != y.number.width)
+    return x.number.width > y.number.width ? a : b;
+  return TypeTable::number(x.number.width, false);
+}
+
+TypeRef Lowering::declaredType(TypeRef type) {
+  type = m_types->withFlags(type, TPF_NONE);
+
+  Type info = m_types->get(type);
+  if (info.id != TID_VOID && info.id != TID_NUMBER && info.id != TID_BOOLEAN)
+    throw LoweringError("Type " + m_types->name(type) + " is not supported yet");
+
+  return type;
+}
+
+BlockRef Lowering::startBlock() {
+  m_func->blocks.push_back({ (uint32_t)m_func->insts.size(), 0 });
+  m_block = (BlockRef)m_func->blocks.size() - 1;
+  return m_block;
+}
+
+ValueRef Lowering::emit(Opcode op, TypeRef type, ValueRef a, ValueRef b) {
+  Instruction inst;
+  inst.op = op;
+  inst.type = type;
+  inst.branch = { NO_VALUE, NO_BLOCK, NO_BLOCK };
+  inst.args[0] = a;
+  inst.args[1] = b;
+
+  m_func->insts.push_back(inst);
+  m_func->blocks.back().count++;
+  return (ValueRef)m_func->insts.size() - 1;
+}
+
+ValueRef Lowering::emitInt(TypeRef type, uint64_t value) {
+  ValueRef result = emit(Opcode::CONST_INT, type);
+  m_func->insts[result].intValue = value;
+  return result;
+}
+
+Instruction::List Lowering::addOperands(uint32_t const* items, uint32_t count) {
+  Instruction::List list = { (uint32_t)m_func->operands.size(), count };
+  m_func->operands.insert(m_func->operands.end(), items, items + count);
+  return list;
+}
+
+std::string Lowering::typeName(TypeRef type) const {
+  return irTypeName(*m_types, type);
+}
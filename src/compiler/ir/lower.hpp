@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "ir.hpp"
+#include "../ast/ast.hpp"
+
+namespace lon {
+
+  class LoweringError : public std::exception {
+  private:
+    std::string m_info;
+
+  public:
+    LoweringError(std::string_view info)
+      : m_info(info), std::exception() {}
+
+    virtual const char* what() const noexcept override { return m_info.c_str(); }
+  };
+
+  // Translates the AST to SSA form and checks types on the way.
+  // Expressions are walked with a stack of our own, nesting is unlimited
+  class Lowering {
+  private:
+    struct Frame {
+      NodeIndex expr;
+      uint32_t stage; // children done
+      ValueRef branch; // BR_COND of a short-circuit operator
+      BlockRef block; // where it is
+    };
+
+    AbstractSourceTree const* m_ast;
+    TypeTable* m_types;
+
+    // function names to definitions
+    std::unordered_map<Symbol, FunctionDefinition const*> m_definitions;
+
+    IRFunction* m_func;
+    BlockRef m_block; // NO_BLOCK after return
+
+    std::vector<Frame> m_frames;
+    std::vector<ValueRef> m_values;
+
+  public:
+    static constexpr BlockRef NO_BLOCK = 0xFFFFFFFF;
+
+    Lowering();
+    ~Lowering();
+
+  public:
+    IRModule lower(AbstractSourceTree const& ast);
+
+  private:
+    void lowerFunction(FunctionDefinition const& def, IRFunction& func);
+    ValueRef lowerExpression(NodeIndex expr);
+    ValueRef lowerLiteral(Literal const& lit);
+    ValueRef lowerBinary(BinaryOperator op, ValueRef lhs, ValueRef rhs);
+    ValueRef lowerUnary(UnaryOperator op, ValueRef operand);
+    ValueRef lowerCall(Symbol name, uint32_t argsCount);
+
+    // Converts value to type, throws if it can't be done implicitly
+    ValueRef convert(ValueRef value, TypeRef type);
+    ValueRef toBool(ValueRef value);
+
+    // Common type of arithmetic operands
+    TypeRef unify(TypeRef a, TypeRef b);
+
+    // Type of values for a type from the source, throws if it's unsupported
+    TypeRef declaredType(TypeRef type);
+
+    BlockRef startBlock();
+    ValueRef emit(Opcode op, TypeRef type, ValueRef a = NO_VALUE, ValueRef b = NO_VALUE);
+    ValueRef emitInt(TypeRef type, uint64_t value);
+    Instruction::List addOperands(uint32_t const* items, uint32_t count);
+
+    inline TypeRef typeOf(ValueRef value) const { return m_func->insts[value].type; }
+    std::string typeName(TypeRef type) const;
+  };
+
+} // namespace lon
@@ -0,0 +1,588 @@
+#include "optimize.hpp"
+
+#include <algorithm>
+#include <string>
+
+using lon::BlockRef;
+using lon::Instruction;
+using lon::IRFunction;
+using lon::IRModule;
+using lon::Opcode;
+using lon::OptimizationStats;
+using lon::Symbol;
+using lon::Type;
+using lon::TypeTable;
+using lon::ValueRef;
+
+namespace lon {
+
+  class Optimizer {
+  private:
+    // lattice of values, TOP until something is known
+    enum : uint8_t {
+      TOP,
+      CONSTANT,
+      BOTTOM
+    };
+
+    struct Cell {
+      uint8_t state;
+      uint64_t value; // canonical, see canonicalInt
+    };
+
+    struct Edge {
+      BlockRef from;
+      uint32_t index; // of the successor
+      BlockRef to;
+    };
+
+    TypeTable const& m_types;
+    SymbolTable& m_symbols;
+    IRFunction* m_func;
+
+    std::vector<BlockRef> m_blockOf;
+
+    // users of value v are m_uses[m_useStart[v]] to m_uses[m_useStart[v + 1]]
+    std::vector<uint32_t> m_useStart;
+    std::vector<ValueRef> m_uses;
+
+    std::vector<Cell> m_cells;
+    std::vector<uint8_t> m_executable; // blocks
+    std::vector<uint8_t> m_edges; // two per block, successor edges taken
+
+    std::vector<Edge> m_flowWork;
+    std::vector<ValueRef> m_ssaWork;
+
+    std::vector<ValueRef> m_copyOf; // phis with one value left
+    std::vector<uint8_t> m_live;
+
+  public:
+    Optimizer(TypeTable const& types, SymbolTable& symbols) : m_types(types), m_symbols(symbols) {}
+
+    OptimizationStats run(IRFunction& func) {
+      uint32_t before = (uint32_t)func.insts.size();
+
+      m_func = &func;
+      prepare();
+      propagate();
+      rewrite();
+      mergePrints();
+      markLive();
+      rebuild();
+
+      return { func.name, before, (uint32_t)func.insts.size() };
+    }
+
+  private:
+    void prepare() {
+      auto const& func = *m_func;
+      size_t count = func.insts.size();
+
+      m_blockOf.resize(count);
+      for (BlockRef block = 0; block < func.blocks.size(); ++block) {
+        auto const& bb = func.blocks[block];
+        std::fill(m_blockOf.begin() + bb.first, m_blockOf.begin() + bb.first + bb.count, block);
+      }
+
+      m_useStart.assign(count + 1, 0);
+      for (auto const& inst : func.insts)
+        func.forEachOperand(inst, [this](ValueRef used) { m_useStart[used + 1]++; });
+
+      for (size_t i = 0; i < count; ++i)
+        m_useStart[i + 1] += m_useStart[i];
+
+      m_uses.resize(m_useStart[count]);
+      std::vector<uint32_t> fill(m_useStart.begin(), m_useStart.end() - 1);
+      for (ValueRef user = 0; user < count; ++user)
+        func.forEachOperand(func.insts[user], [&](ValueRef used) { m_uses[fill[used]++] = user; });
+
+      m_cells.assign(count, { TOP, 0 });
+      m_executable.assign(func.blocks.size(), 0);
+      m_edges.assign(func.blocks.size() * 2, 0);
+      m_copyOf.assign(count, NO_VALUE);
+    }
+
+    // Wegman, Zadeck: "Constant Propagation with Conditional Branches"
+    void propagate() {
+      m_flowWork = { { NO_VALUE, 0, 0 } };
+      m_ssaWork.clear();
+
+      while (!m_flowWork.empty() || !m_ssaWork.empty()) {
+        while (!m_flowWork.empty()) {
+          Edge edge = m_flowWork.back();
+          m_flowWork.pop_back();
+
+          if (edge.from != NO_VALUE) {
+            uint8_t& taken = m_edges[edge.from * 2 + edge.index];
+            if (taken)
+              continue;
+            taken = 1;
+          }
+
+          auto const& bb = m_func->blocks[edge.to];
+          bool first = !m_executable[edge.to];
+          m_executable[edge.to] = 1;
+
+          // a new edge only changes phis of a block seen before
+          for (ValueRef value = bb.first; value < bb.first + bb.count; ++value) {
+            if (!first && m_func->insts[value].op != Opcode::PHI)
+              break;
+            visit(value);
+          }
+        }
+
+        while (!m_ssaWork.empty()) {
+          ValueRef value = m_ssaWork.back();
+          m_ssaWork.pop_back();
+
+          for (uint32_t i = m_useStart[value]; i < m_useStart[value + 1]; ++i) {
+            ValueRef user = m_uses[i];
+            if (m_executable[m_blockOf[user]])
+              visit(user);
+          }
+        }
+      }
+    }
+
+    void visit(ValueRef value) {
+      auto const& inst = m_func->insts[value];
+      BlockRef block = m_blockOf[value];
+
+      switch (inst.op) {
+        case Opcode::RET:
+          return;
+
+        case Opcode::BR:
+          m_flowWork.push_back({ block, 0, inst.branch.target });
+          return;
+
+        case Opcode::BR_COND: {
+          Cell const& cond = m_cells[inst.branch.cond];
+          if (cond.state == CONSTANT && cond.value == 0)
+            m_flowWork.push_back({ block, 1, inst.branch.otherwise });
+          if (cond.state == CONSTANT && cond.value != 0)
+            m_flowWork.push_back({ block, 0, inst.branch.target });
+          if (cond.state == BOTTOM) {
+            m_flowWork.push_back({ block, 0, inst.branch.target });
+            m_flowWork.push_back({ block, 1, inst.branch.otherwise });
+          }
+        } return;
+
+        default:
+          break;
+      }
+
+      Cell& cell = m_cells[value];
+      if (cell.state == BOTTOM)
+        return;
+
+      Cell result = evaluate(value);
+      if (result.state == cell.state && result.value == cell.value)
+        return;
+
+      // values only go down the lattice
+      if (cell.state == CONSTANT)
+        result.state = BOTTOM;
+
+      cell = result;
+      m_ssaWork.push_back(value);
+    }
+
+    Cell evaluate(ValueRef value) {
+      auto const& inst = m_func->insts[value];
+
+      switch (inst.op) {
+        case Opcode::CONST_INT:
+          return { CONSTANT, inst.intValue };
+
+        case Opcode::CONST_FLOAT:
+        case Opcode::CONST_STRING:
+        case Opcode::CALL:
+          return { BOTTOM, 0 };
+
+        case Opcode::PHI: {
+          Cell result = { TOP, 0 };
+
+          for (uint32_t i = 0; i < inst.list.count; i += 2) {
+            if (!taken(m_func->operand(inst.list, i), m_blockOf[value]))
+              continue;
+
+            Cell const& incoming = m_cells[m_func->operand(inst.list, i + 1)];
+            if (incoming.state == TOP)
+              continue;
+            if (incoming.state == BOTTOM || (result.state == CONSTANT && result.value != incoming.value))
+              return { BOTTOM, 0 };
+            result = incoming;
+          }
+
+          return result;
+        }
+
+        default:
+          break;
+      }
+
+      bool binary = inst.op >= Opcode::ADD && inst.op <= Opcode::CMP_GE;
+      Cell const& a = m_cells[inst.args[0]];
+      Cell const& b = binary ? m_cells[inst.args[1]] : a;
+
+      if (a.state == BOTTOM || b.state == BOTTOM)
+        return { BOTTOM, 0 };
+      if (a.state == TOP || b.state == TOP)
+        return { TOP, 0 };
+
+      uint64_t result;
+      if (!fold(m_types, *m_func, inst, a.value, b.value, result))
+        return { BOTTOM, 0 };
+      return { CONSTANT, result };
+    }
+
+    bool taken(BlockRef from, BlockRef to) const {
+      BlockRef targets[2];
+      int count = m_func->successors(from, targets);
+
+      for (int i = 0; i < count; ++i) {
+        if (targets[i] == to && m_edges[from * 2 + i])
+          return true;
+      }
+      return false;
+    }
+
+    // Constants replace what they were computed from, branches on them
+    // become jumps, phis left with one value become copies of it
+    void rewrite() {
+      auto& func = *m_func;
+
+      for (BlockRef block = 0; block < func.blocks.size(); ++block) {
+        if (!m_executable[block])
+          continue;
+
+        auto const& bb = func.blocks[block];
+        for (ValueRef value = bb.first; value < bb.first + bb.count; ++value) {
+          Instruction& inst = func.insts[value];
+          Cell const& cell = m_cells[value];
+
+          if (inst.op == Opcode::BR_COND && m_cells[inst.branch.cond].state == CONSTANT) {
+            bool cond = m_cells[inst.branch.cond].value != 0;
+            inst.op = Opcode::BR;
+            inst.branch.target = cond ? inst.branch.target : inst.branch.otherwise;
+            m_edges[block * 2] = 1;
+            m_edges[block * 2 + 1] = 0;
+            continue;
+          }
+
+          if (inst.type != TYPE_VOID && cell.state == CONSTANT) {
+            inst.op = Opcode::CONST_INT;
+            inst.intValue = cell.value;
+            continue;
+          }
+
+          if (inst.op != Opcode::PHI)
+            continue;
+
+          ValueRef single = NO_VALUE;
+          bool many = false;
+
+          for (uint32_t i = 0; i < inst.list.count; i += 2) {
+            ValueRef incoming = func.operand(inst.list, i + 1);
+            if (!taken(func.operand(inst.list, i), block) || incoming == value)
+              continue;
+
+            if (single == NO_VALUE)
+              single = incoming;
+            else if (incoming != single)
+              many = true;
+          }
+
+          if (!many)
+            m_copyOf[value] = single;
+        }
+      }
+    }
+
+    inline ValueRef resolve(ValueRef value) const {
+      while (m_copyOf[value] != NO_VALUE)
+        value = m_copyOf[value];
+      return value;
+    }
+
+    bool hasSideEffects(Instruction const& inst) const {
+      switch (inst.op) {
+        case Opcode::CALL:
+        case Opcode::RET:
+        case Opcode::BR:
+        case Opcode::BR_COND:
+          return true;
+
+        case Opcode::DIV:
+        case Opcode::MOD: {
+          // may trap unless divisor is a known safe constant
+          Cell const& divisor = m_cells[inst.args[1]];
+          Type type = m_types.get(inst.type);
+          bool isSigned = type.id == TID_NUMBER && type.number.isSigned;
+          return divisor.state != CONSTANT || divisor.value == 0 || (isSigned && (int64_t)divisor.value == -1);
+        }
+
+        default:
+          return false;
+      }
+    }
+
+    void markLive() {
+      auto const& func = *m_func;
+      std::vector<ValueRef> work;
+      m_live.assign(func.insts.size(), 0);
+
+      auto mark = [&](ValueRef value) {
+        value = resolve(value);
+        if (!m_live[value]) {
+          m_live[value] = 1;
+          work.push_back(value);
+        }
+      };
+
+      for (BlockRef block = 0; block < func.blocks.size(); ++block) {
+        if (!m_executable[block])
+          continue;
+
+        auto const& bb = func.blocks[block];
+        for (ValueRef value = bb.first; value < bb.first + bb.count; ++value) {
+          if (hasSideEffects(func.insts[value]))
+            mark(value);
+        }
+      }
+
+      while (!work.empty()) {
+        ValueRef value = work.back();
+        work.pop_back();
+
+        auto const& inst = func.insts[value];
+        if (inst.op != Opcode::PHI) {
+          func.forEachOperand(inst, mark);
+          continue;
+        }
+
+        for (uint32_t i = 0; i < inst.list.count; i += 2) {
+          if (taken(func.operand(inst.list, i), m_blockOf[value]))
+            mark(func.operand(inst.list, i + 1));
+        }
+      }
+    }
+
+    // Consecutive prints of constant strings in a block become one print of
+    // the strings joined, at the last of them. Instructions between them
+    // may only compute values. The first print becomes the joined constant,
+    // the rest before the last become unused ones
+    void mergePrints() {
+      auto& func = *m_func;
+      std::string text;
+
+      for (BlockRef block = 0; block < func.blocks.size(); ++block) {
+        if (!m_executable[block])
+          continue;
+
+        ValueRef first = NO_VALUE;
+        ValueRef last = NO_VALUE;
+
+        auto join = [&]() {
+          if (last != NO_VALUE) {
+            Instruction& constant = func.insts[first];
+            constant.op = Opcode::CONST_STRING;
+            constant.type = TYPE_STRING;
+            constant.string = m_symbols.intern(text);
+            func.operands[func.insts[last].call.args.first] = first;
+          }
+          first = last = NO_VALUE;
+        };
+
+        auto const& bb = func.blocks[block];
+        for (ValueRef value = bb.first; value < bb.first + bb.count; ++value) {
+          auto const& inst = func.insts[value];
+
+          if (inst.op == Opcode::CALL && inst.call.callee == SYM_PRINT) {
+            auto const& str = func.insts[resolve(func.operand(inst.call.args, 0))];
+            if (str.op == Opcode::CONST_STRING) {
+              if (first == NO_VALUE) {
+                first = value;
+                text = m_symbols.name(str.string);
+                continue;
+              }
+
+              text += m_symbols.name(str.string);
+              if (last != NO_VALUE) {
+                Instruction& merged = func.insts[last];
+                Symbol string = func.insts[resolve(func.operand(merged.call.args, 0))].string;
+                merged.op = Opcode::CONST_STRING;
+                merged.type = TYPE_STRING;
+                merged.string = string;
+              }
+              last = value;
+              continue;
+            }
+          }
+
+          if (hasSideEffects(inst))
+            join();
+        }
+
+        join();
+      }
+    }
+
+    // Compacts live instructions of reachable blocks into new arrays. A block
+    // that is the only target of a jump is appended to the jumping one
+    void rebuild() {
+      auto& func = *m_func;
+      size_t blocksCount = func.blocks.size();
+
+      std::vector<uint32_t> predsCount(blocksCount, 0);
+      for (BlockRef block = 0; block < blocksCount; ++block) {
+        if (!m_executable[block])
+          continue;
+
+        BlockRef targets[2];
+        int count = func.successors(block, targets);
+        for (int i = 0; i < count; ++i) {
+          if (m_edges[block * 2 + i] && (i == 0 || targets[1] != targets[0]))
+            predsCount[targets[i]]++;
+        }
+      }
+
+      std::vector<BlockRef> chainNext(blocksCount, NO_VALUE);
+      std::vector<uint8_t> merged(blocksCount, 0);
+
+      for (BlockRef block = 0; block < blocksCount; ++block) {
+        if (!m_executable[block])
+          continue;
+
+        auto const& bb = func.blocks[block];
+        auto const& last = func.insts[bb.first + bb.count - 1];
+        if (last.op == Opcode::BR && last.branch.target != 0 && predsCount[last.branch.target] == 1) {
+          chainNext[block] = last.branch.target;
+          merged[last.branch.target] = 1;
+        }
+      }
+
+      // numbers first, then instructions, so operands can refer forward
+      std::vector<BlockRef> heads;
+      std::vector<BlockRef> newBlock(blocksCount, NO_VALUE);
+      std::vector<ValueRef> newIndex(func.insts.size(), NO_VALUE);
+      ValueRef count = 0;
+
+      auto emitted = [&](ValueRef value, BlockRef block) {
+        auto const& inst = func.insts[value];
+        return m_live[value] && !(inst.op == Opcode::BR && chainNext[block] != NO_VALUE);
+      };
+
+      // phis go first even if some before them became constants
+      auto walk = [&](BlockRef head, auto&& fn) {
+        for (int phis = 1; phis >= 0; --phis) {
+          for (BlockRef block = head; block != NO_VALUE; block = chainNext[block]) {
+            auto const& bb = func.blocks[block];
+            for (ValueRef value = bb.first; value < bb.first + bb.count; ++value) {
+              if ((func.insts[value].op == Opcode::PHI) == (phis == 1) && emitted(value, block))
+                fn(value);
+            }
+          }
+        }
+      };
+
+      for (BlockRef block = 0; block < blocksCount; ++block) {
+        if (!m_executable[block] || merged[block])
+          continue;
+
+        for (BlockRef member = block; member != NO_VALUE; member = chainNext[member])
+          newBlock[member] = (BlockRef)heads.size();
+        heads.push_back(block);
+
+        walk(block, [&](ValueRef value) { newIndex[value] = count++; });
+      }
+
+      std::vector<Instruction> insts;
+      std::vector<BasicBlock> blocks;
+      std::vector<uint32_t> operands;
+      insts.reserve(count);
+
+      auto map = [&](ValueRef value) { return newIndex[resolve(value)]; };
+
+      for (BlockRef head : heads) {
+        blocks.push_back({ (uint32_t)insts.size(), 0 });
+
+        walk(head, [&](ValueRef value) {
+          Instruction inst = func.insts[value];
+
+          switch (inst.op) {
+            case Opcode::CONST_INT:
+            case Opcode::CONST_FLOAT:
+            case Opcode::CONST_STRING:
+              break;
+
+            case Opcode::PHI: {
+              Instruction::List list = { (uint32_t)operands.size(), 0 };
+              for (uint32_t i = 0; i < inst.list.count; i += 2) {
+                BlockRef pred = func.operand(inst.list, i);
+                if (!taken(pred, m_blockOf[value]))
+                  continue;
+                operands.push_back(newBlock[pred]);
+                operands.push_back(map(func.operand(inst.list, i + 1)));
+                list.count += 2;
+              }
+              inst.list = list;
+            } break;
+
+            case Opcode::CALL: {
+              Instruction::List args = { (uint32_t)operands.size(), inst.call.args.count };
+              for (uint32_t i = 0; i < inst.call.args.count; ++i)
+                operands.push_back(map(func.operand(inst.call.args, i)));
+              inst.call.args = args;
+            } break;
+
+            case Opcode::RET:
+              if (inst.args[0] != NO_VALUE)
+                inst.args[0] = map(inst.args[0]);
+              break;
+
+            case Opcode::BR:
+              inst.branch.target = newBlock[inst.branch.target];
+              break;
+
+            case Opcode::BR_COND:
+              inst.branch.cond = map(inst.branch.cond);
+              inst.branch.target = newBlock[inst.branch.target];
+              inst.branch.otherwise = newBlock[inst.branch.otherwise];
+              break;
+
+            case Opcode::NEG:
+            case Opcode::NOT:
+            case Opcode::CAST:
+              inst.args[0] = map(inst.args[0]);
+              break;
+
+            default:
+              inst.args[0] = map(inst.args[0]);
+              inst.args[1] = map(inst.args[1]);
+              break;
+          }
+
+          insts.push_back(inst);
+          blocks.back().count++;
+        });
+      }
+
+      func.insts.swap(insts);
+      func.blocks.swap(blocks);
+      func.operands.swap(operands);
+    }
+  };
+
+} // namespace lon
+
+std::vector<OptimizationStats> lon::optimize(IRModule& module) {
+  std::vector<OptimizationStats> stats;
+  Optimizer optimizer(*module.types, *module.symbols);
+
+  for (auto& func : module.functions)
+    stats.push_back(optimizer.run(func));
+
+  return stats;
+}
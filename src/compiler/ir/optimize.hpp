@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+#include "ir.hpp"
+
+namespace lon {
+
+  struct OptimizationStats {
+    Symbol function;
+    uint32_t before; // instructions
+    uint32_t after;
+  };
+
+  // Sparse conditional constant propagation, then removal of unreachable
+  // blocks and unused pure instructions. Straight branches to blocks with a
+  // single predecessor are merged, so are consecutive prints of constant
+  // strings. Returns stats in order of functions
+  std::vector<OptimizationStats> optimize(IRModule& module);
+
+} // namespace lon
@@ -0,0 +1,354 @@
+#include "verify.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using lon::BlockRef;
+using lon::Instruction;
+using lon::IRFunction;
+using lon::IRModule;
+using lon::Opcode;
+using lon::Type;
+using lon::TypeRef;
+using lon::ValueRef;
+
+std::vector<BlockRef> lon::dominators(IRFunction const& func) {
+  size_t count = func.blocks.size();
+  std::vector<BlockRef> idom(count, NO_VALUE);
+  if (count == 0)
+    return idom;
+
+  // reverse postorder, iterative depth-first search
+  std::vector<BlockRef> order;
+  std::vector<uint32_t> position(count, NO_VALUE);
+  std::vector<uint8_t> visited(count, 0);
+  std::vector<std::pair<BlockRef, int>> stack = { { 0, 0 } };
+  visited[0] = 1;
+
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    BlockRef targets[2];
+    int targetsCount = func.successors(top.first, targets);
+
+    if (top.second < targetsCount) {
+      BlockRef next = targets[top.second++];
+      if (!visited[next]) {
+        visited[next] = 1;
+        stack.push_back({ next, 0 });
+      }
+      continue;
+    }
+
+    order.push_back(top.first);
+    stack.pop_back();
+  }
+
+  std::reverse(order.begin(), order.end());
+  for (uint32_t i = 0; i < order.size(); ++i)
+    position[order[i]] = i;
+
+  // Cooper, Harvey, Kennedy: "A Simple, Fast Dominance Algorithm"
+  auto preds = func.predecessors();
+  idom[0] = 0;
+
+  for (bool changed = true; changed;) {
+    changed = false;
+
+    for (size_t i = 1; i < order.size(); ++i) {
+      BlockRef block = order[i];
+      BlockRef result = NO_VALUE;
+
+      for (BlockRef pred : preds[block]) {
+        if (idom[pred] == NO_VALUE)
+          continue;
+
+        if (result == NO_VALUE) {
+          result = pred;
+          continue;
+        }
+
+        BlockRef other = pred;
+        while (result != other) {
+          while (position[result] > position[other])
+            result = idom[result];
+          while (position[other] > position[result])
+            other = idom[other];
+        }
+      }
+
+      if (idom[block] != result) {
+        idom[block] = result;
+        changed = true;
+      }
+    }
+  }
+
+  return idom;
+}
+
+namespace lon {
+
+  class Verifier {
+  private:
+    IRModule const& m_module;
+    IRFunction const* m_func;
+    ValueRef m_value;
+
+    std::vector<BlockRef> m_blockOf; // of every instruction
+    std::vector<std::vector<BlockRef>> m_preds;
+
+    // dominator tree numbering, a dominates b if b is inside a's range
+    std::vector<uint32_t> m_enter;
+    std::vector<uint32_t> m_leave;
+
+  public:
+    Verifier(IRModule const& module) : m_module(module) {}
+
+    void run() {
+      for (auto const& func : m_module.functions) {
+        m_func = &func;
+        m_value = NO_VALUE;
+
+        checkBlocks();
+        buildDominatorTree();
+
+        for (m_value = 0; m_value < func.insts.size(); ++m_value)
+          checkInstruction(func.insts[m_value]);
+      }
+    }
+
+  private:
+    [[noreturn]] void fail(std::string const& info) {
+      std::string message = "IR verifier: function ";
+      message += m_module.symbols->name(m_func->name);
+      if (m_value != NO_VALUE)
+        message += ", %" + std::to_string(m_value);
+      throw std::logic_error(message + ": " + info);
+    }
+
+    void checkBlocks() {
+      auto const& func = *m_func;
+
+      if (func.blocks.empty())
+        fail("no blocks");
+
+      m_blockOf.assign(func.insts.size(), NO_VALUE);
+      uint32_t next = 0;
+
+      for (BlockRef block = 0; block < func.blocks.size(); ++block) {
+        auto const& bb = func.blocks[block];
+        std::string name = "block b" + std::to_string(block);
+
+        if (bb.first != next || bb.count == 0 || bb.first + bb.count > func.insts.size())
+          fail(name + " isn't a nonempty range right after the previous block");
+
+        for (uint32_t i = bb.first; i < bb.first + bb.count; ++i) {
+          m_blockOf[i] = block;
+
+          bool last = i + 1 == bb.first + bb.count;
+          if (func.insts[i].isTerminator() != last)
+            fail(name + (last ? " doesn't end with a terminator" : " has a terminator in the middle"));
+        }
+
+        BlockRef targets[2];
+        int count = func.successors(block, targets);
+        for (int i = 0; i < count; ++i) {
+          if (targets[i] >= func.blocks.size())
+            fail(name + " branches to a missing block");
+        }
+
+        next = bb.first + bb.count;
+      }
+
+      if (next != func.insts.size())
+        fail("instructions after the last block");
+
+      m_preds = func.predecessors();
+    }
+
+    void buildDominatorTree() {
+      auto idom = dominators(*m_func);
+      size_t count = idom.size();
+
+      std::vector<std::vector<BlockRef>> children(count);
+      for (BlockRef block = 1; block < count; ++block) {
+        if (idom[block] != NO_VALUE)
+          children[idom[block]].push_back(block);
+      }
+
+      m_enter.assign(count, NO_VALUE);
+      m_leave.assign(count, NO_VALUE);
+
+      uint32_t clock = 0;
+      std::vector<std::pair<BlockRef, size_t>> stack = { { 0, 0 } };
+      m_enter[0] = clock++;
+
+      while (!stack.empty()) {
+        auto& top = stack.back();
+        if (top.second < children[top.first].size()) {
+          BlockRef child = children[top.first][top.second++];
+          m_enter[child] = clock++;
+          stack.push_back({ child, 0 });
+          continue;
+        }
+
+        m_leave[top.first] = clock++;
+        stack.pop_back();
+      }
+    }
+
+    inline bool reachable(BlockRef block) const {
+      return m_enter[block] != NO_VALUE;
+    }
+
+    inline bool dominates(BlockRef a, BlockRef b) const {
+      return m_enter[a] <= m_enter[b] && m_leave[b] <= m_leave[a];
+    }
+
+    Type typeOf(ValueRef value) {
+      return m_module.types->get(m_func->insts[value].type);
+    }
+
+    // Defined value, available at the end of block if atEnd, else before m_value
+    TypeRef use(ValueRef value, BlockRef block, bool atEnd) {
+      if (value >= m_func->insts.size())
+        fail("operand %" + std::to_string(value) + " doesn't exist");
+
+      TypeRef type = m_func->insts[value].type;
+      if (type == TYPE_VOID)
+        fail("operand %" + std::to_string(value) + " has no value");
+
+      if (!reachable(block))
+        return type;
+
+      BlockRef def = m_blockOf[value];
+      bool ok = def == block ? (atEnd || value < m_value) : dominates(def, block);
+      if (!ok)
+        fail("operand %" + std::to_string(value) + " doesn't dominate its use");
+
+      return type;
+    }
+
+    void checkInstruction(Instruction const& inst) {
+      auto const& func = *m_func;
+      BlockRef block = m_blockOf[m_value];
+      TypeRef type = inst.type;
+      Type info = m_module.types->get(type);
+
+      bool numeric = info.id == TID_NUMBER || info.id == TID_FLOAT;
+
+      switch (inst.op) {
+        case Opcode::CONST_INT:
+          if (info.id != TID_NUMBER && info.id != TID_BOOLEAN)
+            fail("integer constant of a non-integer type");
+          break;
+        case Opcode::CONST_FLOAT:
+          if (info.id != TID_FLOAT)
+            fail("float constant of a non-float type");
+          break;
+        case Opcode::CONST_STRING:
+          if (type != TYPE_STRING)
+            fail("string constant of a non-string type");
+          break;
+
+        case Opcode::ADD:
+        case Opcode::SUB:
+        case Opcode::MUL:
+        case Opcode::DIV:
+        case Opcode::MOD:
+          if (!numeric)
+            fail("arithmetic on a non-number");
+          if (use(inst.args[0], block, false) != type || use(inst.args[1], block, false) != type)
+            fail("operands and result of different types");
+          break;
+
+        case Opcode::CMP_EQ:
+        case Opcode::CMP_NE:
+        case Opcode::CMP_LT:
+        case Opcode::CMP_LE:
+        case Opcode::CMP_GT:
+        case Opcode::CMP_GE:
+          if (type != TYPE_BOOLEAN)
+            fail("comparison result isn't boolean");
+          if (use(inst.args[0], block, false) != use(inst.args[1], block, false))
+            fail("compared operands of different types");
+          break;
+
+        case Opcode::NEG:
+          if (!numeric || use(inst.args[0], block, false) != type)
+            fail("negation of a non-number or of another type");
+          break;
+        case Opcode::NOT:
+          if (type != TYPE_BOOLEAN || use(inst.args[0], block, false) != TYPE_BOOLEAN)
+            fail("not of a non-boolean");
+          break;
+        case Opcode::CAST: {
+          use(inst.args[0], block, false);
+          Type from = typeOf(inst.args[0]);
+          bool fromNumber = from.id == TID_NUMBER || from.id == TID_FLOAT || from.id == TID_BOOLEAN;
+          if (!numeric || !fromNumber)
+            fail("cast between non-numbers");
+        } break;
+
+        case Opcode::PHI: {
+          if (m_value != func.blocks[block].first && func.insts[m_value - 1].op != Opcode::PHI)
+            fail("phi after other instructions");
+
+          auto const& preds = m_preds[block];
+          if (inst.list.first + inst.list.count > func.operands.size())
+            fail("operands out of range");
+          if (inst.list.count != preds.size() * 2)
+            fail("phi must have one value per predecessor");
+
+          for (uint32_t i = 0; i < inst.list.count; i += 2) {
+            BlockRef pred = func.operand(inst.list, i);
+            ValueRef value = func.operand(inst.list, i + 1);
+
+            if (std::find(preds.begin(), preds.end(), pred) == preds.end())
+              fail("phi value from b" + std::to_string(pred) + ", which isn't a predecessor");
+            for (uint32_t j = 0; j < i; j += 2) {
+              if (func.operand(inst.list, j) == pred)
+                fail("phi has two values from b" + std::to_string(pred));
+            }
+
+            if (use(value, pred, true) != type)
+              fail("phi value of another type");
+          }
+        } break;
+
+        case Opcode::CALL:
+          if (inst.call.args.first + inst.call.args.count > func.operands.size())
+            fail("operands out of range");
+          for (uint32_t i = 0; i < inst.call.args.count; ++i)
+            use(func.operand(inst.call.args, i), block, false);
+          break;
+
+        case Opcode::RET:
+          if (inst.args[0] == NO_VALUE) {
+            if (func.returnType != TYPE_VOID)
+              fail("no return value");
+          }
+          else if (use(inst.args[0], block, false) != func.returnType) {
+            fail("return value of another type");
+          }
+          break;
+
+        case Opcode::BR:
+          break;
+        case Opcode::BR_COND:
+          if (use(inst.branch.cond, block, false) != TYPE_BOOLEAN)
+            fail("branch condition isn't boolean");
+          break;
+      }
+
+      if (inst.isTerminator() && type != TYPE_VOID)
+        fail("terminator with a value");
+    }
+  };
+
+} // namespace lon
+
+void lon::verify(IRModule const& module) {
+  Verifier(module).run();
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "ir.hpp"
+
+namespace lon {
+
+  // Checks block structure, phis, operand types and that every use is
+  // dominated by its definition. Throws std::logic_error on the first
+  // problem, it's a bug in whatever produced the IR
+  void verify(IRModule const& module);
+
+  // Immediate dominator of every block, entry is its own,
+  // NO_VALUE for unreachable blocks
+  std::vector<BlockRef> dominators(IRFunction const& func);
+
+} // namespace lon
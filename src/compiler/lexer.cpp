@@ -1,26 +1,29 @@
 #include "lexer.hpp"
 
-#include <map>
-#include "../utils.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include "number.hpp"
 
 using lon::TokenID;
 using lon::Token;
 using lon::LexerResult;
 using lon::Lexer;
-
-static std::map<std::string, TokenID> KEYWORDS = {
-  {"function", lon::TK_FUNCTION},
-  {"return",   lon::TK_RETURN},
-  {"const",    lon::TK_CONST},
-  {"signed",   lon::TK_SIGNED},
-  {"unsigned", lon::TK_UNSIGNED},
-  {"void",     lon::TK_VOID},
-  {"byte",     lon::TK_BYTE},
-  {"short",    lon::TK_SHORT},
-  {"integer",  lon::TK_INTEGER},
-  {"long",     lon::TK_LONG},
-  {"char",     lon::TK_CHAR},
-  {"boolean",  lon::TK_BOOLEAN},
+using lon::Symbol;
+
+// token for every keyword symbol, indexed by symbol
+static const TokenID KEYWORDS[lon::SYM_KEYWORDS_END] = {
+  lon::TK_FUNCTION,
+  lon::TK_RETURN,
+  lon::TK_CONST,
+  lon::TK_SIGNED,
+  lon::TK_UNSIGNED,
+  lon::TK_VOID,
+  lon::TK_BYTE,
+  lon::TK_SHORT,
+  lon::TK_INTEGER,
+  lon::TK_LONG,
+  lon::TK_CHAR,
+  lon::TK_BOOLEAN,
 };
 
 std::string lon::TokenIDToString(TokenID id) {
@@ -34,6 +37,12 @@ std::string lon::TokenIDToString(TokenID id) {
     case TK_NUMBER_FLOAT: return "float number";
 
     case TK_RET_ARROW: return "->";
+    case TK_EQ: return "==";
+    case TK_NOT_EQ: return "!=";
+    case TK_LESS_EQ: return "<=";
+    case TK_GREATER_EQ: return ">=";
+    case TK_AND: return "&&";
+    case TK_OR: return "||";
 
     case TK_FUNCTION: return "keyword <function>";
     case TK_RETURN: return "keyword <return>";
@@ -52,101 +61,310 @@ std::string lon::TokenIDToString(TokenID id) {
   return std::string("unknown<") + std::to_string(id) + '>';
 }
 
-Lexer::Lexer(std::string_view inputFilePath, std::string_view replaceContent)
+Lexer::Lexer(SymbolTable& symbols, std::string_view inputFilePath, std::string_view replaceContent)
   : m_inputFileName(inputFilePath),
-    m_content(replaceContent)
+    m_symbols(symbols),
+    m_scan(scanKernels())
+{
+  if (!replaceContent.empty())
+    m_source = SourceBuffer::fromString(replaceContent);
+
+  m_base = m_limit = nullptr;
+  m_pt = m_tkStart = nullptr;
+  m_out = nullptr;
+  m_emitted = false;
+  m_deferSymbols = false;
+}
+
+Lexer::Lexer(SymbolTable& symbols, std::string_view inputFileName, SourceBuffer&& source)
+  : Lexer(symbols, inputFileName)
+{
+  m_source = std::move(source);
+}
+
+Lexer::Lexer(Lexer& parent, const char* begin, const char* end)
+  : m_inputFileName(parent.m_inputFileName),
+    m_symbols(parent.m_symbols),
+    m_scan(parent.m_scan)
 {
-  m_row = m_column = 1;
-  m_pt = nullptr;
+  m_base = parent.m_base;
+  m_limit = end;
+  m_pt = m_tkStart = begin;
+  m_out = nullptr;
+  m_emitted = false;
+  m_deferSymbols = true;
 }
 
 Lexer::~Lexer() = default;
 
-void Lexer::tokenize() {
+void Lexer::tokenize(ThreadPool* pool) {
   if (!m_tokens.empty())
     return;
 
-  if (m_content.empty()) {
-    std::ifstream file(m_inputFileName);
-    file.exceptions(std::ifstream::failbit);
-    m_content = slurpFile(file);
+  start();
+
+  if (pool && pool->size() > 1 && m_source.size() >= PARALLEL_MIN_SIZE) {
+    tokenizeParallel(*pool);
+    return;
   }
 
-  m_row = m_column = 1;
-  m_pt = m_content.data();
+  // rough guess, so usually the array is allocated once
+  m_tokens.reserve(m_source.size() / 6 + 16);
+
+  Token tk;
+  while (nextToken(tk))
+    m_tokens.push_back(tk);
+}
 
-  while (*m_pt) {
-    if (*m_pt == '\r') {
-      if (m_pt[1] != '\n')
-        throw LexerError("Invalid line separator in file. Classic Mac OS style not supported", m_row, m_column);
+// Chunks start right after a newline. Only a multi line comment can cross
+// that (strings can't have line breaks), and then the previous chunk eats
+// the comment and stops past its end. So a chunk is lexed right if the
+// previous one stopped at its beginning, otherwise it's lexed again from
+// where the previous one actually stopped
+void Lexer::tokenizeParallel(ThreadPool& pool) {
+  struct Chunk {
+    const char* begin;
+    const char* end;
+    const char* stop; // where lexer stopped, may be past the end
+    std::vector<Token> tokens;
+    std::exception_ptr error;
+  };
 
-      next();
+  const char* end = m_base + m_source.size();
+
+  size_t chunksCount = pool.size() * 4;
+  size_t chunkSize = m_source.size() / chunksCount + 1;
+
+  std::vector<Chunk> chunks;
+  chunks.reserve(chunksCount);
+
+  for (const char* begin = m_base; begin < end; ) {
+    const char* chunkEnd = end;
+
+    if ((size_t)(end - begin) > chunkSize) {
+      auto newline = (const char*)memchr(begin + chunkSize, '\n', end - begin - chunkSize);
+      if (newline)
+        chunkEnd = newline + 1;
     }
 
-    if (*m_pt == '\n') {
-      m_column = 1;
-      ++m_row; ++m_pt;
-      continue;
+    chunks.push_back({ begin, chunkEnd, chunkEnd, {}, nullptr });
+    begin = chunkEnd;
+  }
+
+  auto lexChunk = [this](Chunk& chunk, const char* from) {
+    chunk.tokens.clear();
+    chunk.error = nullptr;
+
+    Lexer lexer(*this, from, chunk.end);
+    chunk.tokens.reserve((chunk.end - from) / 6 + 16);
+
+    try {
+      Token tk;
+      while (lexer.nextToken(tk))
+        chunk.tokens.push_back(tk);
+    }
+    catch (LexerError&) {
+      chunk.error = std::current_exception();
     }
 
-    if (isspace(*m_pt)) {
-      next();
-      continue;
+    chunk.stop = lexer.m_pt;
+  };
+
+  pool.parallelFor(chunks.size(), [&](size_t i) {
+    lexChunk(chunks[i], chunks[i].begin);
+  });
+
+  // fix up in source order, same errors as sequential lexing
+  size_t total = 0;
+  const char* stop = m_base;
+
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    auto& chunk = chunks[i];
+
+    if (stop > chunk.begin) {
+      if (stop >= chunk.end) {
+        chunk.tokens.clear();
+        chunk.error = nullptr;
+        chunk.stop = stop;
+      }
+      else {
+        lexChunk(chunk, stop);
+      }
     }
 
-    m_tkRow = m_row, m_tkColumn = m_column;
+    if (chunk.error)
+      std::rethrow_exception(chunk.error);
+
+    stop = chunk.stop;
+    total += chunk.tokens.size();
+
+    // null char in the middle of the file, sequential lexer stops there too
+    const char* next = m_scan.skipWhitespace(stop);
+    if (!*next && next < end) {
+      chunks.resize(i + 1);
+      break;
+    }
+  }
+
+  // merge, interning names in the same order as sequential lexer does
+  m_tokens.reserve(total);
+
+  for (auto& chunk : chunks) {
+    for (Token tk : chunk.tokens) {
+      if (tk.id == TK_ID && tk.symbol == SYM_INVALID) {
+        tk.symbol = m_symbols.intern(std::string_view(m_base + tk.offset, tk.length));
+      }
+      else if (tk.id == TK_STRING) {
+        std::string_view raw(m_base + tk.offset + 1, tk.length - 2);
+        tk.symbol = internString(raw, raw.find('\\') != std::string_view::npos);
+      }
+
+      m_tokens.push_back(tk);
+    }
+  }
+
+  m_pt = stop;
+}
+
+void Lexer::load() {
+  if (m_source.empty())
+    m_source = SourceBuffer::fromFile(m_inputFileName);
+}
+
+void Lexer::start() {
+  load();
+
+  m_base = m_pt = m_source.data();
+  m_limit = m_base + m_source.size();
+}
+
+void Lexer::replaceSource(uint32_t offset, uint32_t length, std::string_view text) {
+  m_source.replace(offset, length, text);
+
+  // buffer may have moved, seek() restarts
+  m_base = m_limit = nullptr;
+  m_pt = m_tkStart = nullptr;
+}
+
+void Lexer::seek(uint32_t offset) {
+  start();
+  m_pt = m_base + offset;
+}
+
+bool Lexer::nextToken(Token& out) {
+  if (!m_pt)
+    start();
+
+  m_out = &out;
+  m_emitted = false;
+
+  while (!m_emitted) {
+    const char* consumed = m_pt;
+    m_pt = m_scan.skipWhitespace(m_pt);
+
+    if (!*m_pt || m_pt >= m_limit) {
+      // stay right after the last token or comment
+      m_pt = consumed;
+      return false;
+    }
+
+    // whitespace kernel skips only "\r\n" pairs
+    if (*m_pt == '\r')
+      error("Invalid line separator in file. Classic Mac OS style not supported", m_pt);
+
+    m_tkStart = m_pt;
 
     switch (*m_pt) {
       case '/':
         if (m_pt[1] == '/') {
           // single line comment
-          while (*m_pt != '\n')
-            next();
-
+          next(m_scan.findLineEnd(m_pt) - m_pt);
           continue;
         }
         else if (m_pt[1] == '*') {
           // multi line comment
-          while (*m_pt != '*' || m_pt[1] != '/') {
-            if (*m_pt == '\n') {
-              m_column = 1;
-              ++m_row;
-            }
-
-            next();
-          }
+          const char* end = m_scan.findCommentEnd(m_pt + 2);
+          if (!*end)
+            error("Unexpected EOF in multi line comment", m_tkStart);
 
-          next(2);
+          m_pt = end + 2;
           continue;
         }
 
         goto SINGLE_CHAR_TOKEN;
       case '.':
-      case '+':
-      case '-':
         if (isdigit(m_pt[1])) {
           processNumber();
           continue;
         }
 
-        if (*m_pt != '-')
-          goto SINGLE_CHAR_TOKEN;
-
+        goto SINGLE_CHAR_TOKEN;
+      case '-':
+        // sign is an operator, parser folds it into literals
         if (m_pt[1] == '>') {
+          next(2);
           token(TK_RET_ARROW);
+          continue;
+        }
+
+        goto SINGLE_CHAR_TOKEN;
+      case '=':
+        if (m_pt[1] == '=') {
+          next(2);
+          token(TK_EQ);
+          continue;
+        }
+
+        goto SINGLE_CHAR_TOKEN;
+      case '!':
+        if (m_pt[1] == '=') {
+          next(2);
+          token(TK_NOT_EQ);
+          continue;
+        }
+
+        goto SINGLE_CHAR_TOKEN;
+      case '<':
+        if (m_pt[1] == '=') {
+          next(2);
+          token(TK_LESS_EQ);
+          continue;
+        }
+
+        goto SINGLE_CHAR_TOKEN;
+      case '>':
+        if (m_pt[1] == '=') {
+          next(2);
+          token(TK_GREATER_EQ);
+          continue;
+        }
+
+        goto SINGLE_CHAR_TOKEN;
+      case '&':
+        if (m_pt[1] == '&') {
           next(2);
+          token(TK_AND);
           continue;
         }
 
-        // fallthrough
+        goto SINGLE_CHAR_TOKEN;
+      case '|':
+        if (m_pt[1] == '|') {
+          next(2);
+          token(TK_OR);
+          continue;
+        }
+
+        goto SINGLE_CHAR_TOKEN;
+      case '+':
       case '(':
       case ')':
       case '{':
       case '}':
       case ';':
       SINGLE_CHAR_TOKEN:
-        token(*m_pt);
         next();
+        token(*m_tkStart);
         continue;
       default:
         if (isdigit(*m_pt)) {
@@ -158,35 +376,42 @@ void Lexer::tokenize() {
         if (*m_pt == '"') {
           next();
           const char* begin = m_pt;
+          bool hasEscapes = false;
 
-          std::string buffer;
-          buffer.reserve(64);
+          while (true) {
+            next(m_scan.findStringSpecial(m_pt) - m_pt);
+
+            if (*m_pt == '"')
+              break;
 
-          while (*m_pt != '"') {
             switch (*m_pt) {
+              case '\0':
+                error("Unexpected EOF in string", m_tkStart);
               case '\r':
               case '\n':
-                throw LexerError("Unexpected line break in string", m_row, m_column);
+                error("Unexpected line break in string", m_pt);
               case '\\':
+                hasEscapes = true;
                 next();
 
                 switch (*m_pt) {
-                  case 'n': buffer.push_back('\n'); break;
-                  case 't': buffer.push_back('\t'); break;
+                  case 'n':
+                  case 't':
+                    break;
                   default:
-                    throw LexerError("Unknown escape sequence", m_row, m_column);
+                    error("Unknown escape sequence", m_pt);
                 }
 
                 break;
-              default:
-                buffer.push_back(*m_pt);
             }
 
             next();
           }
 
-          token(TK_STRING, buffer);
+          std::string_view raw(begin, m_pt - begin);
           next();
+
+          token(TK_STRING, m_deferSymbols ? SYM_INVALID : internString(raw, hasEscapes));
           continue;
         }
 
@@ -194,147 +419,243 @@ void Lexer::tokenize() {
         if (isalpha(*m_pt) || *m_pt == '_') {
           const char* begin = m_pt;
 
-          int length = 0;
-          while (isalnum(*m_pt) || *m_pt == '_')
-            ++length, next();
+          next(m_scan.findIdentifierEnd(m_pt) - m_pt);
 
-          std::string name(begin, length);
+          std::string_view name(begin, m_pt - begin);
 
-          auto it = KEYWORDS.find(name);
-          if (it != KEYWORDS.end()) {
-            token(it->second);
+          // table is only read while chunks are lexed in parallel,
+          // new names are interned when chunks are merged
+          Symbol symbol = m_deferSymbols ? m_symbols.find(name) : m_symbols.intern(name);
+          if (symbol < SYM_KEYWORDS_END) {
+            token(KEYWORDS[symbol]);
             continue;
           }
 
-          token(TK_ID, name);
+          token(TK_ID, symbol);
           continue;
         }
 
-        token(*m_pt);
         next();
+        token(*m_tkStart);
     }
   }
-}
-
-// parse number at m_pt
-void Lexer::processNumber() {
-  bool isNegative = false;
-
-  if (*m_pt == '+' || *m_pt == '-')
-    isNegative = (*m_pt == '-'), next();
 
-  // NaN (case-sensitive)
-  if (
-    m_pt[0] == 'N' &&
-    m_pt[1] == 'a' &&
-    m_pt[2] == 'N'
-  ) {
-    next(3);
-
-    double nan = std::numeric_limits<double>::quiet_NaN();
-    if (isNegative)
-      nan = -nan;
-    token(TK_NUMBER_FLOAT, nan);
+  return true;
+}
 
-    return;
-  }
+static inline bool isDecimalDigit(char chr) {
+  return chr >= '0' && chr <= '9';
+}
 
-  char* dt = nullptr; // dot pointer
-  int base = 10;
+// digit value for bases up to 16, 16 if not a digit
+static inline int digitValue(char chr) {
+  if (chr >= '0' && chr <= '9')
+    return chr - '0';
+  if (chr >= 'a' && chr <= 'f')
+    return chr - 'a' + 10;
+  if (chr >= 'A' && chr <= 'F')
+    return chr - 'A' + 10;
+  return 16;
+}
 
+// parse number at m_pt, literals have no sign
+void Lexer::processNumber() {
   if (*m_pt == '0') {
     switch (m_pt[1]) {
       case 'x':
       case 'X':
-        base = 16;
         next(2);
-        break;
+        processRadixNumber(4);
+        return;
       case 'b':
       case 'B':
-        base = 2;
         next(2);
-        break;
-      default:
-        while (*m_pt == '0')
-          next();
-        break;
+        processRadixNumber(1);
+        return;
     }
   }
 
-  // hex and bin
-  if (base != 10) {
-    union { int64_t result; uint64_t uresult; };
-    result = 0;
-    int count = 0;
+  processDecimalNumber();
+}
 
-    if (base == 2) {
-      while (*m_pt == '0' || *m_pt == '1') {
-        if (count == 64)
-          throw LexerError("Too big number", m_tkRow, m_tkColumn);
+// skips '_' between digits, m_pt is at '_'
+void Lexer::digitSeparator(int base) {
+  if (digitValue(m_pt[-1]) >= base || digitValue(m_pt[1]) >= base)
+    error("Digit separator must be between digits", m_pt);
 
-        ++count;
-        uresult <<= 1;
-        if (*m_pt == '1')
-          uresult |= 1;
+  next();
+}
 
-        next();
-      }
+// hexadecimal and binary integers after the prefix
+void Lexer::processRadixNumber(int bitsPerDigit) {
+  int base = 1 << bitsPerDigit;
+  uint64_t result = 0;
+  const char* digitsStart = m_pt;
 
-      if (isalnum(*m_pt))
-        throw new LexerError("Invalid digit for a binary number", m_row, m_column);
+  while (true) {
+    if (*m_pt == '_') {
+      digitSeparator(base);
+      continue;
     }
-    else if (base == 16) {
-      while (
-        isdigit(*m_pt) ||
-        (*m_pt >= 'a' && *m_pt <= 'f') ||
-        (*m_pt >= 'A' && *m_pt <= 'F')
-      ) {
-        if (count == 16)
-          throw LexerError("Too big number", m_tkRow, m_tkColumn);
-
-        ++count;
-        uresult <<= 4;
-
-        if (isdigit(*m_pt))
-          uresult |= (*m_pt) - '0';
-        else if (*m_pt >= 'a' && *m_pt <= 'f')
-          uresult |= ((*m_pt) - 'a') + 10;
-        else if (*m_pt >= 'A' && *m_pt <= 'F')
-          uresult |= ((*m_pt) - 'A') + 10;
 
-        next();
-      }
+    int digit = digitValue(*m_pt);
+    if (digit >= base)
+      break;
+
+    if (result >> (64 - bitsPerDigit))
+      error("Too big number", m_tkStart);
+
+    result = (result << bitsPerDigit) | (uint64_t)digit;
+    next();
+  }
 
-      if (isalpha(*m_pt))
-        throw new LexerError("Invalid digit for a hexadecimal number", m_row, m_column);
+  if (m_pt == digitsStart || isalnum(*m_pt) || *m_pt == '_') {
+    error(
+      base == 2
+        ? "Invalid digit for a binary number"
+        : "Invalid digit for a hexadecimal number",
+      m_pt
+    );
+  }
+
+  token(TK_NUMBER_INT, result);
+}
+
+// Decimal integer or float.
+// Floats keep the first 19 significant digits and a decimal exponent,
+// that's enough for decimalToDouble in all but pathological cases
+void Lexer::processDecimalNumber() {
+  uint64_t integer = 0;
+  bool integerOverflow = false;
+
+  uint64_t mantissa = 0;
+  int mantissaDigits = 0;
+  int64_t exponent = 0;
+  bool truncated = false;
+  bool isFloat = false;
+
+  // integer part
+  while (true) {
+    if (*m_pt == '_') {
+      digitSeparator(10);
+      continue;
     }
 
-    if (isNegative)
-      result = -result;
+    if (!isDecimalDigit(*m_pt))
+      break;
 
-    token(TK_NUMBER_INT, uresult);
-    return;
+    uint64_t digit = (uint64_t)(*m_pt - '0');
+
+    if (integer > (UINT64_MAX - digit) / 10)
+      integerOverflow = true;
+    else
+      integer = integer * 10 + digit;
+
+    if (mantissaDigits < 19) {
+      if (mantissa != 0 || digit != 0) {
+        mantissa = mantissa * 10 + digit;
+        ++mantissaDigits;
+      }
+    }
+    else {
+      ++exponent;
+      truncated |= digit != 0;
+    }
+
+    next();
   }
 
-  // decimal
-  union { int64_t result; uint64_t uresult; };
-  result = 0;
+  // fraction
+  if (*m_pt == '.' && isDecimalDigit(m_pt[1])) {
+    isFloat = true;
+    next();
+
+    while (true) {
+      if (*m_pt == '_') {
+        digitSeparator(10);
+        continue;
+      }
+
+      if (!isDecimalDigit(*m_pt))
+        break;
+
+      uint64_t digit = (uint64_t)(*m_pt - '0');
+
+      if (mantissaDigits < 19) {
+        if (mantissa != 0 || digit != 0) {
+          mantissa = mantissa * 10 + digit;
+          ++mantissaDigits;
+        }
+        --exponent;
+      }
+      else {
+        truncated |= digit != 0;
+      }
 
-  while (isdigit(*m_pt)) {
-    result *= 10;
-    result += (*m_pt) - '0';
+      next();
+    }
+  }
+
+  // exponent
+  if (
+    (*m_pt == 'e' || *m_pt == 'E') &&
+    (
+      isDecimalDigit(m_pt[1]) ||
+      ((m_pt[1] == '+' || m_pt[1] == '-') && isDecimalDigit(m_pt[2]))
+    )
+  ) {
+    isFloat = true;
     next();
+
+    bool isExponentNegative = false;
+    if (*m_pt == '+' || *m_pt == '-')
+      isExponentNegative = (*m_pt == '-'), next();
+
+    int64_t value = 0;
+    while (true) {
+      if (*m_pt == '_') {
+        digitSeparator(10);
+        continue;
+      }
+
+      if (!isDecimalDigit(*m_pt))
+        break;
+
+      // anything past that is zero or infinity anyway
+      if (value < 100000)
+        value = value * 10 + (*m_pt - '0');
+
+      next();
+    }
+
+    exponent += isExponentNegative ? -value : value;
+  }
+
+  if (isalnum(*m_pt) || *m_pt == '_')
+    error("Invalid digit for a decimal number", m_pt);
+
+  if (!isFloat) {
+    if (integerOverflow)
+      error("Too big number", m_tkStart);
+
+    token(TK_NUMBER_INT, integer);
+    return;
   }
 
-  if (isalpha(*m_pt))
-    throw new LexerError("Invalid digit for a decimal number", m_row, m_column);
+  double result = decimalToDouble(mantissa, exponent);
 
-  if (isNegative)
-    result = -result;
+  // digits were dropped, so the value is between mantissa and mantissa + 1
+  if (truncated && result != decimalToDouble(mantissa + 1, exponent)) {
+    m_stringBuffer.clear();
+    for (const char* pt = m_tkStart; pt < m_pt; ++pt) {
+      if (*pt != '_')
+        m_stringBuffer.push_back(*pt);
+    }
 
-  token(TK_NUMBER_INT, uresult);
+    result = strtod(m_stringBuffer.c_str(), nullptr);
+  }
 
-  // TODO floats
+  token(TK_NUMBER_FLOAT, result);
 }
 
 void Lexer::debugPrint() {
@@ -353,6 +674,12 @@ void Lexer::debugPrint() {
         case TK_NUMBER_INT:   printf("integer number"); break;
         case TK_NUMBER_FLOAT: printf("float number"); break;
         case TK_RET_ARROW:    printf("->"); break;
+        case TK_EQ:           printf("=="); break;
+        case TK_NOT_EQ:       printf("!="); break;
+        case TK_LESS_EQ:      printf("<="); break;
+        case TK_GREATER_EQ:   printf(">="); break;
+        case TK_AND:          printf("&&"); break;
+        case TK_OR:           printf("||"); break;
         case TK_FUNCTION:     printf("keyword <function>"); break;
         case TK_RETURN:       printf("keyword <return>"); break;
         case TK_CONST:        printf("keyword <const>"); break;
@@ -370,44 +697,74 @@ void Lexer::debugPrint() {
     }
 
     if (tk.id == TK_ID)
-      printf(" %s", tk.strValue.c_str());
+      printf(" %s", m_symbols.cname(tk.symbol));
     else if (tk.id == TK_STRING)
-      printf(" \"%s\"", tk.strValue.c_str());
+      printf(" \"%s\"", m_symbols.cname(tk.symbol));
     else if (tk.id == TK_NUMBER_INT)
       printf(" %llu", tk.intValue);
     else if (tk.id == TK_NUMBER_FLOAT)
       printf(" %lf", tk.fltValue);
 
-    printf(" at %d:%d\n", tk.row, tk.column);
+    SourceLocation location = m_source.locate(tk.offset);
+    printf(" at %d:%d\n", location.row, location.column);
   }
 }
 
 void Lexer::token(TokenID id) {
-  m_tokens.push_back(Token { id, m_tkRow, m_tkColumn, "", 0 });
+  *m_out = Token { id, (uint32_t)(m_tkStart - m_base), (uint32_t)(m_pt - m_tkStart) };
+  m_out->intValue = 0;
+  m_emitted = true;
 }
 
-void Lexer::token(TokenID id, std::string_view value) {
-  m_tokens.push_back(Token { id, m_tkRow, m_tkColumn, std::string(value), 0 });
+void Lexer::token(TokenID id, Symbol symbol) {
+  token(id);
+  m_out->symbol = symbol;
 }
 
 void Lexer::token(TokenID id, uint64_t value) {
-  m_tokens.push_back(Token { id, m_tkRow, m_tkColumn, "", value });
+  token(id);
+  m_out->intValue = value;
 }
 
 void Lexer::token(TokenID id, double value) {
-  Token token { id, m_tkRow, m_tkColumn, "", 0 };
-  token.fltValue = value;
-  m_tokens.emplace_back(std::move(token));
+  token(id);
+  m_out->fltValue = value;
 }
 
 inline void Lexer::next(int amount) {
   m_pt += amount;
-  m_column += amount;
 }
 
-LexerResult Lexer::getResult() const {
+void Lexer::error(const char* info, const char* pt) {
+  throw LexerError(info, (uint32_t)(pt - m_base));
+}
+
+Symbol Lexer::internString(std::string_view raw, bool hasEscapes) {
+  if (!hasEscapes)
+    return m_symbols.intern(raw);
+
+  m_stringBuffer.clear();
+
+  for (size_t i = 0; i < raw.size(); ++i) {
+    if (raw[i] != '\\') {
+      m_stringBuffer.push_back(raw[i]);
+      continue;
+    }
+
+    switch (raw[++i]) {
+      case 'n': m_stringBuffer.push_back('\n'); break;
+      case 't': m_stringBuffer.push_back('\t'); break;
+    }
+  }
+
+  return m_symbols.intern(m_stringBuffer);
+}
+
+LexerResult Lexer::takeResult() {
   return {
     m_inputFileName,
-    m_tokens
+    &m_symbols,
+    std::move(m_source),
+    std::move(m_tokens)
   };
 }
@@ -1,8 +1,14 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string>
-#include <list>
+#include <string_view>
+#include <vector>
+#include "source.hpp"
+#include "symbols.hpp"
+#include "scan.hpp"
+#include "thread_pool.hpp"
 
 namespace lon {
 
@@ -18,6 +24,12 @@ namespace lon {
 
     // multiple chars
     TK_RET_ARROW,
+    TK_EQ, // ==
+    TK_NOT_EQ, // !=
+    TK_LESS_EQ, // <=
+    TK_GREATER_EQ, // >=
+    TK_AND, // &&
+    TK_OR, // ||
 
     // keywords
     TK_FUNCTION,
@@ -32,7 +44,9 @@ namespace lon {
     TK_INTEGER,
     TK_LONG,
     TK_CHAR,
-    TK_BOOLEAN
+    TK_BOOLEAN,
+
+    TK_COUNT
   };
 
   // do like that so we can implicitly convert chars to token id
@@ -40,12 +54,15 @@ namespace lon {
 
   std::string TokenIDToString(TokenID id);
 
+  // Plain data, tokens are stored in one contiguous array.
+  // TK_ID and TK_STRING don't own their text, it's interned in SymbolTable.
+  // Row and column are computed from offset only when needed (SourceBuffer::locate)
   struct Token {
     TokenID id;
-    int row; // starts from 1
-    int column; // starts from 1
-    std::string strValue; // TK_ID, TK_STRING
+    uint32_t offset; // in source
+    uint32_t length; // in source, with quotes for strings
     union {
+      Symbol symbol; // TK_ID, TK_STRING (with decoded escapes)
       uint64_t intValue; // TK_NUMBER_INT
       double fltValue; // TK_NUMBER_FLOAT
     };
@@ -53,58 +70,119 @@ namespace lon {
 
   class LexerError : public std::exception {
   private:
-    int m_row;
-    int m_column;
+    const char* m_info;
+    uint32_t m_offset;
 
   public:
-    LexerError(const char* info, int row, int column)
-      : m_row(row), m_column(column), std::exception(info) {}
+    LexerError(const char* info, uint32_t offset)
+      : m_info(info), m_offset(offset), std::exception() {}
+
+    virtual const char* what() const noexcept override { return m_info; }
 
-    inline int row() const { return m_row; }
-    inline int column() const { return m_column; }
+    inline uint32_t offset() const { return m_offset; }
   };
 
   struct LexerResult {
     std::string inputFileName;
-    std::list<Token> tokens;
+    SymbolTable* symbols;
+    SourceBuffer source;
+    std::vector<Token> tokens;
+
+    inline std::string_view text(Token const& tk) const {
+      return { source.data() + tk.offset, tk.length };
+    }
   };
 
   class Lexer {
   private:
     std::string m_inputFileName;
-    std::string m_content;
+    SymbolTable& m_symbols;
+    ScanKernels const& m_scan;
+    SourceBuffer m_source;
 
-    // position of m_pt
-    int m_row;
-    int m_column;
+    // beginning of the source, token offsets are relative to it
+    const char* m_base;
 
-    // position of the current token beginning
-    int m_tkRow;
-    int m_tkColumn;
+    // lexing stops on null char or after this
+    const char* m_limit;
 
     // current char pointer
     const char* m_pt;
 
-    std::list<Token> m_tokens;
+    // current token beginning
+    const char* m_tkStart;
+
+    std::vector<Token> m_tokens;
+
+    // where nextToken() puts the token
+    Token* m_out;
+    bool m_emitted;
+
+    // decoded string literal with escapes
+    std::string m_stringBuffer;
+
+    // TK_ID and TK_STRING get SYM_INVALID unless already interned,
+    // chunk lexers can't modify the symbol table
+    bool m_deferSymbols;
 
   public:
-    Lexer(std::string_view inputFilePath, std::string_view replaceContent = "");
+    Lexer(SymbolTable& symbols, std::string_view inputFilePath, std::string_view replaceContent = "");
+
+    // Lexes already loaded source
+    Lexer(SymbolTable& symbols, std::string_view inputFileName, SourceBuffer&& source);
+
     ~Lexer();
 
   public:
-    void tokenize();
+    // Smaller files are always lexed on one thread
+    static constexpr size_t PARALLEL_MIN_SIZE = 1024 * 1024;
+
+    // Loads source if it isn't loaded yet, throws if file can't be read
+    void load();
+
+    // Lexes whole file into token array.
+    // With a pool, big files are split into chunks lexed in parallel
+    void tokenize(ThreadPool* pool = nullptr);
+
+    // Lexes one more token, false on end of file.
+    // Use either this or tokenize(), not both
+    bool nextToken(Token& token);
+
     void debugPrint();
 
-    LexerResult getResult() const;
+    // Moves tokens and source out of lexer
+    LexerResult takeResult();
+
+    // For incremental relexing (see Document).
+    // Replaces source bytes, then nextToken() continues from seek() offset,
+    // which must be where some token could start (not in a comment or a token)
+    void replaceSource(uint32_t offset, uint32_t length, std::string_view text);
+    void seek(uint32_t offset);
+
+    std::string const& inputFileName() const { return m_inputFileName; }
+    SourceBuffer const& source() const { return m_source; }
+    SymbolTable& symbols() const { return m_symbols; }
 
   private:
+    // lexer for chunk [begin, end) of parent's source
+    Lexer(Lexer& parent, const char* begin, const char* end);
+
+    void start();
+    void tokenizeParallel(ThreadPool& pool);
     void processNumber();
+    void processRadixNumber(int bitsPerDigit);
+    void processDecimalNumber();
+    void digitSeparator(int base);
 
+    // all of these make a token from m_tkStart to m_pt
     void token(TokenID id);
-    void token(TokenID id, std::string_view value);
+    void token(TokenID id, Symbol symbol);
     void token(TokenID id, uint64_t value);
     void token(TokenID id, double value);
     void next(int amount = 1);
+
+    [[noreturn]] void error(const char* info, const char* pt);
+    Symbol internString(std::string_view raw, bool hasEscapes);
   };
 
 } // namespace lon
@@ -0,0 +1,398 @@
+#include "linker.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+using lon::LinkOptions;
+using lon::ObjectCode;
+using lon::SectionId;
+
+namespace lon {
+
+  class Linker {
+  private:
+    static constexpr uint32_t FILE_ALIGNMENT = 0x200;
+    static constexpr uint32_t SECTION_ALIGNMENT = 0x1000;
+
+    // parts of a minimal image are aligned like this in its one section
+    static constexpr uint32_t PART_ALIGNMENT = 16;
+
+    static constexpr uint32_t DOS_HEADER_SIZE = 0x40;
+    static constexpr uint32_t PE_HEADERS_SIZE = 4 + 20 + 224; // signature, file and optional headers
+    static constexpr uint32_t SECTION_HEADER_SIZE = 40;
+    static constexpr uint32_t IMPORT_DESCRIPTOR_SIZE = 20;
+
+    // in order of the image, data last so its reserved bytes stay out of the file
+    static constexpr SectionId ORDER[] = { SECTION_TEXT, SECTION_RDATA, SECTION_IDATA, SECTION_DATA };
+
+    // prints a message and exits if run in DOS
+    static constexpr uint8_t DOS_STUB[] = {
+      0x0E, 0x1F, 0xBA, 0x0E, 0x00, 0xB4, 0x09, 0xCD, 0x21, 0xB8, 0x01, 0x4C, 0xCD, 0x21,
+      'T', 'h', 'i', 's', ' ', 'p', 'r', 'o', 'g', 'r', 'a', 'm', ' ', 'c', 'a', 'n', 'n', 'o', 't', ' ',
+      'b', 'e', ' ', 'r', 'u', 'n', ' ', 'i', 'n', ' ', 'D', 'O', 'S', ' ', 'm', 'o', 'd', 'e', '.',
+      '\r', '\r', '\n', '$'
+    };
+
+    // sections of the image
+    struct ImageSection {
+      char name[8];
+      uint32_t characteristics;
+      uint32_t virtualSize;
+      uint32_t rva;
+      uint32_t rawSize;
+      uint32_t fileOffset;
+    };
+
+    // import tables of one library
+    struct Library {
+      std::string const* name;
+      std::vector<Import const*> procedures;
+      uint32_t lookup; // offsets in the import section
+      uint32_t addresses;
+      uint32_t nameOffset;
+    };
+
+    ObjectCode const& m_object;
+    LinkOptions m_options;
+
+    Section m_imports; // SECTION_IDATA
+    std::vector<Library> m_libraries;
+    std::vector<LabelDefinition> m_labels; // of the object, imports defined
+
+    std::vector<ImageSection> m_sections;
+    uint32_t m_partSection[SECTION_COUNT]; // in m_sections
+    uint32_t m_partOffset[SECTION_COUNT]; // in its image section
+    uint32_t m_fileAlignment;
+    uint32_t m_sectionAlignment;
+    uint32_t m_headersSize;
+    uint32_t m_imageSize;
+
+    std::vector<uint8_t> m_file;
+
+  public:
+    Linker(ObjectCode const& object, LinkOptions const& options) : m_object(object), m_options(options) {}
+
+    std::vector<uint8_t> run() {
+      if (!m_object.errors.empty())
+        throw LinkerError(m_object.errors.front());
+
+      m_labels = m_object.labels;
+      m_fileAlignment = FILE_ALIGNMENT;
+      m_sectionAlignment = m_options.minimal ? FILE_ALIGNMENT : SECTION_ALIGNMENT;
+
+      groupImports();
+      layout();
+      buildImports();
+      writeHeaders();
+      writeSections();
+      return std::move(m_file);
+    }
+
+  private:
+    static uint32_t align(uint32_t value, uint32_t alignment) {
+      return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    Section const& part(SectionId id) const {
+      return id == SECTION_IDATA ? m_imports : m_object.sections[id];
+    }
+
+    uint32_t rva(LabelRef label) const {
+      if (label >= m_labels.size() || m_labels[label].section == SECTION_NONE)
+        throw LinkerError("undefined label " + std::to_string(label));
+
+      auto const& definition = m_labels[label];
+      return m_sections[m_partSection[definition.section]].rva + m_partOffset[definition.section] + definition.offset;
+    }
+
+    void put16(uint32_t offset, uint16_t value) {
+      m_file[offset] = (uint8_t)value;
+      m_file[offset + 1] = (uint8_t)(value >> 8);
+    }
+
+    void put32(uint32_t offset, uint32_t value) {
+      put16(offset, (uint16_t)value);
+      put16(offset + 2, (uint16_t)(value >> 16));
+    }
+
+    // Sizes of the import section, so it can be placed before it's filled.
+    // Descriptors, lookup tables, address tables, names of procedures,
+    // names of libraries
+    void groupImports() {
+      for (auto const& import : m_object.imports) {
+        Library* library = nullptr;
+        for (auto& other : m_libraries) {
+          if (*other.name == import.library)
+            library = &other;
+        }
+
+        if (!library) {
+          m_libraries.push_back({ &import.library, {}, 0, 0, 0 });
+          library = &m_libraries.back();
+        }
+        library->procedures.push_back(&import);
+      }
+
+      if (m_libraries.empty())
+        return;
+
+      uint32_t size = (uint32_t)(m_libraries.size() + 1) * IMPORT_DESCRIPTOR_SIZE;
+      for (auto& library : m_libraries) {
+        library.lookup = size;
+        size += (uint32_t)(library.procedures.size() + 1) * 4;
+      }
+
+      // address tables are together for the IAT directory
+      for (auto& library : m_libraries) {
+        library.addresses = size;
+        for (size_t i = 0; i < library.procedures.size(); ++i) {
+          auto const* import = library.procedures[i];
+          m_labels.resize(std::max(m_labels.size(), (size_t)import->label + 1), { SECTION_NONE, 0 });
+          m_labels[import->label] = { SECTION_IDATA, size + (uint32_t)i * 4 };
+        }
+        size += (uint32_t)(library.procedures.size() + 1) * 4;
+      }
+
+      // hint, then name, padded to even size
+      for (auto const& library : m_libraries) {
+        for (auto const* import : library.procedures)
+          size += align(2 + (uint32_t)import->procedure.size() + 1, 2);
+      }
+
+      for (auto& library : m_libraries) {
+        library.nameOffset = size;
+        size += align((uint32_t)library.name->size() + 1, 2);
+      }
+
+      m_imports.bytes.assign(size, 0);
+    }
+
+    void layout() {
+      uint32_t count = 0;
+      for (SectionId id : ORDER) {
+        Section const& section = part(id);
+        if (!section.bytes.empty() || section.reserved != 0)
+          count++;
+      }
+
+      uint32_t stubSize = m_options.minimal ? 0 : (uint32_t)sizeof(DOS_STUB);
+      uint32_t peOffset = align(DOS_HEADER_SIZE + stubSize, 8);
+      uint32_t sectionsCount = m_options.minimal ? std::min(count, 1u) : count;
+      m_headersSize = align(peOffset + PE_HEADERS_SIZE + sectionsCount * SECTION_HEADER_SIZE, m_fileAlignment);
+
+      uint32_t rva = align(m_headersSize, m_sectionAlignment);
+      uint32_t fileOffset = m_headersSize;
+
+      for (SectionId id : ORDER) {
+        Section const& section = part(id);
+        m_partSection[id] = 0;
+        m_partOffset[id] = 0;
+        if (section.bytes.empty() && section.reserved == 0)
+          continue;
+
+        if (m_options.minimal && !m_sections.empty()) {
+          // after the rest of the one section, nothing is reserved before data
+          ImageSection& image = m_sections.back();
+          m_partOffset[id] = align(image.virtualSize, PART_ALIGNMENT);
+          image.virtualSize = m_partOffset[id] + (uint32_t)section.bytes.size() + section.reserved;
+          image.rawSize = align(m_partOffset[id] + (uint32_t)section.bytes.size(), m_fileAlignment);
+          continue;
+        }
+
+        ImageSection image = {};
+        switch (id) {
+          case SECTION_TEXT:
+            memcpy(image.name, ".text", 5);
+            image.characteristics = 0x60000020; // code, execute, read
+            break;
+          case SECTION_RDATA:
+            memcpy(image.name, ".rdata", 6);
+            image.characteristics = 0x40000040; // initialized data, read
+            break;
+          case SECTION_IDATA:
+            memcpy(image.name, ".idata", 6);
+            image.characteristics = 0xC0000040; // initialized data, read, write
+            break;
+          default:
+            memcpy(image.name, ".data", 5);
+            image.characteristics = 0xC0000040;
+            break;
+        }
+
+        if (m_options.minimal)
+          image.characteristics = 0xE0000060; // code and data, everything allowed
+
+        image.virtualSize = (uint32_t)section.bytes.size() + section.reserved;
+        image.rva = rva;
+        image.rawSize = align((uint32_t)section.bytes.size(), m_fileAlignment);
+        image.fileOffset = fileOffset;
+
+        m_partSection[id] = (uint32_t)m_sections.size();
+        m_sections.push_back(image);
+
+        if (!m_options.minimal) {
+          rva = align(rva + image.virtualSize, m_sectionAlignment);
+          fileOffset += image.rawSize;
+        }
+      }
+
+      for (auto& image : m_sections) {
+        if (image.rawSize == 0)
+          image.fileOffset = 0;
+      }
+
+      m_imageSize = m_sections.empty() ? rva : align(m_sections.back().rva + m_sections.back().virtualSize, m_sectionAlignment);
+    }
+
+    void buildImports() {
+      if (m_libraries.empty())
+        return;
+
+      uint32_t base = m_sections[m_partSection[SECTION_IDATA]].rva + m_partOffset[SECTION_IDATA];
+      auto& bytes = m_imports.bytes;
+
+      auto set = [&](uint32_t offset, uint32_t value) {
+        for (int i = 0; i < 4; ++i)
+          bytes[offset + i] = (uint8_t)(value >> (i * 8));
+      };
+
+      // names of procedures follow the last address table
+      auto const& last = m_libraries.back();
+      uint32_t names = last.addresses + (uint32_t)(last.procedures.size() + 1) * 4;
+
+      for (size_t i = 0; i < m_libraries.size(); ++i) {
+        auto const& library = m_libraries[i];
+        uint32_t descriptor = (uint32_t)i * IMPORT_DESCRIPTOR_SIZE;
+        set(descriptor, base + library.lookup);
+        set(descriptor + 12, base + library.nameOffset);
+        set(descriptor + 16, base + library.addresses);
+
+        for (size_t j = 0; j < library.procedures.size(); ++j) {
+          auto const& name = library.procedures[j]->procedure;
+          set(library.lookup + (uint32_t)j * 4, base + names);
+          set(library.addresses + (uint32_t)j * 4, base + names);
+          memcpy(bytes.data() + names + 2, name.data(), name.size());
+          names += align(2 + (uint32_t)name.size() + 1, 2);
+        }
+
+        memcpy(bytes.data() + library.nameOffset, library.name->data(), library.name->size());
+      }
+    }
+
+    void writeHeaders() {
+      uint32_t fileSize = m_headersSize;
+      for (auto const& image : m_sections)
+        fileSize = std::max(fileSize, image.fileOffset + image.rawSize);
+      m_file.assign(fileSize, 0);
+
+      uint32_t stubSize = m_options.minimal ? 0 : (uint32_t)sizeof(DOS_STUB);
+      uint32_t pe = align(DOS_HEADER_SIZE + stubSize, 8);
+
+      // DOS header, only e_lfanew matters to Windows
+      m_file[0] = 'M';
+      m_file[1] = 'Z';
+      if (!m_options.minimal) {
+        put16(0x02, (uint16_t)(pe % 512)); // bytes in last page
+        put16(0x04, (uint16_t)align(pe, 512) / 512); // pages
+        put16(0x08, DOS_HEADER_SIZE / 16); // header paragraphs
+        put16(0x0C, 0xFFFF); // maximum extra paragraphs
+        put16(0x10, 0xB8); // sp
+        put16(0x18, DOS_HEADER_SIZE); // relocations
+        memcpy(m_file.data() + DOS_HEADER_SIZE, DOS_STUB, sizeof(DOS_STUB));
+      }
+      put32(0x3C, pe);
+
+      memcpy(m_file.data() + pe, "PE\0\0", 4);
+
+      // file header, no time stamp so builds are reproducible
+      uint32_t header = pe + 4;
+      put16(header, 0x14C); // i386
+      put16(header + 2, (uint16_t)m_sections.size());
+      put16(header + 16, 224); // optional header size
+      put16(header + 18, 0x010F); // no relocations, executable, no line numbers and symbols, 32-bit
+
+      uint32_t codeSize = 0, dataSize = 0, codeBase = 0, dataBase = 0;
+      for (auto const& image : m_sections) {
+        if (image.characteristics & 0x20) {
+          codeSize += image.rawSize;
+          codeBase = codeBase ? codeBase : image.rva;
+        }
+        else {
+          dataSize += image.rawSize;
+          dataBase = dataBase ? dataBase : image.rva;
+        }
+      }
+
+      uint32_t optional = header + 20;
+      put16(optional, 0x10B); // PE32
+      m_file[optional + 2] = 1; // linker version
+      put32(optional + 4, codeSize);
+      put32(optional + 8, dataSize);
+      put32(optional + 16, m_object.entry != NO_LABEL ? rva(m_object.entry) : 0);
+      put32(optional + 20, codeBase);
+      put32(optional + 24, dataBase);
+      put32(optional + 28, IMAGE_BASE);
+      put32(optional + 32, m_sectionAlignment);
+      put32(optional + 36, m_fileAlignment);
+      put16(optional + 40, 4); // operating system version
+      put16(optional + 48, 4); // subsystem version
+      put32(optional + 56, m_imageSize);
+      put32(optional + 60, m_headersSize);
+      put16(optional + 68, 3); // console
+      put32(optional + 72, 0x100000); // stack reserve
+      put32(optional + 76, 0x1000); // stack commit
+      put32(optional + 80, 0x100000); // heap reserve
+      put32(optional + 84, 0x1000); // heap commit
+      put32(optional + 92, 16); // data directories
+
+      if (!m_libraries.empty()) {
+        uint32_t base = m_sections[m_partSection[SECTION_IDATA]].rva + m_partOffset[SECTION_IDATA];
+        auto const& last = m_libraries.back();
+        uint32_t addresses = m_libraries.front().addresses;
+
+        put32(optional + 104, base); // import directory
+        put32(optional + 108, (uint32_t)(m_libraries.size() + 1) * IMPORT_DESCRIPTOR_SIZE);
+        put32(optional + 192, base + addresses); // import address table
+        put32(optional + 196, last.addresses + (uint32_t)(last.procedures.size() + 1) * 4 - addresses);
+      }
+
+      uint32_t sectionHeader = optional + 224;
+      for (auto const& image : m_sections) {
+        memcpy(m_file.data() + sectionHeader, image.name, 8);
+        put32(sectionHeader + 8, image.virtualSize);
+        put32(sectionHeader + 12, image.rva);
+        put32(sectionHeader + 16, image.rawSize);
+        put32(sectionHeader + 20, image.fileOffset);
+        put32(sectionHeader + 36, image.characteristics);
+        sectionHeader += SECTION_HEADER_SIZE;
+      }
+    }
+
+    void writeSections() {
+      for (SectionId id : ORDER) {
+        Section const& section = part(id);
+        if (section.bytes.empty())
+          continue;
+
+        auto const& image = m_sections[m_partSection[id]];
+        memcpy(m_file.data() + image.fileOffset + m_partOffset[id], section.bytes.data(), section.bytes.size());
+      }
+
+      // addresses are added to what is stored at the place
+      for (auto const& relocation : m_object.relocations) {
+        auto const& image = m_sections[m_partSection[relocation.section]];
+        uint32_t offset = image.fileOffset + m_partOffset[relocation.section] + relocation.offset;
+
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+          value |= (uint32_t)m_file[offset + i] << (i * 8);
+        put32(offset, value + IMAGE_BASE + rva(relocation.label));
+      }
+    }
+  };
+
+} // namespace lon
+
+std::vector<uint8_t> lon::link(ObjectCode const& object, LinkOptions const& options) {
+  return Linker(object, options).run();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "encoder.hpp"
+
+namespace lon {
+
+  class LinkerError : public std::exception {
+  private:
+    std::string m_info;
+
+  public:
+    LinkerError(std::string_view info)
+      : m_info(info), std::exception() {}
+
+    virtual const char* what() const noexcept override { return m_info.c_str(); }
+  };
+
+  // Where the image is loaded, it has no base relocations
+  constexpr uint32_t IMAGE_BASE = 0x400000;
+
+  struct LinkOptions {
+    // No DOS stub, everything in one section aligned like the file
+    bool minimal = false;
+  };
+
+  // PE32 console executable of object, relocations resolved and the import
+  // table built from object.imports. Nothing depends on time or memory
+  // layout, the same object always gives the same bytes.
+  // Throws LinkerError on errors of object and undefined labels
+  std::vector<uint8_t> link(ObjectCode const& object, LinkOptions const& options);
+
+} // namespace lon
@@ -0,0 +1,126 @@
+#include "literal_pool.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+using lon::LabelRef;
+using lon::LiteralPool;
+using lon::MachineCode;
+using lon::ObjectCode;
+using lon::SectionId;
+
+void LiteralPool::clear() {
+  m_literals.clear();
+  m_index.clear();
+  m_size = 0;
+}
+
+LabelRef LiteralPool::add(MachineCode& code, std::string bytes, uint32_t align) {
+  auto it = m_index.find(bytes);
+  if (it != m_index.end()) {
+    Literal& literal = m_literals[it->second];
+    literal.align = std::max(literal.align, align);
+    return literal.label;
+  }
+
+  uint32_t index = (uint32_t)m_literals.size();
+  LabelRef label = code.label("lit" + std::to_string(index));
+  m_index.emplace(bytes, index);
+  m_literals.push_back({ std::move(bytes), align, label, 0, index });
+  return label;
+}
+
+void LiteralPool::layout() {
+  size_t count = m_literals.size();
+
+  // by reversed bytes, a literal comes right before the ones it ends
+  std::vector<uint32_t> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    auto const& x = m_literals[a].bytes;
+    auto const& y = m_literals[b].bytes;
+    return std::lexicographical_compare(x.rbegin(), x.rend(), y.rbegin(), y.rend());
+  });
+
+  // a base is the longest of literals ending each other
+  uint32_t base = 0;
+  for (size_t i = count; i-- > 0;) {
+    Literal& literal = m_literals[order[i]];
+    literal.base = order[i];
+
+    if (i + 1 == count) {
+      base = order[i];
+      continue;
+    }
+
+    Literal const& longer = m_literals[base];
+    size_t skip = longer.bytes.size() - std::min(longer.bytes.size(), literal.bytes.size());
+    bool ends = literal.bytes.size() <= longer.bytes.size() &&
+      longer.bytes.compare(skip, literal.bytes.size(), literal.bytes) == 0;
+
+    // the base is placed at its own alignment only
+    if (ends && literal.align <= longer.align && skip % literal.align == 0)
+      literal.base = base;
+    else
+      base = order[i];
+  }
+
+  m_size = 0;
+  for (auto& literal : m_literals) {
+    if (&literal != &m_literals[literal.base])
+      continue;
+    literal.offset = (m_size + literal.align - 1) & ~(literal.align - 1);
+    m_size = literal.offset + (uint32_t)literal.bytes.size();
+  }
+
+  for (auto& literal : m_literals) {
+    Literal const& base = m_literals[literal.base];
+    literal.offset = base.offset + (uint32_t)(base.bytes.size() - literal.bytes.size());
+  }
+}
+
+void LiteralPool::print(MachineCode const& code, FILE* out) const {
+  uint32_t position = 0;
+
+  for (auto const& literal : m_literals) {
+    if (&literal != &m_literals[literal.base])
+      continue;
+
+    if (literal.offset > position) {
+      fputs("db 0", out);
+      for (++position; position < literal.offset; ++position)
+        fputs(",0", out);
+      fputc('\n', out);
+    }
+
+    fputs(code.labels[literal.label].c_str(), out);
+    for (size_t i = 0; i < literal.bytes.size(); ++i)
+      fprintf(out, i == 0 ? " db %u" : ",%u", (unsigned)(uint8_t)literal.bytes[i]);
+    fputs(literal.bytes.empty() ? ":\n" : "\n", out);
+    position = literal.offset + (uint32_t)literal.bytes.size();
+  }
+
+  // fasm computes addresses of the rest from their bases
+  for (auto const& literal : m_literals) {
+    if (&literal == &m_literals[literal.base])
+      continue;
+
+    Literal const& base = m_literals[literal.base];
+    fprintf(
+      out, "%s = %s+%u\n",
+      code.labels[literal.label].c_str(), code.labels[base.label].c_str(), literal.offset - base.offset
+    );
+  }
+}
+
+void LiteralPool::place(ObjectCode& object, SectionId section) const {
+  auto& bytes = object.sections[section].bytes;
+  uint32_t start = (uint32_t)bytes.size();
+  bytes.resize(start + m_size, 0);
+
+  for (auto const& literal : m_literals) {
+    object.define(literal.label, section, start + literal.offset);
+    if (&literal == &m_literals[literal.base])
+      std::copy(literal.bytes.begin(), literal.bytes.end(), bytes.begin() + start + literal.offset);
+  }
+}
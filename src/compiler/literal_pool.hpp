@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "encoder.hpp"
+#include "machine.hpp"
+
+namespace lon {
+
+  // Read-only constants of the program, every distinct content stored once.
+  // A literal that ends another one points into it instead of being copied,
+  // so "World!" costs nothing next to "Hello, World!"
+  class LiteralPool {
+  public:
+    struct Literal {
+      std::string bytes;
+      uint32_t align; // power of two
+      LabelRef label;
+      uint32_t offset; // from the start of the section, set by layout
+      uint32_t base; // literal whose bytes it shares, itself if none
+    };
+
+  private:
+    std::vector<Literal> m_literals; // in order of first use
+    std::unordered_map<std::string, uint32_t> m_index; // by bytes
+    uint32_t m_size = 0;
+
+  public:
+    void clear();
+
+    // Label of bytes, aligned to at least align bytes
+    LabelRef add(MachineCode& code, std::string bytes, uint32_t align = 1);
+
+    // Places literals, bases in order of first use, padded to alignments
+    void layout();
+
+    inline std::vector<Literal> const& literals() const { return m_literals; }
+    inline uint32_t size() const { return m_size; }
+    inline bool empty() const { return m_literals.empty(); }
+
+    // fasm syntax, after layout
+    void print(MachineCode const& code, FILE* out) const;
+
+    // Bytes to section of object, labels defined in it, after layout
+    void place(ObjectCode& object, SectionId section) const;
+  };
+
+} // namespace lon
@@ -0,0 +1,147 @@
+#include "machine.hpp"
+
+using lon::Condition;
+using lon::LabelRef;
+using lon::MachineCode;
+using lon::Mnemonic;
+using lon::Operand;
+
+LabelRef MachineCode::label(std::string name) {
+  labels.push_back(std::move(name));
+  return (LabelRef)labels.size() - 1;
+}
+
+void MachineCode::emit(Mnemonic op, Operand a, Operand b) {
+  insts.push_back({ op, CC_O, { a, b } });
+}
+
+void MachineCode::emit(Mnemonic op, Condition cond, Operand a) {
+  insts.push_back({ op, cond, { a, {} } });
+}
+
+void MachineCode::error(std::string message) {
+  errors.push_back(std::move(message));
+  emit(Mnemonic::ERROR, Operand::imm((int32_t)errors.size() - 1));
+}
+
+static void printOperand(MachineCode const& code, Operand const& op, FILE* out) {
+  static const char* bytes[] = { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" };
+  static const char* words[] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" };
+
+  switch (op.kind) {
+    case Operand::NONE:
+      break;
+
+    case Operand::REGISTER:
+      if (op.size == 1)
+        fputs(bytes[op.reg], out);
+      else if (op.size == 2)
+        fputs(words[op.reg], out);
+      else
+        fputs(lon::registerName(op.reg), out);
+      break;
+
+    case Operand::IMMEDIATE:
+      if (op.label == lon::NO_LABEL)
+        fprintf(out, "%d", op.value);
+      else if (op.value == 0)
+        fputs(code.labels[op.label].c_str(), out);
+      else
+        fprintf(out, "%s%+d", code.labels[op.label].c_str(), op.value);
+      break;
+
+    case Operand::MEMORY:
+      fputs(op.size == 1 ? "byte [" : op.size == 2 ? "word [" : "dword [", out);
+
+      // variables, imported procedures are called through their table entries
+      if (op.label != lon::NO_LABEL) {
+        fprintf(out, "%s]", code.labels[op.label].c_str());
+        break;
+      }
+
+      fputs(lon::registerName(op.reg), out);
+      if (op.value != 0)
+        fprintf(out, "%+d", op.value);
+      fputc(']', out);
+      break;
+
+    case Operand::LABEL:
+      fputs(code.labels[op.label].c_str(), out);
+      break;
+  }
+}
+
+void MachineCode::print(FILE* out) const {
+  for (auto const& inst : insts) {
+    switch (inst.op) {
+      case Mnemonic::NONE:
+        continue;
+      case Mnemonic::LABEL:
+        fprintf(out, "%s:\n", labels[inst.ops[0].label].c_str());
+        continue;
+      case Mnemonic::ERROR:
+        fprintf(out, "ERROR >> %s\n", errors[inst.ops[0].value].c_str());
+        continue;
+      case Mnemonic::SETCC:
+        fprintf(out, "  set%s", conditionName(inst.cond));
+        break;
+      case Mnemonic::JCC:
+        fprintf(out, "  j%s", conditionName(inst.cond));
+        break;
+      default:
+        fprintf(out, "  %s", mnemonicName(inst.op));
+        break;
+    }
+
+    for (int i = 0; i < 2 && inst.ops[i].kind != Operand::NONE; ++i) {
+      fputs(i == 0 ? " " : ", ", out);
+      printOperand(*this, inst.ops[i], out);
+    }
+    fputc('\n', out);
+  }
+}
+
+const char* lon::registerName(uint8_t reg) {
+  static const char* names[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+  return reg < REG_COUNT ? names[reg] : "?";
+}
+
+const char* lon::mnemonicName(Mnemonic op) {
+  switch (op) {
+    case Mnemonic::NONE: return "";
+    case Mnemonic::MOV: return "mov";
+    case Mnemonic::MOVZX: return "movzx";
+    case Mnemonic::MOVSX: return "movsx";
+    case Mnemonic::ADD: return "add";
+    case Mnemonic::SUB: return "sub";
+    case Mnemonic::IMUL: return "imul";
+    case Mnemonic::XOR: return "xor";
+    case Mnemonic::CMP: return "cmp";
+    case Mnemonic::TEST: return "test";
+    case Mnemonic::NEG: return "neg";
+    case Mnemonic::INC: return "inc";
+    case Mnemonic::DEC: return "dec";
+    case Mnemonic::CDQ: return "cdq";
+    case Mnemonic::DIV: return "div";
+    case Mnemonic::IDIV: return "idiv";
+    case Mnemonic::SETCC: return "set";
+    case Mnemonic::PUSH: return "push";
+    case Mnemonic::POP: return "pop";
+    case Mnemonic::CALL: return "call";
+    case Mnemonic::JMP: return "jmp";
+    case Mnemonic::JCC: return "j";
+    case Mnemonic::RET: return "ret";
+    case Mnemonic::REP_MOVSB: return "rep movsb";
+    case Mnemonic::LABEL: return "label";
+    case Mnemonic::ERROR: return "error";
+  }
+
+  return "?";
+}
+
+const char* lon::conditionName(Condition cond) {
+  static const char* names[] = {
+    "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g"
+  };
+  return names[cond & 15];
+}
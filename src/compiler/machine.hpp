@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace lon {
+
+  // x86 general purpose registers, in encoding order
+  enum Register : uint8_t {
+    REG_EAX,
+    REG_ECX,
+    REG_EDX,
+    REG_EBX,
+    REG_ESP,
+    REG_EBP,
+    REG_ESI,
+    REG_EDI,
+
+    REG_COUNT,
+    REG_NONE = 0xFF
+  };
+
+  using LabelRef = uint32_t;
+
+  constexpr LabelRef NO_LABEL = 0xFFFFFFFF;
+
+  enum class Mnemonic : uint8_t {
+    NONE, // removed by peephole, never printed
+
+    MOV,
+    MOVZX,
+    MOVSX,
+    ADD,
+    SUB,
+    IMUL,
+    XOR,
+    CMP,
+    TEST,
+    NEG,
+    INC,
+    DEC,
+    CDQ,
+    DIV,
+    IDIV,
+    SETCC, // cond
+    PUSH,
+    POP,
+    CALL,
+    JMP,
+    JCC, // cond
+    RET, // ops[0] is bytes of arguments to pop, if any
+    REP_MOVSB, // copies ecx bytes from [esi] to [edi]
+
+    LABEL, // ops[0] label defined here
+    ERROR, // ops[0].value is index in MachineCode::errors, breaks assembling
+  };
+
+  // x86 condition codes, in encoding order
+  enum Condition : uint8_t {
+    CC_O,
+    CC_NO,
+    CC_B,
+    CC_AE,
+    CC_E,
+    CC_NE,
+    CC_BE,
+    CC_A,
+    CC_S,
+    CC_NS,
+    CC_P,
+    CC_NP,
+    CC_L,
+    CC_GE,
+    CC_LE,
+    CC_G,
+  };
+
+  // Opposite condition, the lowest bit flips it
+  inline Condition negate(Condition cond) { return (Condition)(cond ^ 1); }
+
+  struct Operand {
+    enum Kind : uint8_t {
+      NONE,
+      REGISTER, // reg
+      IMMEDIATE, // value, plus address of label if any
+      MEMORY, // [reg + value] or [label + value]
+      LABEL // jump or call target
+    };
+
+    Kind kind;
+    uint8_t size; // in bytes
+    uint8_t reg; // REG_NONE if memory has no base
+    int32_t value;
+    LabelRef label;
+
+    static Operand reg32(uint8_t reg) { return { REGISTER, 4, reg, 0, NO_LABEL }; }
+    static Operand reg16(uint8_t reg) { return { REGISTER, 2, reg, 0, NO_LABEL }; }
+    static Operand reg8(uint8_t reg) { return { REGISTER, 1, reg, 0, NO_LABEL }; }
+    static Operand imm(int32_t value) { return { IMMEDIATE, 4, REG_NONE, value, NO_LABEL }; }
+    static Operand address(LabelRef label) { return { IMMEDIATE, 4, REG_NONE, 0, label }; }
+    static Operand mem(uint8_t base, int32_t offset) { return { MEMORY, 4, base, offset, NO_LABEL }; }
+    static Operand global(LabelRef label) { return { MEMORY, 4, REG_NONE, 0, label }; }
+    static Operand target(LabelRef label) { return { LABEL, 4, REG_NONE, 0, label }; }
+
+    inline bool is(Kind other) const { return kind == other; }
+    inline bool isRegister(uint8_t other) const { return kind == REGISTER && reg == other; }
+
+    inline bool operator==(Operand const& other) const {
+      return kind == other.kind && size == other.size && reg == other.reg &&
+        value == other.value && label == other.label;
+    }
+    inline bool operator!=(Operand const& other) const { return !(*this == other); }
+  };
+
+  struct MachineInstruction {
+    Mnemonic op;
+    Condition cond; // SETCC, JCC
+    Operand ops[2]; // destination first, NONE if missing
+  };
+
+  // Instructions of the whole code section in order, labels included
+  struct MachineCode {
+    std::vector<MachineInstruction> insts;
+    std::vector<std::string> labels; // names
+    std::vector<std::string> errors;
+
+    LabelRef label(std::string name);
+
+    void emit(Mnemonic op, Operand a = {}, Operand b = {});
+    void emit(Mnemonic op, Condition cond, Operand a);
+    void error(std::string message);
+
+    // fasm syntax
+    void print(FILE* out) const;
+  };
+
+  const char* registerName(uint8_t reg);
+  const char* mnemonicName(Mnemonic op);
+  const char* conditionName(Condition cond);
+
+} // namespace lon
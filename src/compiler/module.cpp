@@ -0,0 +1,471 @@
+#include "module.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using lon::AbstractSourceTree;
+using lon::Expression;
+using lon::FunctionDefinition;
+using lon::Module;
+using lon::NodeIndex;
+using lon::NodePool;
+using lon::Statement;
+using lon::Symbol;
+using lon::SymbolTable;
+using lon::TypeRef;
+using lon::TypeTable;
+
+static constexpr uint32_t MODULE_MAGIC = 0x4D4E4F4C; // "LONM"
+
+// every section starts at a multiple of that
+static constexpr size_t SECTION_ALIGNMENT = 64;
+
+enum {
+  MS_SYMBOL_ENTRIES,
+  MS_SYMBOL_SLOTS,
+  MS_SYMBOL_STRINGS,
+  MS_TYPE_ENTRIES,
+  MS_TYPE_SLOTS,
+  MS_FUNCTIONS,
+  MS_EXPRESSIONS,
+  MS_STATEMENTS,
+  MS_LISTS,
+
+  MS_COUNT
+};
+
+// size of one item of every section
+static constexpr size_t SECTION_ITEM_SIZE[MS_COUNT] = {
+  sizeof(SymbolTable::SavedSymbol),
+  sizeof(Symbol),
+  1,
+  sizeof(TypeTable::Entry),
+  sizeof(TypeRef),
+  sizeof(FunctionDefinition),
+  sizeof(Expression),
+  sizeof(Statement),
+  sizeof(NodeIndex),
+};
+
+struct ModuleSection {
+  uint64_t offset; // from file start
+  uint64_t count; // items
+};
+
+struct ModuleHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceHash;
+
+  // sizes of stored structures, files of builds with another layout are rejected
+  uint32_t layout;
+  uint32_t sectionsCount;
+
+  ModuleSection sections[MS_COUNT];
+};
+
+static constexpr uint32_t MODULE_LAYOUT =
+  (uint32_t)sizeof(Expression) |
+  (uint32_t)sizeof(Statement) << 8 |
+  (uint32_t)sizeof(FunctionDefinition) << 16 |
+  (uint32_t)sizeof(TypeTable::Entry) << 24;
+
+static size_t roundUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+[[noreturn]] static void fail(const char* what, std::string_view path) {
+  throw std::runtime_error(std::string(what) + " '" + std::string(path) + "'");
+}
+
+// Sections are written one after another, each aligned
+class ModuleWriter {
+private:
+  FILE* m_file;
+  std::string_view m_path;
+  size_t m_offset;
+
+public:
+  ModuleHeader header;
+
+  ModuleWriter(FILE* file, std::string_view path)
+    : m_file(file), m_path(path), m_offset(0), header() {}
+
+  void begin(int section, size_t count) {
+    static const char zeros[SECTION_ALIGNMENT] = {};
+
+    size_t start = roundUp(m_offset, SECTION_ALIGNMENT);
+    write(zeros, start - m_offset);
+
+    header.sections[section] = { start, count };
+  }
+
+  void write(const void* data, size_t size) {
+    if (size != 0 && fwrite(data, 1, size, m_file) != size)
+      fail("Failed to write module", m_path);
+    m_offset += size;
+  }
+
+  template <typename T>
+  void section(int id, T const* items, size_t count) {
+    begin(id, count);
+    write(items, count * sizeof(T));
+  }
+
+  template <typename T>
+  void pool(int id, NodePool<T> const& pool) {
+    begin(id, pool.size());
+
+    for (size_t i = 0; (i << NodePool<T>::CHUNK_BITS) < pool.size(); ++i) {
+      size_t count = std::min<size_t>(NodePool<T>::CHUNK_SIZE, pool.size() - (i << NodePool<T>::CHUNK_BITS));
+      write(pool.chunk(i), count * sizeof(T));
+    }
+  }
+};
+
+Module::Module()
+  : m_data(nullptr), m_size(0), m_mapped(false) {}
+
+Module::Module(Module&& other) noexcept
+  : m_data(other.m_data),
+    m_size(other.m_size),
+    m_mapped(other.m_mapped),
+    m_heap(std::move(other.m_heap))
+{
+  other.m_data = nullptr;
+  other.m_size = 0;
+  other.m_mapped = false;
+}
+
+Module& Module::operator=(Module&& other) noexcept {
+  if (this == &other)
+    return *this;
+
+  release();
+
+  m_data = other.m_data;
+  m_size = other.m_size;
+  m_mapped = other.m_mapped;
+  m_heap = std::move(other.m_heap);
+
+  other.m_data = nullptr;
+  other.m_size = 0;
+  other.m_mapped = false;
+  return *this;
+}
+
+Module::~Module() {
+  release();
+}
+
+uint64_t Module::hashSource(std::string_view source) {
+  // 8 bytes at a time, length goes first so a zero tail still changes it
+  uint64_t hash = 0x9E3779B97F4A7C15ull ^ source.size();
+
+  auto mix = [&hash](uint64_t word) {
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 32;
+  };
+
+  size_t i = 0;
+  for (; i + 8 <= source.size(); i += 8) {
+    uint64_t word;
+    memcpy(&word, source.data() + i, 8);
+    mix(word);
+  }
+
+  uint64_t tail = 0;
+  memcpy(&tail, source.data() + i, source.size() - i);
+  mix(tail);
+
+  return hash;
+}
+
+void Module::save(std::string_view path, AbstractSourceTree const& ast, uint64_t sourceHash) {
+  // written next to the target and renamed, so a broken file is never left behind
+  std::string target(path);
+  std::string temp = target + ".tmp";
+
+  FILE* file = fopen(temp.c_str(), "wb");
+  if (!file)
+    fail("Failed to create module", path);
+
+  ModuleWriter writer(file, path);
+
+  try {
+    // header goes last, when offsets are known
+    writer.write(&writer.header, sizeof(ModuleHeader));
+
+    std::vector<SymbolTable::SavedSymbol> symbols;
+    std::vector<Symbol> symbolSlots;
+    std::vector<char> strings;
+    ast.symbols->save(symbols, symbolSlots, strings);
+
+    writer.section(MS_SYMBOL_ENTRIES, symbols.data(), symbols.size());
+    writer.section(MS_SYMBOL_SLOTS, symbolSlots.data(), symbolSlots.size());
+    writer.section(MS_SYMBOL_STRINGS, strings.data(), strings.size());
+
+    std::vector<TypeTable::Entry> types;
+    std::vector<TypeRef> typeSlots;
+    ast.types->save(types, typeSlots);
+
+    writer.section(MS_TYPE_ENTRIES, types.data(), types.size());
+    writer.section(MS_TYPE_SLOTS, typeSlots.data(), typeSlots.size());
+
+    writer.section(MS_FUNCTIONS, ast.functions.data(), ast.functions.size());
+    writer.pool(MS_EXPRESSIONS, ast.expressions);
+    writer.pool(MS_STATEMENTS, ast.statements);
+    writer.pool(MS_LISTS, ast.lists);
+
+    writer.header.magic = MODULE_MAGIC;
+    writer.header.version = VERSION;
+    writer.header.sourceHash = sourceHash;
+    writer.header.layout = MODULE_LAYOUT;
+    writer.header.sectionsCount = MS_COUNT;
+
+    if (fseek(file, 0, SEEK_SET) != 0)
+      fail("Failed to write module", path);
+    writer.write(&writer.header, sizeof(ModuleHeader));
+  }
+  catch (...) {
+    fclose(file);
+    remove(temp.c_str());
+    throw;
+  }
+
+  if (fclose(file) != 0) {
+    remove(temp.c_str());
+    fail("Failed to write module", path);
+  }
+
+  // rename doesn't replace files on Windows
+  remove(target.c_str());
+  if (rename(temp.c_str(), target.c_str()) != 0) {
+    remove(temp.c_str());
+    fail("Failed to write module", path);
+  }
+}
+
+static bool isPowerOfTwo(uint64_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+// Checks everything restore() relies on, except node indices
+static bool isValid(const void* data, size_t size, uint64_t sourceHash) {
+  if (size < sizeof(ModuleHeader))
+    return false;
+
+  auto header = (ModuleHeader const*)data;
+
+  if (
+    header->magic != MODULE_MAGIC ||
+    header->version != Module::VERSION ||
+    header->layout != MODULE_LAYOUT ||
+    header->sectionsCount != MS_COUNT ||
+    header->sourceHash != sourceHash
+  ) {
+    return false;
+  }
+
+  for (int i = 0; i < MS_COUNT; ++i) {
+    ModuleSection const& section = header->sections[i];
+
+    if (section.offset % SECTION_ALIGNMENT != 0 || section.offset > size)
+      return false;
+    if (section.count > (size - section.offset) / SECTION_ITEM_SIZE[i])
+      return false;
+    if (section.count > 0xFFFFFFFFull)
+      return false;
+  }
+
+  auto const& sections = header->sections;
+  auto strings = (const char*)data + sections[MS_SYMBOL_STRINGS].offset;
+
+  return
+    sections[MS_SYMBOL_ENTRIES].count >= lon::SYM_PREDEFINED_END &&
+    sections[MS_TYPE_ENTRIES].count >= lon::TYPE_PREDEFINED_END &&
+    isPowerOfTwo(sections[MS_SYMBOL_SLOTS].count) &&
+    isPowerOfTwo(sections[MS_TYPE_SLOTS].count) &&
+    sections[MS_SYMBOL_SLOTS].count > sections[MS_SYMBOL_ENTRIES].count &&
+    sections[MS_TYPE_SLOTS].count > sections[MS_TYPE_ENTRIES].count &&
+    sections[MS_SYMBOL_STRINGS].count != 0 &&
+    strings[sections[MS_SYMBOL_STRINGS].count - 1] == 0;
+}
+
+void Module::restore(AbstractSourceTree& ast) {
+  auto header = (ModuleHeader const*)m_data;
+
+  auto section = [&](int id) {
+    return (char*)m_data + header->sections[id].offset;
+  };
+
+  auto count = [&](int id) {
+    return (size_t)header->sections[id].count;
+  };
+
+  auto symbols = (SymbolTable::SavedSymbol const*)section(MS_SYMBOL_ENTRIES);
+  ast.symbols->restore(
+    symbols, count(MS_SYMBOL_ENTRIES),
+    (Symbol const*)section(MS_SYMBOL_SLOTS), count(MS_SYMBOL_SLOTS),
+    section(MS_SYMBOL_STRINGS)
+  );
+
+  ast.types->restore(
+    (TypeTable::Entry const*)section(MS_TYPE_ENTRIES), count(MS_TYPE_ENTRIES),
+    (TypeRef const*)section(MS_TYPE_SLOTS), count(MS_TYPE_SLOTS)
+  );
+
+  auto functions = (FunctionDefinition const*)section(MS_FUNCTIONS);
+  ast.functions.assign(functions, functions + count(MS_FUNCTIONS));
+
+  ast.expressions.view((Expression*)section(MS_EXPRESSIONS), (NodeIndex)count(MS_EXPRESSIONS));
+  ast.statements.view((Statement*)section(MS_STATEMENTS), (NodeIndex)count(MS_STATEMENTS));
+  ast.lists.view((NodeIndex*)section(MS_LISTS), (NodeIndex)count(MS_LISTS));
+}
+
+#ifdef _WIN32
+
+void Module::release() {
+  if (m_mapped)
+    UnmapViewOfFile(m_data);
+
+  m_heap.reset();
+  m_data = nullptr;
+  m_size = 0;
+  m_mapped = false;
+}
+
+Module Module::load(std::string_view path, uint64_t sourceHash) {
+  Module module;
+
+  std::string pathStr(path);
+  HANDLE file = CreateFileA(
+    pathStr.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+  );
+
+  if (file == INVALID_HANDLE_VALUE)
+    return module;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(ModuleHeader)) {
+    CloseHandle(file);
+    return module;
+  }
+
+  size_t size = (size_t)fileSize.QuadPart;
+
+  // copy-on-write, so nodes can be changed after loading
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  if (mapping != nullptr) {
+    void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+
+    if (view != nullptr) {
+      module.m_data = view;
+      module.m_size = size;
+      module.m_mapped = true;
+    }
+  }
+
+  if (!module.m_mapped) {
+    module.m_heap.reset(new uint64_t[size / 8 + 1]);
+    char* pt = (char*)module.m_heap.get();
+
+    for (size_t done = 0; done < size; ) {
+      DWORD chunk = size - done > 0x40000000 ? 0x40000000 : (DWORD)(size - done);
+      DWORD count = 0;
+      if (!ReadFile(file, pt + done, chunk, &count, nullptr) || count == 0) {
+        CloseHandle(file);
+        return Module();
+      }
+      done += count;
+    }
+
+    module.m_data = pt;
+    module.m_size = size;
+  }
+
+  CloseHandle(file);
+
+  if (!isValid(module.m_data, module.m_size, sourceHash))
+    return Module();
+
+  return module;
+}
+
+#else
+
+void Module::release() {
+  if (m_mapped)
+    munmap(m_data, m_size);
+
+  m_heap.reset();
+  m_data = nullptr;
+  m_size = 0;
+  m_mapped = false;
+}
+
+Module Module::load(std::string_view path, uint64_t sourceHash) {
+  Module module;
+
+  std::string pathStr(path);
+  int fd = open(pathStr.c_str(), O_RDONLY);
+  if (fd < 0)
+    return module;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(ModuleHeader)) {
+    close(fd);
+    return module;
+  }
+
+  size_t size = (size_t)st.st_size;
+
+  // copy-on-write, so nodes can be changed after loading
+  void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (view != MAP_FAILED) {
+    module.m_data = view;
+    module.m_size = size;
+    module.m_mapped = true;
+  }
+  else {
+    module.m_heap.reset(new uint64_t[size / 8 + 1]);
+    char* pt = (char*)module.m_heap.get();
+
+    for (size_t done = 0; done < size; ) {
+      ssize_t count = ::read(fd, pt + done, size - done);
+      if (count <= 0) {
+        close(fd);
+        return Module();
+      }
+      done += (size_t)count;
+    }
+
+    module.m_data = pt;
+    module.m_size = size;
+  }
+
+  close(fd);
+
+  if (!isValid(module.m_data, module.m_size, sourceHash))
+    return Module();
+
+  return module;
+}
+
+#endif
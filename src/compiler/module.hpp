@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string_view>
+#include "ast/ast.hpp"
+
+namespace lon {
+
+  // Precompiled module: AST of one source file with its symbol and type tables.
+  // Sections are flat arrays of the in-memory structures, references in them
+  // are indices or offsets relative to their section, so a loaded file is used
+  // as is: node pools point into the mapping, tables copy their arrays without
+  // rehashing. Files are only valid for the same compiler version and build
+  class Module {
+  private:
+    // whole file, a copy-on-write mapping or a heap copy
+    void* m_data;
+    size_t m_size;
+    bool m_mapped;
+    std::unique_ptr<uint64_t[]> m_heap;
+
+  public:
+    static constexpr uint32_t VERSION = 2;
+
+    Module();
+    Module(Module&& other) noexcept;
+    Module& operator=(Module&& other) noexcept;
+    ~Module();
+
+    Module(Module const&) = delete;
+    Module& operator=(Module const&) = delete;
+
+    // Key of modules, source is the same if hashes are
+    static uint64_t hashSource(std::string_view source);
+
+    // Writes ast with its tables, throws if file can't be written
+    static void save(std::string_view path, AbstractSourceTree const& ast, uint64_t sourceHash);
+
+    // Empty module if file is missing, broken, made by another version
+    // or for another source
+    static Module load(std::string_view path, uint64_t sourceHash);
+
+  public:
+    inline bool empty() const { return m_data == nullptr; }
+
+    // Fills ast and replaces everything in its symbol and type tables.
+    // Nodes and names stay in the module, so it must outlive all of them
+    void restore(AbstractSourceTree& ast);
+
+  private:
+    void release();
+  };
+
+} // namespace lon
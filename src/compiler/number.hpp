@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace lon {
+
+  // Nearest double to mantissa * 10^exponent, rounding ties to even.
+  // Exact for any mantissa (Eisel-Lemire), but if mantissa is a truncated
+  // decimal, results for mantissa and mantissa + 1 must agree
+  double decimalToDouble(uint64_t mantissa, int64_t exponent);
+
+} // namespace lon
@@ -1,43 +1,110 @@
 #include "parser.hpp"
 
+#include <algorithm>
+#include <array>
+
+using lon::BinaryOperator;
 using lon::Expression;
 using lon::Statement;
 using lon::Parser;
-using lon::TypeID;
-using lon::Type;
+using lon::Symbol;
+using lon::TypeFlags;
+using lon::TypeRef;
+using lon::TypeTable;
+using lon::NodeIndex;
+using lon::NodeRange;
+using lon::Token;
+using lon::UnaryOperator;
+
+struct BinaryOperatorInfo {
+  BinaryOperator op;
+  uint8_t precedence; // 0 if token isn't a binary operator
+};
+
+// prefix operators bind tighter than any binary one
+static constexpr uint8_t PREC_UNARY = 7;
+
+// indexed by TokenID
+static constexpr auto BINARY_OPERATORS = [] {
+  std::array<BinaryOperatorInfo, lon::TK_COUNT> table = {};
+
+  table[lon::TK_OR] = { BinaryOperator::OR, 1 };
+  table[lon::TK_AND] = { BinaryOperator::AND, 2 };
+  table[lon::TK_EQ] = { BinaryOperator::EQ, 3 };
+  table[lon::TK_NOT_EQ] = { BinaryOperator::NOT_EQ, 3 };
+  table['<'] = { BinaryOperator::LESS, 4 };
+  table[lon::TK_LESS_EQ] = { BinaryOperator::LESS_EQ, 4 };
+  table['>'] = { BinaryOperator::GREATER, 4 };
+  table[lon::TK_GREATER_EQ] = { BinaryOperator::GREATER_EQ, 4 };
+  table['+'] = { BinaryOperator::ADD, 5 };
+  table['-'] = { BinaryOperator::SUB, 5 };
+  table['*'] = { BinaryOperator::MUL, 6 };
+  table['/'] = { BinaryOperator::DIV, 6 };
+  table['%'] = { BinaryOperator::MOD, 6 };
+
+  return table;
+}();
+
+static inline BinaryOperatorInfo binaryOperator(Token const* tk) {
+  if (tk == nullptr || tk->id < 0 || tk->id >= lon::TK_COUNT)
+    return {};
+  return BINARY_OPERATORS[tk->id];
+}
+
 
-Parser::Parser(LexerResult const& lexerResult)
-  : m_inputFileName(lexerResult.inputFileName),
-    m_textTokens(lexerResult.tokens)
+Parser::Parser(LexerResult&& lexerResult, TypeTable& types)
+  : m_lexerResult(std::move(lexerResult)),
+    m_lexer(nullptr),
+    m_stream(m_lexerResult.tokens.data(), m_lexerResult.tokens.data() + m_lexerResult.tokens.size()),
+    m_tk(nullptr)
 {
-  m_tk = m_textTokens.begin();
+  m_ast.fileName = m_lexerResult.inputFileName;
+  m_ast.symbols = m_lexerResult.symbols;
+  m_ast.types = &types;
 }
 
-Parser::~Parser() = default;
+Parser::Parser(Lexer& lexer, TypeTable& types)
+  : m_lexerResult(),
+    m_lexer(&lexer),
+    m_stream(lexer),
+    m_tk(nullptr)
+{
+  m_ast.fileName = lexer.inputFileName();
+  m_ast.symbols = &lexer.symbols();
+  m_ast.types = &types;
+}
 
-static Type makeVoid() {
-  Type type;
-  type.id = lon::TID_VOID;
-  return std::move(type);
+Parser::Parser(std::string_view fileName, SymbolTable& symbols, TypeTable& types, Token const* begin, Token const* end)
+  : m_lexerResult(),
+    m_lexer(nullptr),
+    m_stream(begin, end),
+    m_tk(nullptr)
+{
+  m_ast.fileName = fileName;
+  m_ast.symbols = &symbols;
+  m_ast.types = &types;
 }
 
-Type Parser::parseTypeName() {
+Parser::~Parser() = default;
+
+TypeRef Parser::parseTypeName() {
   if (end())
-    throw ParserError("Unexpected EOF. Expected type name", -1, -1);
+    throw ParserError("Unexpected EOF. Expected type name");
 
-  auto startTk = m_tk;
+  // copy, in streaming mode the slot may be reused
+  Token startTk = *m_tk;
   TokenID id = m_tk->id;
   next();
 
   int sign = 0;
 
   if (id == TK_CONST) {
-    auto child = parseTypeName();
-    if (child.flags & TPF_CONST)
-      throw ParserError("Multiple const modifiers", startTk);
+    TypeRef child = parseTypeName();
+    TypeFlags flags = m_ast.types->get(child).flags;
+    if (flags & TPF_CONST)
+      throw ParserError("Multiple const modifiers", &startTk);
 
-    child.flags |= TPF_CONST;
-    return child;
+    return m_ast.types->withFlags(child, flags | TPF_CONST);
   }
 
   if (id == TK_UNSIGNED)
@@ -47,7 +114,7 @@ Type Parser::parseTypeName() {
 
   if (sign != 0) {
     if (end())
-      throw ParserError("Unexpected EOF. Expected numeric type name", -1, -1);
+      throw ParserError("Unexpected EOF. Expected numeric type name");
 
     id = m_tk->id;
 
@@ -60,7 +127,7 @@ Type Parser::parseTypeName() {
   int width = 0;
   switch (id) {
     case TK_VOID:
-      return makeVoid();
+      return TYPE_VOID;
 
     case TK_BYTE:
       if (sign == 0) sign = 1;
@@ -78,108 +145,230 @@ Type Parser::parseTypeName() {
       if (sign == 0) sign = -1;
       width = 3;
 
-    NUMBER_TYPE: {
-      Type type;
-      type.id = TID_NUMBER;
-      auto& number = type.data.emplace<Type::Number>();
-      number.width = width;
-      number.isSigned = sign == -1;
-      return type;
-    }
+    NUMBER_TYPE:
+      return TypeTable::number(width, sign == -1);
   }
 
   // TODO pointers
 
-  throw ParserError("Invalid type name", startTk);
+  throw ParserError("Invalid type name", &startTk);
 }
 
-Expression Parser::parseExpression() {
-  if (end())
-    throw ParserError("Unexpected EOF. Expected expression", -1, -1);
+NodeIndex Parser::parseExpression() {
+  // Pratt parser with explicit stacks: prefix operators, open parentheses and
+  // calls wait in m_operators, finished subexpressions in m_operands
+  size_t operatorsBase = m_operators.size();
+
+  while (true) {
+    // prefix operators and parentheses, then an operand
+    bool operand = false;
+    while (!operand) {
+      if (end()) {
+        if (m_operators.size() > operatorsBase && m_operators.back().kind == PendingOperator::CALL)
+          throw ParserError("Unexpected EOF in functions arguments list");
+        throw ParserError("Unexpected EOF. Expected expression");
+      }
 
-  Literal literal;
-  Expression expr;
+      switch (m_tk->id) {
+        case '+':
+          next();
+          break;
+        case '-':
+          m_operators.push_back({ PendingOperator::UNARY, (uint8_t)UnaryOperator::NEG, PREC_UNARY });
+          next();
+          break;
+        case '!':
+          m_operators.push_back({ PendingOperator::UNARY, (uint8_t)UnaryOperator::NOT, PREC_UNARY });
+          next();
+          break;
+        case '(':
+          m_operators.push_back({ PendingOperator::PAREN });
+          next();
+          break;
 
-  switch (m_tk->id) {
-    default:
-      throw ParserError("Unexpected token. Expected valid expression", m_tk);
+        case TK_ID: {
+          // FIXME only call for now
 
-    case TK_NUMBER_INT:
-      literal.data.emplace<uint64_t>(m_tk->intValue);
-      goto LITERAL;
-    case TK_STRING:
-      literal.data.emplace<std::string>(m_tk->strValue);
-      // fallthrough
-    LITERAL:
-      expr.data.emplace<Literal>(std::move(literal));
-      next();
-      return expr;
+          PendingOperator call = { PendingOperator::CALL, 0, 0, m_tk->symbol, (uint32_t)m_listStack.size() };
+          next();
 
-    case TK_ID: {
-      // FIXME only call for now
+          assertToken('(');
+          next();
 
-      std::string const& name = m_tk->strValue;
-      next();
+          if (!end() && m_tk->id == ')') {
+            next();
+            finishCall(call);
+            operand = true;
+          }
+          else {
+            m_operators.push_back(call);
+          }
+        } break;
+
+        default:
+          m_operands.push_back(parseLiteral());
+          operand = true;
+          break;
+      }
+    }
 
-      assertToken('(');
-      next();
+    // binary operators, closing parentheses and arguments separators
+    while (true) {
+      BinaryOperatorInfo info = binaryOperator(m_tk);
+      if (info.precedence != 0) {
+        reduce(operatorsBase, info.precedence);
+        m_operators.push_back({ PendingOperator::BINARY, (uint8_t)info.op, info.precedence });
+        next();
+        break;
+      }
 
-      auto& call = expr.data.emplace<Expression::Call>();
-      call.funcName = name;
+      reduce(operatorsBase, 0);
 
-      auto& args = call.args;
+      if (m_operators.size() == operatorsBase) {
+        NodeIndex result = m_operands.back();
+        m_operands.pop_back();
+        return result;
+      }
 
-      bool hadComma = true;
-      while (true) {
-        if (end())
-          throw ParserError("Unexpected EOF in functions arguments list", -1, -1);
+      PendingOperator top = m_operators.back();
 
-        if (m_tk->id == ')')
-          break;
+      if (top.kind == PendingOperator::PAREN) {
+        assertToken(')');
+        next();
+        m_operators.pop_back();
+        continue;
+      }
 
-        if (!hadComma)
-          throw ParserError("Unexpected token. Expected closing parenthesis", -1, -1);
+      if (end())
+        throw ParserError("Unexpected EOF in functions arguments list");
 
-        hadComma = false;
+      if (m_tk->id != ',' && m_tk->id != ')')
+        throw ParserError("Unexpected token. Expected closing parenthesis", m_tk);
 
-        auto arg = parseExpression();
-        args.emplace_back(std::move(arg));
+      m_listStack.push_back(m_operands.back());
+      m_operands.pop_back();
 
-        if (!end() && m_tk->id == ',') {
-          hadComma = true;
-          next();
-        }
+      if (m_tk->id == ',') {
+        next();
+
+        // trailing comma is fine
+        if (end() || m_tk->id != ')')
+          break;
       }
 
       next();
-      return expr;
+      m_operators.pop_back();
+      finishCall(top);
     }
   }
 }
 
-std::list<Statement> Parser::parseBlock() {
-  std::list<Statement> block;
+NodeIndex Parser::parseLiteral() {
+  Expression expr = {};
+  expr.type = ExpressionType::LITERAL;
+
+  switch (m_tk->id) {
+    default:
+      throw ParserError("Unexpected token. Expected valid expression", m_tk);
+
+    case TK_NUMBER_INT:
+      expr.literal.type = LiteralType::INT;
+      expr.literal.intValue = m_tk->intValue;
+      break;
+    case TK_NUMBER_FLOAT:
+      expr.literal.type = LiteralType::FLOAT;
+      expr.literal.fltValue = m_tk->fltValue;
+      break;
+    case TK_STRING:
+      expr.literal.type = LiteralType::STRING;
+      expr.literal.string = m_tk->symbol;
+      break;
+  }
+
+  next();
+  return m_ast.expressions.add(expr);
+}
+
+void Parser::reduce(size_t base, int precedence) {
+  while (m_operators.size() > base) {
+    PendingOperator top = m_operators.back();
+
+    // all operators are left-associative
+    if (top.kind != PendingOperator::BINARY && top.kind != PendingOperator::UNARY)
+      break;
+    if (top.precedence < precedence)
+      break;
+
+    m_operators.pop_back();
+
+    Expression expr = {};
+    NodeIndex operand = m_operands.back();
+
+    if (top.kind == PendingOperator::UNARY) {
+      Expression& node = m_ast.expressions[operand];
+
+      // literals have no sign, it's folded into them here
+      if (
+        top.op == (uint8_t)UnaryOperator::NEG &&
+        node.type == ExpressionType::LITERAL &&
+        node.literal.type != LiteralType::STRING
+      ) {
+        if (node.literal.type == LiteralType::INT)
+          node.literal.intValue = 0 - node.literal.intValue;
+        else
+          node.literal.fltValue = -node.literal.fltValue;
+        continue;
+      }
+
+      expr.type = ExpressionType::UNARY;
+      expr.unary.op = (UnaryOperator)top.op;
+      expr.unary.operand = operand;
+    }
+    else {
+      m_operands.pop_back();
+
+      expr.type = ExpressionType::BINARY;
+      expr.binary.op = (BinaryOperator)top.op;
+      expr.binary.lhs = m_operands.back();
+      expr.binary.rhs = operand;
+    }
+
+    m_operands.back() = m_ast.expressions.add(expr);
+  }
+}
+
+void Parser::finishCall(PendingOperator const& call) {
+  Expression expr = {};
+  expr.type = ExpressionType::CALL;
+  expr.call.funcName = call.funcName;
+  expr.call.args = popList(call.args);
+  m_operands.push_back(m_ast.expressions.add(expr));
+}
+
+NodeRange Parser::parseBlock() {
+  size_t block = m_listStack.size();
 
   while (!end() && m_tk->id != '}') {
-    Statement st;
+    Statement st = {};
 
     switch (m_tk->id) {
       default:
         throw ParserError("Unexpected token. Expected valid statement", m_tk);
 
-      case TK_RETURN: {
+      case TK_RETURN:
         next();
-        auto expr = parseExpression();
-        st.data.emplace<Statement::Return>(Statement::Return { std::move(expr) });
-        block.emplace_back(std::move(st));
-      } break;
+        st.type = StatementType::RETURN;
+        st.expression = parseExpression();
+        break;
 
       case TK_ID:
-        st.data.emplace<Expression>(parseExpression());
-        block.emplace_back(std::move(st));
+        st.type = StatementType::EXPR;
+        st.expression = parseExpression();
         break;
     }
 
+    m_listStack.push_back(m_ast.statements.add(st));
+
     assertToken(';');
     next();
   }
@@ -187,81 +376,198 @@ std::list<Statement> Parser::parseBlock() {
   assertToken('}');
   next();
 
-  return block;
+  return popList(block);
 }
 
-void Parser::parse() {
-  while (!end()) {
-    switch (m_tk->id) {
-      default:
-        throw ParserError("Unexpected token", m_tk);
+NodeRange Parser::popList(size_t start) {
+  NodeRange range = m_ast.addList(m_listStack.data() + start, (uint32_t)(m_listStack.size() - start));
+  m_listStack.resize(start);
+  return range;
+}
 
-      case TK_FUNCTION: {
-        next();
-        assertToken(TK_ID);
+void Parser::parse(ThreadPool* pool) {
+  if (
+    pool && pool->size() > 1 && !m_stream.isStreaming() &&
+    (size_t)(m_stream.restEnd() - m_stream.rest()) >= PARALLEL_MIN_TOKENS
+  ) {
+    parseParallel(*pool);
+    return;
+  }
 
-        FunctionDefinition func;
-        func.funcName = m_tk->strValue;
+  while (parseDefinition()) {}
+}
 
-        next();
-        assertToken('(');
+// Definitions start at `function` outside of braces and never look past
+// their closing brace, so chunks cut there parse the same as the whole file.
+// Broken code may be cut in the middle of a definition, then everything from
+// the first failed chunk is parsed again sequentially to get the same error
+void Parser::parseParallel(ThreadPool& pool) {
+  struct Chunk {
+    Token const* begin;
+    Token const* end;
+    AbstractSourceTree ast;
+    std::exception_ptr error;
+  };
+
+  Token const* begin = m_stream.rest();
+  Token const* end = m_stream.restEnd();
+
+  size_t slicesCount = pool.size() * 4;
+  size_t sliceSize = (end - begin) / slicesCount + 1;
+
+  auto slice = [&](size_t i) {
+    return begin + std::min(i * sliceSize, (size_t)(end - begin));
+  };
+
+  // brace matching pre-pass, depth at slice starts is the sum of earlier deltas
+  std::vector<int> depths(slicesCount + 1, 0);
+
+  pool.parallelFor(slicesCount, [&](size_t i) {
+    int delta = 0;
+    for (Token const* tk = slice(i); tk < slice(i + 1); ++tk)
+      delta += (tk->id == '{') - (tk->id == '}');
+    depths[i + 1] = delta;
+  });
+
+  for (size_t i = 1; i <= slicesCount; ++i)
+    depths[i] += depths[i - 1];
+
+  // every slice but the first is cut at its first definition, if it has one
+  std::vector<Token const*> cuts(slicesCount, nullptr);
+  cuts[0] = begin;
+
+  pool.parallelFor(slicesCount - 1, [&](size_t i) {
+    int depth = depths[i + 1];
+
+    for (Token const* tk = slice(i + 1); tk < slice(i + 2); ++tk) {
+      if (tk->id == TK_FUNCTION && depth == 0) {
+        cuts[i + 1] = tk;
+        return;
+      }
+      depth += (tk->id == '{') - (tk->id == '}');
+    }
+  });
 
-        // TODO args
+  std::vector<Chunk> chunks;
+  chunks.reserve(slicesCount);
 
-        next();
-        assertToken(')');
+  for (Token const* cut : cuts) {
+    if (!cut)
+      continue;
 
-        next();
-        if (end())
-          throw ParserError("Unexpected EOF. Expected return arrow or function body", -1, -1);
+    if (!chunks.empty())
+      chunks.back().end = cut;
+    chunks.push_back({ cut, end });
+  }
 
-        if (m_tk->id == TK_RET_ARROW) {
-          next();
-          func.returnType = parseTypeName();
+  pool.parallelFor(chunks.size(), [&](size_t i) {
+    auto& chunk = chunks[i];
+    Parser parser(m_ast.fileName, *m_ast.symbols, *m_ast.types, chunk.begin, chunk.end);
 
-          if (end())
-            throw ParserError("Unexpected EOF. Expected function body", -1, -1);
-        } else {
-          func.returnType = makeVoid();
-        }
+    try {
+      parser.parse();
+      chunk.ast = parser.takeAST();
+    }
+    catch (ParserError&) {
+      chunk.error = std::current_exception();
+    }
+  });
 
-        assertToken('{');
+  // merge in source order
+  std::vector<AbstractSourceTree> trees;
+  Token const* failed = nullptr;
+
+  for (auto& chunk : chunks) {
+    if (chunk.error) {
+      failed = chunk.begin;
+      break;
+    }
+
+    trees.push_back(std::move(chunk.ast));
+  }
+
+  m_ast.mergeAll(std::move(trees), pool);
+
+  if (failed) {
+    Parser parser(m_ast.fileName, *m_ast.symbols, *m_ast.types, failed, end);
+    parser.parse();
+    m_ast.merge(parser.takeAST(), m_ast.functions.size());
+  }
+
+  m_stream.skipTo(end);
+  m_tk = nullptr;
+}
+
+bool Parser::parseDefinition() {
+  // first token is pulled here, so in streaming mode lexer errors come from parse()
+  m_tk = m_stream.peek();
+
+  if (end())
+    return false;
+
+  switch (m_tk->id) {
+    default:
+      throw ParserError("Unexpected token", m_tk);
+
+    case TK_FUNCTION: {
+      next();
+      assertToken(TK_ID);
+
+      FunctionDefinition func = {};
+      func.funcName = m_tk->symbol;
+
+      next();
+      assertToken('(');
+
+      // TODO args
+
+      next();
+      assertToken(')');
+
+      next();
+      if (end())
+        throw ParserError("Unexpected EOF. Expected return arrow or function body");
+
+      if (m_tk->id == TK_RET_ARROW) {
         next();
+        func.returnType = parseTypeName();
 
-        func.body = parseBlock();
+        if (end())
+          throw ParserError("Unexpected EOF. Expected function body");
+      } else {
+        func.returnType = TYPE_VOID;
+      }
 
-        m_ast.functions.emplace_back(std::move(func));
-      } break;
-    }
+      assertToken('{');
+      next();
+
+      func.body = parseBlock();
+
+      m_ast.functions.push_back(func);
+    } break;
   }
+
+  return true;
 }
 
 void Parser::debugPrint() {
-  printf("Parser result:\n");
-
-  printf("  Functions:\n");
-  for (auto const& func : m_ast.functions) {
-    printf("    Function %s -> ", func.funcName.c_str());
-    printType(&func.returnType);
-    printf("\n      Body:\n");
-    printBlock(func.body, 8);
-    printf("\n");
-  }
+  m_ast.debugPrint();
 }
 
 void Parser::next() {
   if (end()) return;
-  ++m_tk;
+  m_stream.advance();
+  m_tk = m_stream.peek();
 }
 
 bool Parser::end() {
-  return m_tk == m_textTokens.end();
+  return m_tk == nullptr;
 }
 
 void Parser::assertToken(TokenID id) {
   if (end()) {
     std::string info = "Unexpected EOF. Expected " + TokenIDToString(id);
-    throw ParserError(info.c_str(), -1, -1);
+    throw ParserError(info.c_str());
   }
 
   if (m_tk->id != id) {
@@ -269,85 +575,3 @@ void Parser::assertToken(TokenID id) {
     throw ParserError(info.c_str(), m_tk);
   }
 }
-
-void Parser::printType(Type const* tp) {
-  if (tp->flags & TPF_CONST)
-    printf("const ");
-
-  switch (tp->id) {
-    case TID_VOID:
-      printf("void"); return;
-    case TID_NUMBER: {
-      auto& ntp = std::get<Type::Number>(tp->data);
-      printf("number<");
-      if (ntp.isSigned)
-        printf("signed, ");
-      else
-        printf("unsigned, ");
-      printf("%d bits>", (1 << ntp.width) << 3);
-    } return;
-  }
-}
-
-void Parser::printLiteral(Literal const* lit) {
-  switch (lit->getType()) {
-    case LiteralType::INT:
-      printf("int<%lld>", std::get<uint64_t>(lit->data));
-      break;
-    case LiteralType::STRING:
-      printf("string<%s>", std::get<std::string>(lit->data).c_str());
-      break;
-    case LiteralType::FLOAT:
-      printf("float<%f>", std::get<double>(lit->data));
-      break;
-  }
-}
-
-void Parser::printExpr(Expression const* expr, int indent) {
-  switch (expr->getType()) {
-    case ExpressionType::CALL: {
-      auto& call = std::get<Expression::Call>(expr->data);
-      printf("call %s (", call.funcName.c_str());
-
-      bool first = true;
-      for (auto const& arg : call.args) {
-        printExpr(&arg, indent);
-
-        if (!first)
-          printf(", ");
-        first = false;
-      }
-      printf(")");
-    } break;
-    case ExpressionType::LITERAL: {
-      auto& lit = std::get<Literal>(expr->data);
-      printf("literal ");
-      printLiteral(&lit);
-    } break;
-  }
-}
-
-void Parser::printBlock(std::list<Statement> const& statements, int indent) {
-  printf("%*c{\n", indent, ' ');
-  indent += 2;
-  for (auto const& st : statements) {
-    switch (st.getType()) {
-      case StatementType::EXPR: {
-        auto& expr = std::get<Expression>(st.data);
-        printf("%*c", indent, ' ');
-        printExpr(&expr, indent + 2);
-        printf(";\n");
-      } break;
-      case StatementType::RETURN: {
-        auto& ret = std::get<Statement::Return>(st.data);
-        printf("%*creturn ", indent, ' ');
-        printExpr(&ret.value, indent + 2);
-        printf(";\n");
-      } break;
-      case StatementType::BLOCK:
-        break;
-    }
-  }
-  indent -= 2;
-  printf("%*c}", indent, ' ');
-}
@@ -1,7 +1,9 @@
 #pragma once
 
-#include <list>
+#include <vector>
 #include "lexer.hpp"
+#include "thread_pool.hpp"
+#include "token_stream.hpp"
 #include "ast/ast.hpp"
 
 namespace lon {
@@ -9,59 +11,109 @@ namespace lon {
   class ParserError : public std::exception {
   private:
     std::string m_info;
-    int m_row;
-    int m_column;
+    uint32_t m_offset;
 
   public:
-    ParserError(std::string_view info, int row, int column)
-      : m_row(row), m_column(column), m_info(info), std::exception() {}
+    static constexpr uint32_t AT_EOF = 0xFFFFFFFF;
 
-    ParserError(std::string_view info, Token* tk)
-      : ParserError(info, tk->row, tk->column) {}
-    ParserError(std::string_view info, std::list<Token>::const_iterator tk)
-      : ParserError(info, tk->row, tk->column) {}
+    ParserError(std::string_view info, uint32_t offset = AT_EOF)
+      : m_info(info), m_offset(offset), std::exception() {}
 
-    virtual const char* what() const { return m_info.c_str(); }
+    ParserError(std::string_view info, Token const* tk)
+      : ParserError(info, tk->offset) {}
 
-    inline int row() const { return m_row; }
-    inline int column() const { return m_column; }
+    virtual const char* what() const noexcept override { return m_info.c_str(); }
+
+    // AT_EOF if error is at end of file
+    inline uint32_t offset() const { return m_offset; }
   };
 
   class Parser {
   private:
-    std::string m_inputFileName;
-    std::list<Token> m_textTokens;
+    // owns tokens in array mode, empty when streaming
+    LexerResult m_lexerResult;
+    Lexer* m_lexer;
+
+    TokenStream m_stream;
 
-    // current token
-    std::list<Token>::const_iterator m_tk;
+    // current token, nullptr on end of file
+    Token const* m_tk;
 
     AbstractSourceTree m_ast;
 
+    // children of nodes being parsed, moved to m_ast.lists when node is done
+    std::vector<NodeIndex> m_listStack;
+
+    // operators waiting for their right operand, open parentheses and calls
+    struct PendingOperator {
+      enum Kind : uint8_t { BINARY, UNARY, PAREN, CALL };
+
+      Kind kind;
+      uint8_t op; // BinaryOperator or UnaryOperator
+      uint8_t precedence;
+      Symbol funcName; // CALL
+      uint32_t args; // CALL, start of its arguments in m_listStack
+    };
+
+    // explicit stacks of parseExpression, so nesting doesn't use native stack
+    std::vector<PendingOperator> m_operators;
+    std::vector<NodeIndex> m_operands;
+
   public:
-    Parser(LexerResult const& lexerResult);
+    Parser(LexerResult&& lexerResult, TypeTable& types);
+
+    // Pulls tokens from lexer while parsing, lexer must outlive parser
+    Parser(Lexer& lexer, TypeTable& types);
+
+    // Parses [begin, end) of someone else's token array
+    Parser(std::string_view fileName, SymbolTable& symbols, TypeTable& types, Token const* begin, Token const* end);
+
     ~Parser();
 
   public:
-    void parse();
+    // Array mode files with at least that many tokens are parsed in parallel
+    static constexpr size_t PARALLEL_MIN_TOKENS = 64 * 1024;
+
+    // Parses all definitions, on pool threads if given and there are enough tokens
+    void parse(ThreadPool* pool = nullptr);
     void debugPrint();
 
+    // Parses one top-level definition, false on end of tokens
+    bool parseDefinition();
+
+    // Tokens consumed so far
+    size_t position() const { return m_stream.position(); }
+
     AbstractSourceTree const& getAST() const {
       return m_ast;
     }
 
+    AbstractSourceTree takeAST() {
+      return std::move(m_ast);
+    }
+
+    SourceBuffer const& source() const {
+      return m_lexer ? m_lexer->source() : m_lexerResult.source;
+    }
+
   private:
-    Type parseTypeName();
-    Expression parseExpression();
-    std::list<Statement> parseBlock();
+    void parseParallel(ThreadPool& pool);
+
+    TypeRef parseTypeName();
+    NodeIndex parseExpression();
+    NodeIndex parseLiteral();
+    NodeRange parseBlock();
+
+    // applies pending operators down to base that bind at least as tight as precedence
+    void reduce(size_t base, int precedence);
+    void finishCall(PendingOperator const& call);
+
+    // moves m_listStack from start to m_ast.lists
+    NodeRange popList(size_t start);
 
     void next();
     bool end();
     void assertToken(TokenID id);
-
-    void printType(Type const* tp);
-    void printLiteral(Literal const* lit);
-    void printExpr(Expression const* expr, int indent);
-    void printBlock(std::list<Statement> const& statements, int indent);
   };
 
 } // namespace lon
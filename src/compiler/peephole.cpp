@@ -0,0 +1,542 @@
+#include "peephole.hpp"
+
+#include <algorithm>
+
+using lon::LabelRef;
+using lon::MachineCode;
+using lon::MachineInstruction;
+using lon::Mnemonic;
+using lon::Operand;
+
+namespace lon {
+
+  class Peephole {
+  private:
+    struct Rule {
+      const char* name;
+      bool (Peephole::*apply)(size_t i); // at instruction i, true if rewritten
+    };
+
+    static const Rule RULES[];
+
+    std::vector<MachineInstruction>& m_insts;
+    std::vector<std::string> const& m_labels;
+
+    std::vector<size_t> m_labelAt; // index of every label's LABEL instruction
+    std::vector<uint32_t> m_references; // operands naming every label
+
+  public:
+    Peephole(MachineCode& code) : m_insts(code.insts), m_labels(code.labels) {}
+
+    // Table is defined after the rules
+    uint32_t run();
+
+  private:
+    void index() {
+      m_labelAt.assign(m_labels.size(), NO_VALUE);
+      m_references.assign(m_labels.size(), 0);
+
+      for (size_t i = 0; i < m_insts.size(); ++i) {
+        auto const& inst = m_insts[i];
+        if (inst.op == Mnemonic::LABEL) {
+          m_labelAt[inst.ops[0].label] = i;
+          continue;
+        }
+
+        for (auto const& op : inst.ops) {
+          if (op.label != NO_LABEL)
+            m_references[op.label]++;
+        }
+      }
+    }
+
+    static constexpr size_t NO_VALUE = ~(size_t)0;
+
+    inline MachineInstruction& at(size_t i) { return m_insts[i]; }
+
+    // Next instruction that wasn't removed, m_insts.size() if none
+    size_t next(size_t i) const {
+      do {
+        i++;
+      } while (i < m_insts.size() && m_insts[i].op == Mnemonic::NONE);
+      return i;
+    }
+
+    void remove(size_t i) {
+      for (auto const& op : m_insts[i].ops) {
+        if (op.label != NO_LABEL)
+          m_references[op.label]--;
+      }
+      m_insts[i].op = Mnemonic::NONE;
+    }
+
+    void retarget(MachineInstruction& jump, LabelRef label) {
+      m_references[jump.ops[0].label]--;
+      m_references[label]++;
+      jump.ops[0] = Operand::target(label);
+    }
+
+    // Labels from i on, before any instruction, include label
+    bool labelFollows(size_t i, LabelRef label) const {
+      for (; i < m_insts.size(); i = next(i)) {
+        auto const& inst = m_insts[i];
+        if (inst.op != Mnemonic::LABEL)
+          return false;
+        if (inst.ops[0].label == label)
+          return true;
+      }
+      return false;
+    }
+
+    // Bytes of reg inst reads before writing, and writes
+    static void effects(MachineInstruction const& inst, uint8_t reg, uint8_t& read, uint8_t& written) {
+      read = written = 0;
+
+      auto use = [&](Operand const& op) {
+        if (op.kind == Operand::REGISTER && op.reg == reg)
+          read = std::max(read, op.size);
+        else if (op.kind == Operand::MEMORY && op.reg == reg)
+          read = 4;
+      };
+      auto def = [&](Operand const& op) {
+        if (op.kind == Operand::REGISTER && op.reg == reg)
+          written = std::max(written, op.size);
+        else
+          use(op);
+      };
+
+      switch (inst.op) {
+        case Mnemonic::MOV:
+        case Mnemonic::MOVZX:
+        case Mnemonic::MOVSX:
+        case Mnemonic::SETCC:
+        case Mnemonic::POP:
+          use(inst.ops[1]);
+          def(inst.ops[0]);
+          break;
+
+        case Mnemonic::XOR:
+          // zeroing idiom doesn't depend on the old value
+          if (inst.ops[0].kind == Operand::REGISTER && inst.ops[0] == inst.ops[1]) {
+            def(inst.ops[0]);
+            break;
+          }
+          [[fallthrough]];
+        case Mnemonic::ADD:
+        case Mnemonic::SUB:
+        case Mnemonic::IMUL:
+        case Mnemonic::NEG:
+        case Mnemonic::INC:
+        case Mnemonic::DEC:
+          use(inst.ops[0]);
+          use(inst.ops[1]);
+          def(inst.ops[0]);
+          break;
+
+        case Mnemonic::CMP:
+        case Mnemonic::TEST:
+        case Mnemonic::PUSH:
+          use(inst.ops[0]);
+          use(inst.ops[1]);
+          break;
+
+        case Mnemonic::CDQ:
+          read = reg == REG_EAX ? 4 : 0;
+          written = reg == REG_EDX ? 4 : 0;
+          break;
+
+        case Mnemonic::DIV:
+        case Mnemonic::IDIV:
+          use(inst.ops[0]);
+          if (reg == REG_EAX || reg == REG_EDX)
+            read = written = 4;
+          break;
+
+        case Mnemonic::REP_MOVSB:
+          if (reg == REG_ECX || reg == REG_ESI || reg == REG_EDI)
+            read = written = 4;
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    // Value of reg isn't read from instruction i on
+    bool isDead(uint8_t reg, size_t i) const {
+      uint8_t covered = 0;
+
+      for (; i < m_insts.size(); i = next(i)) {
+        auto const& inst = m_insts[i];
+
+        switch (inst.op) {
+          case Mnemonic::NONE:
+            continue;
+
+          // only the scratch register never lives across these, calls
+          // clobber it and others may be arguments or preserved
+          case Mnemonic::LABEL:
+          case Mnemonic::JMP:
+          case Mnemonic::JCC:
+          case Mnemonic::CALL:
+            return reg == REG_EAX;
+
+          case Mnemonic::RET:
+          case Mnemonic::ERROR:
+            return false;
+
+          default:
+            break;
+        }
+
+        uint8_t read, written;
+        effects(inst, reg, read, written);
+        if (read > covered)
+          return false;
+
+        covered = std::max(covered, written);
+        if (covered >= 4)
+          return true;
+      }
+
+      return true;
+    }
+
+    // Flags aren't read from instruction i on
+    bool flagsDead(size_t i) const {
+      for (; i < m_insts.size(); i = next(i)) {
+        switch (m_insts[i].op) {
+          case Mnemonic::SETCC:
+          case Mnemonic::JCC:
+          case Mnemonic::ERROR:
+            return false;
+
+          case Mnemonic::LABEL:
+          case Mnemonic::JMP:
+          case Mnemonic::CALL:
+          case Mnemonic::RET:
+          case Mnemonic::ADD:
+          case Mnemonic::SUB:
+          case Mnemonic::IMUL:
+          case Mnemonic::XOR:
+          case Mnemonic::CMP:
+          case Mnemonic::TEST:
+          case Mnemonic::NEG:
+          case Mnemonic::DIV:
+          case Mnemonic::IDIV:
+            return true;
+
+          default:
+            break;
+        }
+      }
+
+      return true;
+    }
+
+    static bool isImmediate(Operand const& op, int32_t value) {
+      return op.kind == Operand::IMMEDIATE && op.label == NO_LABEL && op.value == value;
+    }
+
+    // mov x, x
+    bool movToItself(size_t i) {
+      auto const& inst = at(i);
+      if (inst.op != Mnemonic::MOV || inst.ops[0] != inst.ops[1])
+        return false;
+
+      remove(i);
+      return true;
+    }
+
+    // mov a, b; mov b, a: the second copies what is already there
+    bool movBack(size_t i) {
+      size_t j = next(i);
+      if (at(i).op != Mnemonic::MOV || j == m_insts.size() || at(j).op != Mnemonic::MOV)
+        return false;
+
+      auto const& first = at(i);
+      auto const& second = at(j);
+      if (second.ops[0] != first.ops[1] || second.ops[1] != first.ops[0])
+        return false;
+
+      remove(j);
+      return true;
+    }
+
+    // mov [m], r; mov r2, [m]: the value is still in r
+    bool reloadStored(size_t i) {
+      size_t j = next(i);
+      if (at(i).op != Mnemonic::MOV || j == m_insts.size() || at(j).op != Mnemonic::MOV)
+        return false;
+
+      auto const& store = at(i);
+      auto& load = at(j);
+      if (store.ops[0].kind != Operand::MEMORY || store.ops[1].kind != Operand::REGISTER)
+        return false;
+      if (load.ops[0].kind != Operand::REGISTER || load.ops[1] != store.ops[0])
+        return false;
+
+      load.ops[1] = store.ops[1];
+      return true;
+    }
+
+    // mov eax, x; op y, eax: x is used directly if eax isn't read later
+    bool foldScratch(size_t i) {
+      static const Operand eax = Operand::reg32(REG_EAX);
+
+      size_t j = next(i);
+      if (at(i).op != Mnemonic::MOV || at(i).ops[0] != eax || j == m_insts.size())
+        return false;
+
+      auto& use = at(j);
+      Operand x = at(i).ops[1];
+      bool writesFirst;
+
+      switch (use.op) {
+        case Mnemonic::MOV:
+        case Mnemonic::ADD:
+        case Mnemonic::SUB:
+        case Mnemonic::IMUL:
+        case Mnemonic::XOR:
+          writesFirst = true;
+          break;
+        case Mnemonic::CMP:
+        case Mnemonic::TEST:
+        case Mnemonic::PUSH:
+          writesFirst = false;
+          break;
+        default:
+          return false;
+      }
+
+      Operand ops[2] = { use.ops[0], use.ops[1] };
+      bool replaced = false;
+
+      for (int k = 0; k < 2; ++k) {
+        if (ops[k] == eax) {
+          if (k == 0 && writesFirst)
+            return false;
+          ops[k] = x;
+          replaced = true;
+        }
+        else if ((ops[k].kind == Operand::REGISTER || ops[k].kind == Operand::MEMORY) && ops[k].reg == REG_EAX) {
+          return false;
+        }
+      }
+
+      // forms x86 has
+      if (!replaced || ops[0].kind == Operand::IMMEDIATE && use.op != Mnemonic::PUSH)
+        return false;
+      if (ops[0].kind == Operand::MEMORY && ops[1].kind == Operand::MEMORY)
+        return false;
+      if (use.op == Mnemonic::IMUL && ops[0].kind != Operand::REGISTER)
+        return false;
+
+      if (!isDead(REG_EAX, next(j)))
+        return false;
+
+      remove(i);
+      for (auto const& op : ops) {
+        if (op.label != NO_LABEL)
+          m_references[op.label]++;
+      }
+      use.ops[0] = ops[0];
+      use.ops[1] = ops[1];
+      return true;
+    }
+
+    // jmp L; L:
+    bool jumpToNext(size_t i) {
+      auto const& inst = at(i);
+      if (inst.op != Mnemonic::JMP || inst.ops[0].kind != Operand::LABEL)
+        return false;
+      if (!labelFollows(next(i), inst.ops[0].label))
+        return false;
+
+      remove(i);
+      return true;
+    }
+
+    // jcc L1; jmp L2; L1: is jncc L2; L1:
+    bool jumpOverJump(size_t i) {
+      size_t j = next(i);
+      if (at(i).op != Mnemonic::JCC || j == m_insts.size())
+        return false;
+
+      auto& branch = at(i);
+      auto const& jump = at(j);
+      if (jump.op != Mnemonic::JMP || jump.ops[0].kind != Operand::LABEL)
+        return false;
+      if (!labelFollows(next(j), branch.ops[0].label))
+        return false;
+
+      branch.cond = negate(branch.cond);
+      retarget(branch, jump.ops[0].label);
+      remove(j);
+      return true;
+    }
+
+    // jmp L; ... L: jmp M is jmp M, same for conditional jumps
+    bool threadJump(size_t i) {
+      auto& inst = at(i);
+      if ((inst.op != Mnemonic::JMP && inst.op != Mnemonic::JCC) || inst.ops[0].kind != Operand::LABEL)
+        return false;
+
+      LabelRef target = inst.ops[0].label;
+      std::vector<LabelRef> seen = { target };
+
+      while (m_labelAt[target] != NO_VALUE) {
+        size_t k = m_labelAt[target];
+        while (k < m_insts.size() && (m_insts[k].op == Mnemonic::LABEL || m_insts[k].op == Mnemonic::NONE))
+          k++;
+        if (k == m_insts.size())
+          break;
+
+        auto const& jump = m_insts[k];
+        if (jump.op != Mnemonic::JMP || jump.ops[0].kind != Operand::LABEL)
+          break;
+
+        target = jump.ops[0].label;
+
+        // endless loop of jumps, leave it be
+        if (std::find(seen.begin(), seen.end(), target) != seen.end())
+          return false;
+        seen.push_back(target);
+      }
+
+      if (target == inst.ops[0].label)
+        return false;
+
+      retarget(inst, target);
+      return true;
+    }
+
+    // Nothing jumps to instructions after jmp or ret before a label
+    bool unreachable(size_t i) {
+      size_t j = next(i);
+      if ((at(i).op != Mnemonic::JMP && at(i).op != Mnemonic::RET) || j == m_insts.size())
+        return false;
+      if (at(j).op == Mnemonic::LABEL || at(j).op == Mnemonic::ERROR)
+        return false;
+
+      remove(j);
+      return true;
+    }
+
+    // Local labels (.B, .E) are only referenced by jumps of the function
+    bool unusedLabel(size_t i) {
+      auto const& inst = at(i);
+      if (inst.op != Mnemonic::LABEL || m_labels[inst.ops[0].label][0] != '.')
+        return false;
+      if (m_references[inst.ops[0].label] != 0)
+        return false;
+
+      remove(i);
+      return true;
+    }
+
+    // mov r, 0 is xor r, r, 2 bytes instead of 5
+    bool zeroByXor(size_t i) {
+      auto& inst = at(i);
+      if (inst.op != Mnemonic::MOV || inst.ops[0].kind != Operand::REGISTER || !isImmediate(inst.ops[1], 0))
+        return false;
+      if (!flagsDead(next(i)))
+        return false;
+
+      inst.op = Mnemonic::XOR;
+      inst.ops[1] = inst.ops[0];
+      return true;
+    }
+
+    // cmp r, 0 is test r, r, same flags
+    bool compareZero(size_t i) {
+      auto& inst = at(i);
+      if (inst.op != Mnemonic::CMP || inst.ops[0].kind != Operand::REGISTER || !isImmediate(inst.ops[1], 0))
+        return false;
+
+      inst.op = Mnemonic::TEST;
+      inst.ops[1] = inst.ops[0];
+      return true;
+    }
+
+    // add r, 1 is inc r, it only keeps the carry flag
+    bool incDec(size_t i) {
+      auto& inst = at(i);
+      if (inst.op != Mnemonic::ADD && inst.op != Mnemonic::SUB)
+        return false;
+      if (!isImmediate(inst.ops[1], 1) && !isImmediate(inst.ops[1], -1))
+        return false;
+      if (!flagsDead(next(i)))
+        return false;
+
+      bool up = (inst.op == Mnemonic::ADD) == (inst.ops[1].value == 1);
+      inst.op = up ? Mnemonic::INC : Mnemonic::DEC;
+      inst.ops[1] = {};
+      return true;
+    }
+
+    // add x, 0 or imul r, 1
+    bool identity(size_t i) {
+      auto const& inst = at(i);
+      bool none = (inst.op == Mnemonic::ADD || inst.op == Mnemonic::SUB) && isImmediate(inst.ops[1], 0);
+      bool one = inst.op == Mnemonic::IMUL && isImmediate(inst.ops[1], 1);
+      if (!(none || one) || !flagsDead(next(i)))
+        return false;
+
+      remove(i);
+      return true;
+    }
+  };
+
+  // Tried in order at every instruction
+  const Peephole::Rule Peephole::RULES[] = {
+    { "mov to itself", &Peephole::movToItself },
+    { "mov back", &Peephole::movBack },
+    { "reload of stored", &Peephole::reloadStored },
+    { "fold scratch", &Peephole::foldScratch },
+    { "jump to next", &Peephole::jumpToNext },
+    { "jump over jump", &Peephole::jumpOverJump },
+    { "thread jump", &Peephole::threadJump },
+    { "unreachable", &Peephole::unreachable },
+    { "unused label", &Peephole::unusedLabel },
+    { "zero by xor", &Peephole::zeroByXor },
+    { "compare with zero", &Peephole::compareZero },
+    { "inc or dec", &Peephole::incDec },
+    { "identity", &Peephole::identity },
+  };
+
+  uint32_t Peephole::run() {
+    uint32_t rewrites = 0;
+
+    for (bool changed = true; changed;) {
+      changed = false;
+      index();
+
+      for (size_t i = 0; i < m_insts.size(); ++i) {
+        for (auto const& rule : RULES) {
+          if (m_insts[i].op == Mnemonic::NONE)
+            break;
+
+          if ((this->*rule.apply)(i)) {
+            rewrites++;
+            changed = true;
+          }
+        }
+      }
+
+      m_insts.erase(
+        std::remove_if(m_insts.begin(), m_insts.end(), [](MachineInstruction const& inst) {
+          return inst.op == Mnemonic::NONE;
+        }),
+        m_insts.end()
+      );
+    }
+
+    return rewrites;
+  }
+
+} // namespace lon
+
+uint32_t lon::peephole(MachineCode& code) {
+  return Peephole(code).run();
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "machine.hpp"
+
+namespace lon {
+
+  // Rewrites short windows of instructions by the rules in peephole.cpp
+  // until none applies. Relies on how the generator uses registers: eax is
+  // scratch and flags are tested right before conditional jumps, so neither
+  // lives across labels and jumps. Returns count of rewrites
+  uint32_t peephole(MachineCode& code);
+
+} // namespace lon
@@ -0,0 +1,182 @@
+#include "regalloc.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+using lon::Allocation;
+using lon::BlockRef;
+using lon::IRFunction;
+using lon::Location;
+using lon::Opcode;
+using lon::RegisterMask;
+using lon::ValueRef;
+
+static inline bool needsLocation(lon::Instruction const& inst) {
+  return inst.type != lon::TYPE_VOID && inst.op > Opcode::CONST_STRING;
+}
+
+// First instruction in sorted list after value
+static inline ValueRef nextAfter(std::vector<ValueRef> const& list, ValueRef value) {
+  auto it = std::upper_bound(list.begin(), list.end(), value);
+  return it == list.end() ? lon::NO_VALUE : *it;
+}
+
+Allocation lon::allocateRegisters(IRFunction const& func) {
+  size_t count = func.insts.size();
+  Allocation result = { std::vector<Location>(count, { Location::NONE, REG_NONE, 0 }), 0, 0 };
+
+  // uses of instruction i are at 2i, its definition at 2i + 1
+  std::vector<uint32_t> end(count, 0);
+  std::vector<ValueRef> calls;
+  std::vector<ValueRef> divisions;
+
+  auto use = [&](ValueRef value, uint32_t position) {
+    end[value] = std::max(end[value], position);
+  };
+
+  for (auto const& bb : func.blocks) {
+    for (ValueRef value = bb.first; value < bb.first + bb.count; ++value) {
+      auto const& inst = func.insts[value];
+
+      if (inst.op == Opcode::PHI) {
+        // copied at the end of the predecessor
+        for (uint32_t i = 0; i < inst.list.count; i += 2) {
+          auto const& pred = func.blocks[func.operand(inst.list, i)];
+          use(func.operand(inst.list, i + 1), 2 * (pred.first + pred.count - 1));
+        }
+        continue;
+      }
+
+      func.forEachOperand(inst, [&](ValueRef used) { use(used, 2 * value); });
+
+      if (inst.op == Opcode::CALL)
+        calls.push_back(value);
+      if (inst.op == Opcode::DIV || inst.op == Opcode::MOD)
+        divisions.push_back(value);
+    }
+  }
+
+  // a value live at the start of a loop stays live until its back edge
+  for (BlockRef block = 0; block < func.blocks.size(); ++block) {
+    BlockRef targets[2];
+    int targetsCount = func.successors(block, targets);
+
+    for (int i = 0; i < targetsCount; ++i) {
+      if (targets[i] > block)
+        continue;
+
+      auto const& bb = func.blocks[block];
+      uint32_t loopStart = 2 * func.blocks[targets[i]].first;
+      uint32_t loopEnd = 2 * (bb.first + bb.count - 1);
+
+      for (ValueRef value = 0; value < count; ++value) {
+        if (2 * value + 1 < loopStart && end[value] >= loopStart)
+          end[value] = std::max(end[value], loopEnd);
+      }
+    }
+  }
+
+  // registers taken, by values sorted by the end of their intervals
+  std::vector<ValueRef> active;
+  RegisterMask busy = 0;
+
+  // stack slots of spilled values, by end of intervals
+  using Held = std::pair<uint32_t, uint32_t>;
+  std::priority_queue<Held, std::vector<Held>, std::greater<Held>> heldSlots;
+  std::vector<uint32_t> freeSlots;
+
+  auto byEnd = [&](ValueRef a, ValueRef b) { return end[a] < end[b]; };
+
+  auto spill = [&](ValueRef value, bool reuse) {
+    uint32_t slot;
+    if (reuse && !freeSlots.empty()) {
+      slot = freeSlots.back();
+      freeSlots.pop_back();
+    }
+    else {
+      slot = result.slotsCount++;
+    }
+
+    result.locations[value] = { Location::STACK, REG_NONE, slot };
+    heldSlots.push({ end[value], slot });
+  };
+
+  for (ValueRef value = 0; value < count; ++value) {
+    auto const& inst = func.insts[value];
+    if (!needsLocation(inst) || end[value] == 0)
+      continue;
+
+    uint32_t start = 2 * value + 1;
+
+    while (!active.empty() && end[active.front()] < start) {
+      busy &= ~(1 << result.locations[active.front()].reg);
+      active.erase(active.begin());
+    }
+
+    while (!heldSlots.empty() && heldSlots.top().first < start) {
+      freeSlots.push_back(heldSlots.top().second);
+      heldSlots.pop();
+    }
+
+    RegisterMask allowed = ALLOCATABLE_REGISTERS;
+
+    ValueRef call = nextAfter(calls, value);
+    if (call != NO_VALUE && 2 * call + 1 < end[value])
+      allowed &= ~CALLER_SAVED_REGISTERS;
+
+    // dividend goes to edx:eax, constant divisors to ecx
+    ValueRef division = nextAfter(divisions, value);
+    if (division != NO_VALUE && 2 * division <= end[value])
+      allowed &= ~((1 << REG_ECX) | (1 << REG_EDX));
+
+    RegisterMask free = allowed & ~busy;
+    uint8_t reg = REG_NONE;
+
+    if (free != 0) {
+      // a phi in the register of its first value saves a move
+      if (inst.op == Opcode::PHI) {
+        Location const& first = result.locations[func.operand(inst.list, 1)];
+        if (first.kind == Location::REGISTER && (free & (1 << first.reg)))
+          reg = first.reg;
+      }
+
+      // caller-saved ones first, they don't need saving
+      if (reg == REG_NONE) {
+        reg = 0;
+        while (!(free & (1 << reg)))
+          reg++;
+      }
+    }
+    else {
+      // the interval ending last gives up its register, if it can be used here
+      for (auto it = active.rbegin(); it != active.rend(); ++it) {
+        if (!(allowed & (1 << result.locations[*it].reg)))
+          continue;
+
+        if (end[*it] > end[value]) {
+          ValueRef victim = *it;
+          reg = result.locations[victim].reg;
+          active.erase(std::next(it).base());
+
+          // its interval started earlier, a freed slot may still be in use then
+          spill(victim, false);
+          busy &= ~(1 << reg);
+        }
+        break;
+      }
+
+      if (reg == REG_NONE) {
+        spill(value, true);
+        continue;
+      }
+    }
+
+    result.locations[value] = { Location::REGISTER, reg, 0 };
+    result.usedRegisters |= 1 << reg;
+    busy |= 1 << reg;
+    active.insert(std::upper_bound(active.begin(), active.end(), value, byEnd), value);
+  }
+
+  return result;
+}
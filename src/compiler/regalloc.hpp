@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "ir/ir.hpp"
+#include "machine.hpp"
+
+namespace lon {
+
+  using RegisterMask = uint32_t;
+
+  // eax is a scratch register of the generator and holds results of calls,
+  // so values never live in it
+  constexpr RegisterMask ALLOCATABLE_REGISTERS =
+    (1 << REG_ECX) | (1 << REG_EDX) | (1 << REG_EBX) | (1 << REG_ESI) | (1 << REG_EDI);
+
+  // clobbered by calls
+  constexpr RegisterMask CALLER_SAVED_REGISTERS = (1 << REG_EAX) | (1 << REG_ECX) | (1 << REG_EDX);
+
+  // preserved by calls, saved in prologue if used
+  constexpr RegisterMask CALLEE_SAVED_REGISTERS = (1 << REG_EBX) | (1 << REG_ESI) | (1 << REG_EDI);
+
+  // fastcall, the rest goes on the stack right to left and the callee pops it
+  constexpr Register ARGUMENT_REGISTERS[] = { REG_ECX, REG_EDX };
+
+  struct Location {
+    enum Kind : uint8_t {
+      NONE, // constants and unused values
+      REGISTER,
+      STACK
+    };
+
+    Kind kind;
+    uint8_t reg;
+    uint32_t slot; // [ebp - 4 * (slot + 1)]
+
+    inline bool operator==(Location const& other) const {
+      return kind == other.kind && (kind == REGISTER ? reg == other.reg : kind == NONE || slot == other.slot);
+    }
+    inline bool operator!=(Location const& other) const { return !(*this == other); }
+  };
+
+  struct Allocation {
+    std::vector<Location> locations; // of every value
+    uint32_t slotsCount;
+    RegisterMask usedRegisters;
+  };
+
+  // Linear scan (Poletto, Sarkar) over instructions in block order. Every
+  // value has one interval from its definition to its last use, a phi value
+  // is used at the end of its predecessor. Values live across calls only get
+  // callee-saved registers, spilled ones keep their stack slot for the whole
+  // interval
+  Allocation allocateRegisters(IRFunction const& func);
+
+} // namespace lon
@@ -0,0 +1,398 @@
+#include "scan.hpp"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LON_SCAN_SSE2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define LON_TARGET_AVX2
+#else
+#define LON_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using lon::ScanKernels;
+
+static inline unsigned countTrailingZeros(uint32_t value) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanForward(&index, value);
+  return index;
+#else
+  return __builtin_ctz(value);
+#endif
+}
+
+static inline bool isIdentifierChar(char chr) {
+  return
+    (chr >= 'a' && chr <= 'z') ||
+    (chr >= 'A' && chr <= 'Z') ||
+    (chr >= '0' && chr <= '9') ||
+    chr == '_';
+}
+
+//
+// scalar
+//
+
+static const char* scalarSkipWhitespace(const char* pt) {
+  while (
+    *pt == ' ' ||
+    (*pt >= '\t' && *pt <= '\f') ||
+    (*pt == '\r' && pt[1] == '\n')
+  )
+    ++pt;
+
+  return pt;
+}
+
+static const char* scalarFindLineEnd(const char* pt) {
+  while (*pt != '\n' && *pt)
+    ++pt;
+
+  return pt;
+}
+
+static const char* scalarFindCommentEnd(const char* pt) {
+  while ((*pt != '*' || pt[1] != '/') && *pt)
+    ++pt;
+
+  return pt;
+}
+
+static const char* scalarFindStringSpecial(const char* pt) {
+  while (
+    *pt != '"' &&
+    *pt != '\\' &&
+    *pt != '\r' &&
+    *pt != '\n' &&
+    *pt
+  )
+    ++pt;
+
+  return pt;
+}
+
+static const char* scalarFindIdentifierEnd(const char* pt) {
+  while (isIdentifierChar(*pt))
+    ++pt;
+
+  return pt;
+}
+
+static const char* scalarFindNewline(const char* pt, const char* end) {
+  auto found = (const char*)memchr(pt, '\n', end - pt);
+  return found ? found : end;
+}
+
+static const ScanKernels SCALAR_KERNELS = {
+  "scalar",
+  scalarSkipWhitespace,
+  scalarFindLineEnd,
+  scalarFindCommentEnd,
+  scalarFindStringSpecial,
+  scalarFindIdentifierEnd,
+  scalarFindNewline,
+};
+
+#ifdef LON_SCAN_SSE2
+
+//
+// SSE2, 16 bytes per step
+//
+
+static inline __m128i sseLoad(const char* pt) {
+  return _mm_loadu_si128((const __m128i*)pt);
+}
+
+static inline __m128i sseEq(__m128i v, char chr) {
+  return _mm_cmpeq_epi8(v, _mm_set1_epi8(chr));
+}
+
+// v >= lo && v <= hi, signed, so bytes >= 0x80 never match
+static inline __m128i sseRange(__m128i v, char lo, char hi) {
+  return _mm_and_si128(
+    _mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+    _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1))
+  );
+}
+
+static inline uint32_t sseMask(__m128i v) {
+  return (uint32_t)_mm_movemask_epi8(v);
+}
+
+static const char* sseSkipWhitespace(const char* pt) {
+  while (true) {
+    __m128i v = sseLoad(pt);
+    __m128i crlf = _mm_and_si128(sseEq(v, '\r'), sseEq(sseLoad(pt + 1), '\n'));
+    __m128i ws = _mm_or_si128(_mm_or_si128(sseEq(v, ' '), sseRange(v, '\t', '\f')), crlf);
+
+    uint32_t stop = ~sseMask(ws) & 0xFFFF;
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 16;
+  }
+}
+
+static const char* sseFindLineEnd(const char* pt) {
+  while (true) {
+    __m128i v = sseLoad(pt);
+
+    uint32_t stop = sseMask(_mm_or_si128(sseEq(v, '\n'), sseEq(v, 0)));
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 16;
+  }
+}
+
+static const char* sseFindCommentEnd(const char* pt) {
+  while (true) {
+    __m128i v = sseLoad(pt);
+    __m128i end = _mm_and_si128(sseEq(v, '*'), sseEq(sseLoad(pt + 1), '/'));
+
+    uint32_t stop = sseMask(_mm_or_si128(end, sseEq(v, 0)));
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 16;
+  }
+}
+
+static const char* sseFindStringSpecial(const char* pt) {
+  while (true) {
+    __m128i v = sseLoad(pt);
+    __m128i special = _mm_or_si128(
+      _mm_or_si128(sseEq(v, '"'), sseEq(v, '\\')),
+      _mm_or_si128(_mm_or_si128(sseEq(v, '\r'), sseEq(v, '\n')), sseEq(v, 0))
+    );
+
+    uint32_t stop = sseMask(special);
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 16;
+  }
+}
+
+static const char* sseFindIdentifierEnd(const char* pt) {
+  while (true) {
+    __m128i v = sseLoad(pt);
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i ident = _mm_or_si128(
+      _mm_or_si128(sseRange(lower, 'a', 'z'), sseRange(v, '0', '9')),
+      sseEq(v, '_')
+    );
+
+    uint32_t stop = ~sseMask(ident) & 0xFFFF;
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 16;
+  }
+}
+
+static const char* sseFindNewline(const char* pt, const char* end) {
+  while (pt < end) {
+    uint32_t found = sseMask(sseEq(sseLoad(pt), '\n'));
+    if (found) {
+      pt += countTrailingZeros(found);
+      return pt < end ? pt : end;
+    }
+
+    pt += 16;
+  }
+
+  return end;
+}
+
+static const ScanKernels SSE2_KERNELS = {
+  "sse2",
+  sseSkipWhitespace,
+  sseFindLineEnd,
+  sseFindCommentEnd,
+  sseFindStringSpecial,
+  sseFindIdentifierEnd,
+  sseFindNewline,
+};
+
+//
+// AVX2, 32 bytes per step
+//
+
+LON_TARGET_AVX2 static inline __m256i avxLoad(const char* pt) {
+  return _mm256_loadu_si256((const __m256i*)pt);
+}
+
+LON_TARGET_AVX2 static inline __m256i avxEq(__m256i v, char chr) {
+  return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(chr));
+}
+
+LON_TARGET_AVX2 static inline __m256i avxRange(__m256i v, char lo, char hi) {
+  return _mm256_and_si256(
+    _mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+    _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v)
+  );
+}
+
+LON_TARGET_AVX2 static inline uint32_t avxMask(__m256i v) {
+  return (uint32_t)_mm256_movemask_epi8(v);
+}
+
+LON_TARGET_AVX2 static const char* avxSkipWhitespace(const char* pt) {
+  while (true) {
+    __m256i v = avxLoad(pt);
+    __m256i crlf = _mm256_and_si256(avxEq(v, '\r'), avxEq(avxLoad(pt + 1), '\n'));
+    __m256i ws = _mm256_or_si256(_mm256_or_si256(avxEq(v, ' '), avxRange(v, '\t', '\f')), crlf);
+
+    uint32_t stop = ~avxMask(ws);
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 32;
+  }
+}
+
+LON_TARGET_AVX2 static const char* avxFindLineEnd(const char* pt) {
+  while (true) {
+    __m256i v = avxLoad(pt);
+
+    uint32_t stop = avxMask(_mm256_or_si256(avxEq(v, '\n'), avxEq(v, 0)));
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 32;
+  }
+}
+
+LON_TARGET_AVX2 static const char* avxFindCommentEnd(const char* pt) {
+  while (true) {
+    __m256i v = avxLoad(pt);
+    __m256i end = _mm256_and_si256(avxEq(v, '*'), avxEq(avxLoad(pt + 1), '/'));
+
+    uint32_t stop = avxMask(_mm256_or_si256(end, avxEq(v, 0)));
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 32;
+  }
+}
+
+LON_TARGET_AVX2 static const char* avxFindStringSpecial(const char* pt) {
+  while (true) {
+    __m256i v = avxLoad(pt);
+    __m256i special = _mm256_or_si256(
+      _mm256_or_si256(avxEq(v, '"'), avxEq(v, '\\')),
+      _mm256_or_si256(_mm256_or_si256(avxEq(v, '\r'), avxEq(v, '\n')), avxEq(v, 0))
+    );
+
+    uint32_t stop = avxMask(special);
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 32;
+  }
+}
+
+LON_TARGET_AVX2 static const char* avxFindIdentifierEnd(const char* pt) {
+  while (true) {
+    __m256i v = avxLoad(pt);
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i ident = _mm256_or_si256(
+      _mm256_or_si256(avxRange(lower, 'a', 'z'), avxRange(v, '0', '9')),
+      avxEq(v, '_')
+    );
+
+    uint32_t stop = ~avxMask(ident);
+    if (stop)
+      return pt + countTrailingZeros(stop);
+
+    pt += 32;
+  }
+}
+
+LON_TARGET_AVX2 static const char* avxFindNewline(const char* pt, const char* end) {
+  while (pt < end) {
+    uint32_t found = avxMask(avxEq(avxLoad(pt), '\n'));
+    if (found) {
+      pt += countTrailingZeros(found);
+      return pt < end ? pt : end;
+    }
+
+    pt += 32;
+  }
+
+  return end;
+}
+
+static const ScanKernels AVX2_KERNELS = {
+  "avx2",
+  avxSkipWhitespace,
+  avxFindLineEnd,
+  avxFindCommentEnd,
+  avxFindStringSpecial,
+  avxFindIdentifierEnd,
+  avxFindNewline,
+};
+
+static bool hasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+
+  // AVX and OS saves YMM registers
+  __cpuid(info, 1);
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+    return false;
+  if ((_xgetbv(0) & 6) != 6)
+    return false;
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // LON_SCAN_SSE2
+
+static ScanKernels const& selectKernels() {
+  // LON_SCAN=scalar|sse2|avx2 to force kernels (for debugging)
+  const char* forced = getenv("LON_SCAN");
+
+  if (forced && strcmp(forced, "scalar") == 0)
+    return SCALAR_KERNELS;
+
+#ifdef LON_SCAN_SSE2
+  if (forced && strcmp(forced, "sse2") == 0)
+    return SSE2_KERNELS;
+
+  if (hasAvx2())
+    return AVX2_KERNELS;
+
+  return SSE2_KERNELS;
+#else
+  return SCALAR_KERNELS;
+#endif
+}
+
+ScanKernels const& lon::scalarScanKernels() {
+  return SCALAR_KERNELS;
+}
+
+ScanKernels const& lon::scanKernels() {
+  static ScanKernels const& kernels = selectKernels();
+  return kernels;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+namespace lon {
+
+  // Lexer hot loops. Every kernel returns the first position where scanning
+  // must stop and always stops on null char.
+  // Vector versions read up to 33 bytes after the returned position,
+  // that's covered by SOURCE_PADDING
+  struct ScanKernels {
+    const char* name;
+
+    // first char that is not ' ', '\t', '\n', '\v', '\f' or "\r\n" pair
+    const char* (*skipWhitespace)(const char* pt);
+
+    // first '\n'
+    const char* (*findLineEnd)(const char* pt);
+
+    // first "*/"
+    const char* (*findCommentEnd)(const char* pt);
+
+    // first '"', '\\', '\r' or '\n'
+    const char* (*findStringSpecial)(const char* pt);
+
+    // first char that is not [A-Za-z0-9_]
+    const char* (*findIdentifierEnd)(const char* pt);
+
+    // first '\n' before `end` or `end` itself (no null check)
+    const char* (*findNewline)(const char* pt, const char* end);
+  };
+
+  // Portable kernels, the vector ones give exactly the same results
+  ScanKernels const& scalarScanKernels();
+
+  // Best kernels for the running CPU
+  ScanKernels const& scanKernels();
+
+} // namespace lon
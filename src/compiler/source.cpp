@@ -0,0 +1,356 @@
+#include "source.hpp"
+
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "scan.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using lon::SourceBuffer;
+using lon::SourceLocation;
+using lon::SOURCE_PADDING;
+
+static size_t roundUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+[[noreturn]] static void fail(const char* what, std::string_view path) {
+  throw std::runtime_error(std::string(what) + " '" + std::string(path) + "'");
+}
+
+// Grow-as-needed buffer for the read() fallback.
+// `hint` is the expected size, so regular files are read in one go
+struct ReadBuffer {
+  std::unique_ptr<char[]> data;
+  size_t size = 0;
+  size_t capacity = 0;
+
+  explicit ReadBuffer(size_t hint) {
+    capacity = hint + SOURCE_PADDING;
+    data.reset(new char[capacity]);
+  }
+
+  char* tail() { return data.get() + size; }
+  size_t freeSpace() const { return capacity - size - SOURCE_PADDING; }
+
+  void reserveMore() {
+    if (freeSpace() != 0)
+      return;
+
+    size_t newCapacity = capacity * 2;
+    std::unique_ptr<char[]> newData(new char[newCapacity]);
+    memcpy(newData.get(), data.get(), size);
+    data = std::move(newData);
+    capacity = newCapacity;
+  }
+
+  void finish() {
+    memset(data.get() + size, 0, SOURCE_PADDING);
+  }
+};
+
+SourceBuffer::SourceBuffer()
+  : m_data(nullptr), m_size(0), m_mappedSize(0), m_heapSize(0) {}
+
+SourceBuffer::SourceBuffer(SourceBuffer&& other) noexcept
+  : m_data(other.m_data),
+    m_size(other.m_size),
+    m_mappedSize(other.m_mappedSize),
+    m_heap(std::move(other.m_heap)),
+    m_heapSize(other.m_heapSize),
+    m_lineStarts(std::move(other.m_lineStarts))
+{
+  other.m_data = nullptr;
+  other.m_size = other.m_mappedSize = other.m_heapSize = 0;
+}
+
+SourceBuffer& SourceBuffer::operator=(SourceBuffer&& other) noexcept {
+  if (this == &other)
+    return *this;
+
+  release();
+
+  m_data = other.m_data;
+  m_size = other.m_size;
+  m_mappedSize = other.m_mappedSize;
+  m_heap = std::move(other.m_heap);
+  m_heapSize = other.m_heapSize;
+  m_lineStarts = std::move(other.m_lineStarts);
+
+  other.m_data = nullptr;
+  other.m_size = other.m_mappedSize = other.m_heapSize = 0;
+  return *this;
+}
+
+SourceBuffer::~SourceBuffer() {
+  release();
+}
+
+SourceLocation SourceBuffer::locate(uint32_t offset) const {
+  if (m_lineStarts.empty()) {
+    auto findNewline = lon::scanKernels().findNewline;
+    const char* end = m_data + m_size;
+
+    m_lineStarts.push_back(0);
+    for (const char* pt = findNewline(m_data, end); pt != end; pt = findNewline(pt + 1, end))
+      m_lineStarts.push_back((uint32_t)(pt + 1 - m_data));
+  }
+
+  auto line = std::upper_bound(m_lineStarts.begin(), m_lineStarts.end(), offset) - 1;
+  return { (int)(line - m_lineStarts.begin()) + 1, (int)(offset - *line) + 1 };
+}
+
+void SourceBuffer::replace(uint32_t offset, uint32_t length, std::string_view text) {
+  size_t newSize = m_size - length + text.size();
+  size_t tailSize = m_size - offset - length;
+
+  if (m_mappedSize != 0 || newSize + SOURCE_PADDING > m_heapSize) {
+    // room for more edits, so typing doesn't reallocate every time
+    size_t heapSize = newSize + newSize / 2 + SOURCE_PADDING;
+    std::unique_ptr<char[]> heap(new char[heapSize]);
+    memcpy(heap.get(), m_data, offset);
+    memcpy(heap.get() + offset + text.size(), m_data + offset + length, tailSize);
+
+    auto lineStarts = std::move(m_lineStarts);
+    release();
+    m_lineStarts = std::move(lineStarts);
+
+    m_heap = std::move(heap);
+    m_heapSize = heapSize;
+  }
+  else {
+    memmove(m_heap.get() + offset + text.size(), m_data + offset + length, tailSize);
+  }
+
+  memcpy(m_heap.get() + offset, text.data(), text.size());
+  memset(m_heap.get() + newSize, 0, SOURCE_PADDING);
+
+  m_data = m_heap.get();
+  m_size = newSize;
+
+  if (m_lineStarts.empty())
+    return;
+
+  // lines that started inside replaced bytes are gone, later ones move
+  auto first = std::upper_bound(m_lineStarts.begin(), m_lineStarts.end(), offset);
+  auto last = std::upper_bound(first, m_lineStarts.end(), offset + length);
+
+  for (auto line = last; line != m_lineStarts.end(); ++line)
+    *line = (uint32_t)(*line - length + text.size());
+
+  std::vector<uint32_t> newLines;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '\n')
+      newLines.push_back((uint32_t)(offset + i + 1));
+  }
+
+  first = m_lineStarts.erase(first, last);
+  m_lineStarts.insert(first, newLines.begin(), newLines.end());
+}
+
+SourceBuffer SourceBuffer::fromString(std::string_view content) {
+  SourceBuffer buffer;
+  buffer.m_heap.reset(new char[content.size() + SOURCE_PADDING]);
+  memcpy(buffer.m_heap.get(), content.data(), content.size());
+  memset(buffer.m_heap.get() + content.size(), 0, SOURCE_PADDING);
+
+  buffer.m_data = buffer.m_heap.get();
+  buffer.m_size = content.size();
+  buffer.m_heapSize = content.size() + SOURCE_PADDING;
+  return buffer;
+}
+
+#ifdef _WIN32
+
+void SourceBuffer::release() {
+  if (m_mappedSize != 0)
+    UnmapViewOfFile(m_data);
+
+  m_heap.reset();
+  m_lineStarts.clear();
+  m_data = nullptr;
+  m_size = m_mappedSize = m_heapSize = 0;
+}
+
+SourceBuffer SourceBuffer::fromFile(std::string_view path) {
+  SourceBuffer buffer;
+
+  bool isStdin = path == "-";
+  HANDLE file;
+
+  if (isStdin) {
+    file = GetStdHandle(STD_INPUT_HANDLE);
+  }
+  else {
+    std::string pathStr(path);
+    file = CreateFileA(
+      pathStr.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr
+    );
+  }
+
+  if (file == INVALID_HANDLE_VALUE)
+    fail("Failed to open file", path);
+
+  LARGE_INTEGER fileSize;
+  bool isDisk = GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &fileSize);
+  size_t size = isDisk ? (size_t)fileSize.QuadPart : 0;
+
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  size_t pageSize = info.dwPageSize;
+
+  // Tail of the last mapped page is zero-filled, but we can't reserve
+  // extra pages after a view, so map only when the tail is big enough
+  if (isDisk && size != 0 && roundUp(size, pageSize) - size >= SOURCE_PADDING) {
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr) {
+      const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+
+      if (view != nullptr) {
+        buffer.m_data = (const char*)view;
+        buffer.m_size = size;
+        buffer.m_mappedSize = roundUp(size, pageSize);
+        CloseHandle(file);
+        return buffer;
+      }
+    }
+  }
+
+  // one extra byte so the final zero-length read doesn't trigger a reallocation
+  ReadBuffer read(isDisk ? size + 1 : 64 * 1024);
+  while (true) {
+    read.reserveMore();
+
+    DWORD chunk = read.freeSpace() > 0x40000000 ? 0x40000000 : (DWORD)read.freeSpace();
+    DWORD count = 0;
+    if (!ReadFile(file, read.tail(), chunk, &count, nullptr)) {
+      if (GetLastError() == ERROR_BROKEN_PIPE)
+        break;
+
+      if (!isStdin)
+        CloseHandle(file);
+      fail("Failed to read file", path);
+    }
+
+    if (count == 0)
+      break;
+
+    read.size += count;
+  }
+
+  if (!isStdin)
+    CloseHandle(file);
+
+  read.finish();
+  buffer.m_heap = std::move(read.data);
+  buffer.m_data = buffer.m_heap.get();
+  buffer.m_size = read.size;
+  buffer.m_heapSize = read.capacity;
+  return buffer;
+}
+
+#else
+
+void SourceBuffer::release() {
+  if (m_mappedSize != 0)
+    munmap((void*)m_data, m_mappedSize);
+
+  m_heap.reset();
+  m_lineStarts.clear();
+  m_data = nullptr;
+  m_size = m_mappedSize = m_heapSize = 0;
+}
+
+SourceBuffer SourceBuffer::fromFile(std::string_view path) {
+  SourceBuffer buffer;
+
+  bool isStdin = path == "-";
+  int fd;
+
+  if (isStdin) {
+    fd = STDIN_FILENO;
+  }
+  else {
+    std::string pathStr(path);
+    fd = open(pathStr.c_str(), O_RDONLY);
+  }
+
+  if (fd < 0)
+    fail("Failed to open file", path);
+
+  struct stat st;
+  bool isRegular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  size_t size = isRegular ? (size_t)st.st_size : 0;
+
+  if (isRegular && size != 0) {
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t fileSpan = roundUp(size, pageSize);
+    size_t totalSpan = roundUp(size + SOURCE_PADDING, pageSize);
+
+    // Reserve zeroed pages for the whole span, then put the file over them.
+    // Whatever is left after the file is guaranteed to be zero
+    void* region = mmap(nullptr, totalSpan, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region != MAP_FAILED) {
+      void* view = mmap(region, fileSpan, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+
+      if (view != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+        madvise(view, fileSpan, MADV_SEQUENTIAL);
+#endif
+        buffer.m_data = (const char*)view;
+        buffer.m_size = size;
+        buffer.m_mappedSize = totalSpan;
+        close(fd);
+        return buffer;
+      }
+
+      munmap(region, totalSpan);
+    }
+  }
+
+  // one extra byte so the final zero-length read doesn't trigger a reallocation
+  ReadBuffer read(isRegular ? size + 1 : 64 * 1024);
+  while (true) {
+    read.reserveMore();
+
+    ssize_t count = ::read(fd, read.tail(), read.freeSpace());
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+
+      if (!isStdin)
+        close(fd);
+      fail("Failed to read file", path);
+    }
+
+    if (count == 0)
+      break;
+
+    read.size += (size_t)count;
+  }
+
+  if (!isStdin)
+    close(fd);
+
+  read.finish();
+  buffer.m_heap = std::move(read.data);
+  buffer.m_data = buffer.m_heap.get();
+  buffer.m_size = read.size;
+  buffer.m_heapSize = read.capacity;
+  return buffer;
+}
+
+#endif
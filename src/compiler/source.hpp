@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace lon {
+
+  // Every source buffer is followed by at least that many zero bytes.
+  // Lexer relies on it: it stops on the first null char and never checks bounds
+  constexpr size_t SOURCE_PADDING = 64;
+
+  struct SourceLocation {
+    int row; // starts from 1
+    int column; // starts from 1
+  };
+
+  class SourceBuffer {
+  private:
+    const char* m_data;
+    size_t m_size;
+
+    // non-zero if m_data is a file mapping (size of the whole mapped region)
+    size_t m_mappedSize;
+    std::unique_ptr<char[]> m_heap;
+    size_t m_heapSize; // with padding
+
+    // offsets of line beginnings, built on first locate()
+    mutable std::vector<uint32_t> m_lineStarts;
+
+  public:
+    SourceBuffer();
+    SourceBuffer(SourceBuffer&& other) noexcept;
+    SourceBuffer& operator=(SourceBuffer&& other) noexcept;
+    ~SourceBuffer();
+
+    SourceBuffer(SourceBuffer const&) = delete;
+    SourceBuffer& operator=(SourceBuffer const&) = delete;
+
+    // Maps file read-only if possible, otherwise reads it into a heap buffer.
+    // "-" means standard input
+    static SourceBuffer fromFile(std::string_view path);
+    static SourceBuffer fromString(std::string_view content);
+
+  public:
+    inline const char* data() const { return m_data; }
+    inline size_t size() const { return m_size; }
+    inline bool empty() const { return m_data == nullptr; }
+    inline std::string_view view() const { return { m_data, m_size }; }
+
+    // Row and column of byte offset.
+    // Only diagnostics need that, so lines are indexed lazily
+    SourceLocation locate(uint32_t offset) const;
+
+    // Replaces length bytes at offset with text.
+    // Mapped file is copied to the heap on first edit, later edits are done in place
+    void replace(uint32_t offset, uint32_t length, std::string_view text);
+
+  private:
+    void release();
+  };
+
+} // namespace lon
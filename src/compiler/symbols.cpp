@@ -0,0 +1,154 @@
+#include "symbols.hpp"
+
+#include <string.h>
+
+using lon::Symbol;
+using lon::SymbolTable;
+
+// must match SYM_* order
+static const char* PREDEFINED[] = {
+  "function",
+  "return",
+  "const",
+  "signed",
+  "unsigned",
+  "void",
+  "byte",
+  "short",
+  "integer",
+  "long",
+  "char",
+  "boolean",
+
+  "print",
+};
+
+static_assert(sizeof(PREDEFINED) / sizeof(*PREDEFINED) == lon::SYM_PREDEFINED_END);
+
+static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+// FNV-1a
+static uint32_t hashString(std::string_view str) {
+  uint32_t hash = 2166136261u;
+  for (char chr : str) {
+    hash ^= (uint8_t)chr;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+SymbolTable::SymbolTable()
+  : m_chunkPt(nullptr), m_chunkLeft(0)
+{
+  m_slots.assign(256, SYM_INVALID);
+
+  for (const char* name : PREDEFINED)
+    intern(name);
+}
+
+SymbolTable::~SymbolTable() = default;
+
+Symbol SymbolTable::intern(std::string_view str) {
+  uint32_t hash = hashString(str);
+  size_t mask = m_slots.size() - 1;
+
+  for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+    Symbol sym = m_slots[i];
+
+    if (sym == SYM_INVALID) {
+      sym = (Symbol)m_entries.size();
+      m_entries.push_back({ store(str), (uint32_t)str.size(), hash });
+      m_slots[i] = sym;
+
+      // keep load factor under 1/2
+      if (m_entries.size() * 2 > m_slots.size())
+        grow();
+
+      return sym;
+    }
+
+    Entry const& entry = m_entries[sym];
+    if (entry.hash == hash && entry.length == str.size() && memcmp(entry.data, str.data(), str.size()) == 0)
+      return sym;
+  }
+}
+
+Symbol SymbolTable::find(std::string_view str) const {
+  uint32_t hash = hashString(str);
+  size_t mask = m_slots.size() - 1;
+
+  for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+    Symbol sym = m_slots[i];
+
+    if (sym == SYM_INVALID)
+      return SYM_INVALID;
+
+    Entry const& entry = m_entries[sym];
+    if (entry.hash == hash && entry.length == str.size() && memcmp(entry.data, str.data(), str.size()) == 0)
+      return sym;
+  }
+}
+
+const char* SymbolTable::store(std::string_view str) {
+  size_t needed = str.size() + 1;
+
+  if (needed > m_chunkLeft) {
+    size_t size = needed > CHUNK_SIZE ? needed : CHUNK_SIZE;
+    m_chunks.emplace_back(new char[size]);
+    m_chunkPt = m_chunks.back().get();
+    m_chunkLeft = size;
+  }
+
+  char* result = m_chunkPt;
+  memcpy(result, str.data(), str.size());
+  result[str.size()] = 0;
+
+  m_chunkPt += needed;
+  m_chunkLeft -= needed;
+  return result;
+}
+
+void SymbolTable::grow() {
+  std::vector<Symbol> slots(m_slots.size() * 2, SYM_INVALID);
+  size_t mask = slots.size() - 1;
+
+  for (Symbol sym = 0; sym < m_entries.size(); ++sym) {
+    size_t i = m_entries[sym].hash & mask;
+    while (slots[i] != SYM_INVALID)
+      i = (i + 1) & mask;
+    slots[i] = sym;
+  }
+
+  m_slots = std::move(slots);
+}
+
+void SymbolTable::save(std::vector<SavedSymbol>& entries, std::vector<Symbol>& slots, std::vector<char>& strings) const {
+  entries.clear();
+  strings.clear();
+
+  for (Entry const& entry : m_entries) {
+    entries.push_back({ (uint32_t)strings.size(), entry.length, entry.hash });
+    strings.insert(strings.end(), entry.data, entry.data + entry.length + 1);
+  }
+
+  slots = m_slots;
+}
+
+void SymbolTable::restore(
+  SavedSymbol const* entries, size_t count,
+  Symbol const* slots, size_t slotsCount,
+  const char* strings
+) {
+  m_entries.clear();
+  m_entries.reserve(count);
+
+  for (size_t i = 0; i < count; ++i)
+    m_entries.push_back({ strings + entries[i].offset, entries[i].length, entries[i].hash });
+
+  m_slots.assign(slots, slots + slotsCount);
+
+  // new strings go to a fresh chunk
+  m_chunks.clear();
+  m_chunkPt = nullptr;
+  m_chunkLeft = 0;
+}
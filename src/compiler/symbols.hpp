@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace lon {
+
+  // Index of an interned string in SymbolTable
+  using Symbol = uint32_t;
+
+  enum : Symbol {
+    // keywords (same order as keyword tokens)
+    SYM_FUNCTION,
+    SYM_RETURN,
+    SYM_CONST,
+    SYM_SIGNED,
+    SYM_UNSIGNED,
+    SYM_VOID,
+    SYM_BYTE,
+    SYM_SHORT,
+    SYM_INTEGER,
+    SYM_LONG,
+    SYM_CHAR,
+    SYM_BOOLEAN,
+
+    SYM_KEYWORDS_END,
+
+    // builtin functions
+    SYM_PRINT = SYM_KEYWORDS_END,
+
+    SYM_PREDEFINED_END,
+
+    SYM_INVALID = 0xFFFFFFFF
+  };
+
+  // Identifiers and string literals, each distinct string stored once.
+  // Filled by lexer, so later stages compare symbols instead of strings.
+  // Predefined symbols always have the same ids (see SYM_*)
+  class SymbolTable {
+  public:
+    // Entry of a saved table, string is at offset in the strings blob
+    struct SavedSymbol {
+      uint32_t offset;
+      uint32_t length;
+      uint32_t hash;
+    };
+
+  private:
+    struct Entry {
+      const char* data; // null terminated
+      uint32_t length;
+      uint32_t hash;
+    };
+
+    std::vector<Entry> m_entries;
+
+    // open addressing hash table of entry indices, size is power of two
+    std::vector<Symbol> m_slots;
+
+    // string storage, never moves
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    char* m_chunkPt;
+    size_t m_chunkLeft;
+
+  public:
+    SymbolTable();
+    ~SymbolTable();
+
+    SymbolTable(SymbolTable const&) = delete;
+    SymbolTable& operator=(SymbolTable const&) = delete;
+
+  public:
+    Symbol intern(std::string_view str);
+
+    // SYM_INVALID if string was never interned
+    Symbol find(std::string_view str) const;
+
+    inline std::string_view name(Symbol sym) const {
+      return { m_entries[sym].data, m_entries[sym].length };
+    }
+
+    inline const char* cname(Symbol sym) const {
+      return m_entries[sym].data;
+    }
+
+    inline size_t size() const { return m_entries.size(); }
+
+    // Flat copy of the table for module files, strings are null terminated
+    void save(std::vector<SavedSymbol>& entries, std::vector<Symbol>& slots, std::vector<char>& strings) const;
+
+    // Replaces all symbols with saved ones, nothing is rehashed.
+    // Strings aren't copied, they must outlive the table
+    void restore(
+      SavedSymbol const* entries, size_t count,
+      Symbol const* slots, size_t slotsCount,
+      const char* strings
+    );
+
+  private:
+    const char* store(std::string_view str);
+    void grow();
+  };
+
+} // namespace lon
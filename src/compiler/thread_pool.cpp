@@ -0,0 +1,102 @@
+#include "thread_pool.hpp"
+
+using lon::ThreadPool;
+
+ThreadPool::ThreadPool(size_t threads)
+  : m_job(nullptr),
+    m_jobSize(0),
+    m_nextIndex(0),
+    m_busyWorkers(0),
+    m_generation(0),
+    m_stop(false)
+{
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  if (threads == 0)
+    threads = 1;
+
+  for (size_t i = 1; i < threads; ++i)
+    m_workers.emplace_back([this]() { worker(); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+
+  m_wakeUp.notify_all();
+
+  for (auto& thread : m_workers)
+    thread.join();
+}
+
+void ThreadPool::parallelFor(size_t count, std::function<void(size_t)> const& fn) {
+  if (count == 0)
+    return;
+
+  if (m_workers.empty() || count == 1) {
+    for (size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_job = &fn;
+    m_jobSize = count;
+    m_nextIndex = 0;
+    m_error = nullptr;
+    m_busyWorkers = m_workers.size();
+    ++m_generation;
+  }
+
+  m_wakeUp.notify_all();
+  runJob();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_finished.wait(lock, [this]() { return m_busyWorkers == 0; });
+  m_job = nullptr;
+
+  if (m_error)
+    std::rethrow_exception(m_error);
+}
+
+void ThreadPool::worker() {
+  uint64_t seenGeneration = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wakeUp.wait(lock, [&]() { return m_stop || m_generation != seenGeneration; });
+
+      if (m_stop)
+        return;
+
+      seenGeneration = m_generation;
+    }
+
+    runJob();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_busyWorkers == 0)
+      m_finished.notify_one();
+  }
+}
+
+void ThreadPool::runJob() {
+  while (true) {
+    size_t index = m_nextIndex.fetch_add(1);
+    if (index >= m_jobSize)
+      return;
+
+    try {
+      (*m_job)(index);
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_error)
+        m_error = std::current_exception();
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lon {
+
+  // Fixed set of worker threads for data-parallel compiler passes
+  class ThreadPool {
+  private:
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    std::condition_variable m_finished;
+
+    // current job, protected by m_mutex except for the counters
+    std::function<void(size_t)> const* m_job;
+    size_t m_jobSize;
+    std::atomic<size_t> m_nextIndex;
+    size_t m_busyWorkers;
+    uint64_t m_generation;
+    std::exception_ptr m_error;
+    bool m_stop;
+
+  public:
+    // 0 threads = one per hardware thread
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+  public:
+    // Number of threads that run jobs, including the caller
+    inline size_t size() const { return m_workers.size() + 1; }
+
+    // Calls fn(i) for every i in [0, count), calling thread helps.
+    // Returns when all calls are done, rethrows the first exception
+    void parallelFor(size_t count, std::function<void(size_t)> const& fn);
+
+  private:
+    void worker();
+    void runJob();
+  };
+
+} // namespace lon
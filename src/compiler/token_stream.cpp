@@ -0,0 +1,71 @@
+#include "token_stream.hpp"
+
+using lon::Token;
+using lon::TokenStream;
+
+TokenStream::TokenStream(Token const* begin, Token const* end)
+  : m_lexer(nullptr),
+    m_head(0),
+    m_count(0),
+    m_lexerDone(true),
+    m_position(0),
+    m_pt(begin),
+    m_end(end) {}
+
+TokenStream::TokenStream(Lexer& lexer)
+  : m_lexer(&lexer),
+    m_head(0),
+    m_count(0),
+    m_lexerDone(false),
+    m_position(0),
+    m_pt(nullptr),
+    m_end(nullptr) {}
+
+Token const* TokenStream::peek(size_t n) {
+  if (!m_lexer) {
+    Token const* tk = m_pt + n;
+    return tk < m_end ? tk : nullptr;
+  }
+
+  if (n >= m_count)
+    fill(n + 1);
+
+  if (n >= m_count)
+    return nullptr;
+
+  return &m_ring[(m_head + n) & (LOOKAHEAD - 1)];
+}
+
+void TokenStream::advance() {
+  if (!m_lexer) {
+    if (m_pt < m_end)
+      ++m_pt, ++m_position;
+    return;
+  }
+
+  if (m_count == 0)
+    fill(1);
+
+  if (m_count == 0)
+    return;
+
+  m_head = (m_head + 1) & (LOOKAHEAD - 1);
+  --m_count;
+  ++m_position;
+}
+
+void TokenStream::skipTo(Token const* pt) {
+  if (!m_lexer && pt > m_pt && pt <= m_end) {
+    m_position += pt - m_pt;
+    m_pt = pt;
+  }
+}
+
+void TokenStream::fill(size_t count) {
+  while (m_count < count && !m_lexerDone) {
+    if (m_lexer->nextToken(m_ring[(m_head + m_count) & (LOOKAHEAD - 1)]))
+      ++m_count;
+    else
+      m_lexerDone = true;
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include "lexer.hpp"
+
+namespace lon {
+
+  // Tokens as parser sees them.
+  // Either a view of an already lexed array, or a small ring buffer refilled
+  // from Lexer::nextToken, so memory doesn't depend on file size
+  class TokenStream {
+  public:
+    // max peek() distance + 1, power of two
+    static constexpr size_t LOOKAHEAD = 4;
+
+  private:
+    // streaming mode
+    Lexer* m_lexer;
+    Token m_ring[LOOKAHEAD];
+    size_t m_head;
+    size_t m_count;
+    bool m_lexerDone;
+
+    // tokens advanced over
+    size_t m_position;
+
+    // array mode
+    Token const* m_pt;
+    Token const* m_end;
+
+  public:
+    TokenStream(Token const* begin, Token const* end);
+    TokenStream(Lexer& lexer);
+
+  public:
+    // n-th token from current, nullptr if there's no such token
+    Token const* peek(size_t n = 0);
+    void advance();
+
+    inline bool isStreaming() const { return m_lexer != nullptr; }
+    inline size_t position() const { return m_position; }
+
+    // Array mode only, tokens not advanced over yet
+    inline Token const* rest() const { return m_pt; }
+    inline Token const* restEnd() const { return m_end; }
+
+    // Array mode only, advances up to pt
+    void skipTo(Token const* pt);
+
+  private:
+    void fill(size_t count);
+  };
+
+} // namespace lon
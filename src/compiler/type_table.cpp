@@ -0,0 +1,153 @@
+#include "type_table.hpp"
+
+using lon::Type;
+using lon::TypeRef;
+using lon::TypeTable;
+
+static uint32_t hashType(Type const& type) {
+  uint64_t key = ((uint64_t)type.id << 40) ^ ((uint64_t)type.flags << 32) ^ type.payload;
+  key *= 0x9E3779B97F4A7C15ull;
+  return (uint32_t)(key >> 32);
+}
+
+static bool sameType(Type const& a, Type const& b) {
+  return a.id == b.id && a.flags == b.flags && a.payload == b.payload;
+}
+
+static Type makeType(lon::TypeID id) {
+  Type type;
+  type.id = id;
+  type.flags = lon::TPF_NONE;
+  type.payload = 0;
+  return type;
+}
+
+TypeTable::TypeTable() {
+  m_slots.assign(64, TYPE_INVALID);
+
+  // must match TYPE_* order
+  intern(makeType(TID_VOID));
+
+  for (int width = 0; width < 4; ++width) {
+    for (bool isSigned : { true, false }) {
+      Type type = makeType(TID_NUMBER);
+      type.number.width = (uint8_t)width;
+      type.number.isSigned = isSigned;
+      intern(type);
+    }
+  }
+
+  intern(makeType(TID_CHAR));
+  intern(makeType(TID_BOOLEAN));
+  intern(makeType(TID_STRING));
+
+  Type float64 = makeType(TID_FLOAT);
+  float64.number.width = 3;
+  float64.number.isSigned = true;
+  intern(float64);
+}
+
+TypeTable::~TypeTable() = default;
+
+TypeRef TypeTable::intern(Type const& type) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  uint32_t hash = hashType(type);
+  size_t mask = m_slots.size() - 1;
+
+  for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+    TypeRef ref = m_slots[i];
+
+    if (ref == TYPE_INVALID) {
+      ref = (TypeRef)m_entries.size();
+      m_entries.push_back({ type, hash });
+      m_slots[i] = ref;
+
+      // keep load factor under 1/2
+      if (m_entries.size() * 2 > m_slots.size())
+        grow();
+
+      return ref;
+    }
+
+    Entry const& entry = m_entries[ref];
+    if (entry.hash == hash && sameType(entry.type, type))
+      return ref;
+  }
+}
+
+TypeRef TypeTable::withFlags(TypeRef ref, TypeFlags flags) {
+  Type type = get(ref);
+  if (type.flags == flags)
+    return ref;
+
+  type.flags = flags;
+  return intern(type);
+}
+
+TypeRef TypeTable::pointerTo(TypeRef ref) {
+  return derived(TID_POINTER, ref);
+}
+
+TypeRef TypeTable::referenceTo(TypeRef ref) {
+  return derived(TID_REFERENCE, ref);
+}
+
+TypeRef TypeTable::listOf(TypeRef ref) {
+  return derived(TID_LIST, ref);
+}
+
+TypeRef TypeTable::derived(TypeID id, TypeRef element) {
+  Type type = makeType(id);
+  type.element = element;
+  return intern(type);
+}
+
+std::string TypeTable::name(TypeRef ref) const {
+  Type type = get(ref);
+  std::string result = type.flags & TPF_CONST ? "const " : "";
+
+  switch (type.id) {
+    case TID_VOID: return result + "void";
+    case TID_CHAR: return result + "char";
+    case TID_BOOLEAN: return result + "boolean";
+    case TID_STRING: return result + "string";
+    case TID_NUMBER:
+      result += "number<";
+      result += type.number.isSigned ? "signed, " : "unsigned, ";
+      return result + std::to_string((1 << type.number.width) << 3) + " bits>";
+    case TID_FLOAT:
+      return result + "float<" + std::to_string((1 << type.number.width) << 3) + " bits>";
+    case TID_POINTER: return result + "pointer<" + name(type.element) + ">";
+    case TID_REFERENCE: return result + "reference<" + name(type.element) + ">";
+    case TID_LIST: return result + "list<" + name(type.element) + ">";
+  }
+
+  return result + "user<" + std::to_string(type.id) + ">";
+}
+
+void TypeTable::save(std::vector<Entry>& entries, std::vector<TypeRef>& slots) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  entries = m_entries;
+  slots = m_slots;
+}
+
+void TypeTable::restore(Entry const* entries, size_t count, TypeRef const* slots, size_t slotsCount) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries.assign(entries, entries + count);
+  m_slots.assign(slots, slots + slotsCount);
+}
+
+void TypeTable::grow() {
+  std::vector<TypeRef> slots(m_slots.size() * 2, TYPE_INVALID);
+  size_t mask = slots.size() - 1;
+
+  for (TypeRef ref = 0; ref < m_entries.size(); ++ref) {
+    size_t i = m_entries[ref].hash & mask;
+    while (slots[i] != TYPE_INVALID)
+      i = (i + 1) & mask;
+    slots[i] = ref;
+  }
+
+  m_slots = std::move(slots);
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace lon {
+
+  enum {
+    TPF_NONE = 0,
+    TPF_CONST = 1 << 0
+  };
+
+  using TypeFlags = uint32_t;
+
+  enum {
+    TID_VOID,
+    TID_NUMBER,
+    TID_STRING,
+    TID_POINTER,
+    TID_REFERENCE,
+    TID_CHAR,
+    TID_BOOLEAN,
+    TID_LIST,
+    TID_FLOAT,
+
+    TID_USER_START = 0xFFFF,
+    // user defined types
+  };
+
+  using TypeID = uint32_t;
+
+  // Index of an interned type in TypeTable, same types always have same index
+  using TypeRef = uint32_t;
+
+  enum : TypeRef {
+    TYPE_VOID,
+
+    // numbers, signed and unsigned for every width (see TypeTable::number)
+    TYPE_INT8,
+    TYPE_UINT8,
+    TYPE_INT16,
+    TYPE_UINT16,
+    TYPE_INT32,
+    TYPE_UINT32,
+    TYPE_INT64,
+    TYPE_UINT64,
+
+    TYPE_CHAR,
+    TYPE_BOOLEAN,
+    TYPE_STRING,
+    TYPE_FLOAT64,
+
+    TYPE_PREDEFINED_END,
+
+    TYPE_INVALID = 0xFFFFFFFF
+  };
+
+  struct Type {
+    struct Number {
+      uint8_t width; // width in bytes = 1 << width
+      bool isSigned;
+    };
+
+    TypeID id;
+    TypeFlags flags;
+    union {
+      Number number; // TID_NUMBER, TID_FLOAT
+      TypeRef element; // TID_POINTER, TID_REFERENCE, TID_LIST
+      uint32_t payload; // all of the above as one value, zero it before setting number
+    };
+  };
+
+  // Every distinct type stored once, so types are compared by TypeRef.
+  // Predefined types always have the same refs (see TYPE_*).
+  // Thread-safe, parallel parsers share one table
+  class TypeTable {
+  public:
+    // also the format of saved tables
+    struct Entry {
+      Type type;
+      uint32_t hash;
+    };
+
+  private:
+    std::vector<Entry> m_entries;
+
+    // open addressing hash table of entry indices, size is power of two
+    std::vector<TypeRef> m_slots;
+
+    // guards everything above
+    mutable std::mutex m_mutex;
+
+  public:
+    TypeTable();
+    ~TypeTable();
+
+    TypeTable(TypeTable const&) = delete;
+    TypeTable& operator=(TypeTable const&) = delete;
+
+  public:
+    TypeRef intern(Type const& type);
+
+    // copy, another thread may be adding types
+    inline Type get(TypeRef ref) const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_entries[ref].type;
+    }
+
+    // width in bytes = 1 << width
+    static inline TypeRef number(int width, bool isSigned) {
+      return TYPE_INT8 + width * 2 + (isSigned ? 0 : 1);
+    }
+
+    TypeRef withFlags(TypeRef ref, TypeFlags flags);
+    TypeRef pointerTo(TypeRef ref);
+    TypeRef referenceTo(TypeRef ref);
+    TypeRef listOf(TypeRef ref);
+
+    // For diagnostics and debug output
+    std::string name(TypeRef ref) const;
+
+    // Flat copy of the table for module files
+    void save(std::vector<Entry>& entries, std::vector<TypeRef>& slots) const;
+
+    // Replaces all types with saved ones, nothing is rehashed
+    void restore(Entry const* entries, size_t count, TypeRef const* slots, size_t slotsCount);
+
+    inline size_t size() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_entries.size();
+    }
+
+  private:
+    TypeRef derived(TypeID id, TypeRef element);
+    void grow();
+  };
+
+} // namespace lon
@@ -1,24 +1,129 @@
 #include <stdio.h>
-#include <sstream>
-#include <fstream>
+#include <stdlib.h>
+#include <memory>
+#include <string>
 #include "compiler/lexer.hpp"
+#include "compiler/module.hpp"
 #include "compiler/parser.hpp"
 #include "compiler/generator.hpp"
+#include "compiler/linker.hpp"
+#include "compiler/ir/evaluate.hpp"
+#include "compiler/ir/inline.hpp"
+#include "compiler/ir/lower.hpp"
+#include "compiler/ir/optimize.hpp"
+#include "compiler/ir/verify.hpp"
+
+// "dir/name.lon" -> "dir/name.lonm", empty for standard input
+static std::string modulePath(std::string_view input) {
+  if (input == "-")
+    return {};
+
+  std::string path(input);
+  if (path.size() > 4 && path.compare(path.size() - 4, 4, ".lon") == 0)
+    return path + "m";
+  return path + ".lonm";
+}
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
+  const char* input = nullptr;
+  bool dumpIR = false;
+  bool optimize = true;
+  bool optStats = false;
+  bool writeAsm = false;
+  lon::LinkOptions linkOptions;
+  uint32_t inlineThreshold = lon::DEFAULT_INLINE_THRESHOLD;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+
+    if (arg == "--dump-ir")
+      dumpIR = true;
+    else if (arg == "--no-opt")
+      optimize = false;
+    else if (arg == "--opt-stats")
+      optStats = true;
+    else if (arg == "--asm")
+      writeAsm = true;
+    else if (arg == "--minimal")
+      linkOptions.minimal = true;
+    else if (arg == "--inline-threshold" && i + 1 < argc)
+      inlineThreshold = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (arg.size() > 1 && arg[0] == '-' && arg[1] == '-')
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+    else if (!input)
+      input = argv[i];
+  }
+
+  if (!input) {
     fprintf(stderr, "no input file\n");
     return 1;
   }
 
-  lon::LexerResult lexerResult;
+  lon::SymbolTable symbols;
+  lon::TypeTable types;
+  lon::ThreadPool pool;
+  lon::Lexer lexer(symbols, input);
+  std::unique_ptr<lon::Parser> parser;
+
+  // AST from the module cache if the source didn't change, must outlive the AST
+  lon::Module module;
+  lon::AbstractSourceTree cached;
+  lon::AbstractSourceTree const* ast = nullptr;
+
   try {
-    lon::Lexer lexer(argv[1]);
-    lexer.tokenize();
-    lexerResult = lexer.getResult();
+    lexer.load();
+
+    std::string cachePath = modulePath(input);
+    uint64_t sourceHash = lon::Module::hashSource(lexer.source().view());
+
+    if (!cachePath.empty())
+      module = lon::Module::load(cachePath, sourceHash);
+
+    if (!module.empty()) {
+      cached.fileName = input;
+      cached.symbols = &symbols;
+      cached.types = &types;
+      module.restore(cached);
+      ast = &cached;
+    }
+    else {
+      if (pool.size() > 1 && lexer.source().size() >= lon::Lexer::PARALLEL_MIN_SIZE) {
+        // big file, lex everything at once on all cores
+        lexer.tokenize(&pool);
+        parser = std::make_unique<lon::Parser>(lexer.takeResult(), types);
+      }
+      else {
+        // tokens are lexed on demand, so lexer errors also come from parse()
+        parser = std::make_unique<lon::Parser>(lexer, types);
+      }
+
+      parser->parse(&pool);
+      ast = &parser->getAST();
+
+      if (!cachePath.empty()) {
+        try {
+          lon::Module::save(cachePath, *ast, sourceHash);
+        }
+        catch (std::exception& error) {
+          // compiling still works, just without the cache next time
+          fprintf(stderr, "%s\n", error.what());
+        }
+      }
+    }
   }
   catch (lon::LexerError& error) {
-    fprintf(stderr, "Syntax error at %d:%d: %s\n", error.row(), error.column(), error.what());
+    auto location = lexer.source().locate(error.offset());
+    fprintf(stderr, "Syntax error at %d:%d: %s\n", location.row, location.column, error.what());
+    return 1;
+  }
+  catch (lon::ParserError& error) {
+    if (error.offset() != lon::ParserError::AT_EOF) {
+      auto location = parser->source().locate(error.offset());
+      fprintf(stderr, "Parser error at %d:%d: %s\n", location.row, location.column, error.what());
+    }
+    else {
+      fprintf(stderr, "Parser error at EOF: %s\n", error.what());
+    }
     return 1;
   }
   catch (std::exception& error) {
@@ -26,25 +131,94 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  lon::Parser parser(lexerResult);
+  ast->debugPrint();
 
+  lon::IRModule ir;
   try {
-    parser.parse();
+    ir = lon::Lowering().lower(*ast);
+    lon::verify(ir);
   }
-  catch (lon::ParserError& error) {
-    if (error.row() != -1) {
-      fprintf(stderr, "Parser error at %d:%d: %s\n", error.row(), error.column(), error.what());
+  catch (lon::LoweringError& error) {
+    fprintf(stderr, "Error: %s\n", error.what());
+    return 1;
+  }
+
+  if (optimize) {
+    // callees are run and measured for inlining optimized, then callers are
+    // optimized again
+    auto stats = lon::optimize(ir);
+    lon::verify(ir);
+
+    auto evaluation = lon::evaluateCalls(ir);
+    if (evaluation.evaluated > 0)
+      lon::verify(ir);
+
+    auto inlining = lon::inlineCalls(ir, inlineThreshold);
+    constexpr uint32_t NO_FUNCTION = 0xFFFFFFFF;
+    if (evaluation.evaluated > 0 || inlining.inlined > 0) {
+      lon::verify(ir);
+
+      auto again = lon::optimize(ir);
+      lon::verify(ir);
+
+      // functions are only removed, the rest stay in order
+      size_t next = 0;
+      for (auto& item : stats) {
+        if (next < again.size() && again[next].function == item.function)
+          item.after = again[next++].after;
+        else
+          item.after = NO_FUNCTION;
+      }
     }
-    else {
-      fprintf(stderr, "Parser error at EOF: %s\n", error.what());
+
+    if (optStats) {
+      printf("Evaluated %u calls, removed %u functions\n", evaluation.evaluated, evaluation.removed);
+      printf("Inlined %u calls, removed %u functions\n", inlining.inlined, inlining.removed);
+
+      for (auto const& item : stats) {
+        if (item.after == NO_FUNCTION) {
+          printf("Optimized %s: %u instructions, removed\n", symbols.cname(item.function), item.before);
+          continue;
+        }
+
+        printf(
+          "Optimized %s: %u -> %u instructions, %d eliminated\n",
+          symbols.cname(item.function), item.before, item.after, (int)(item.before - item.after)
+        );
+      }
     }
-    return 1;
   }
 
-  parser.debugPrint();
+  if (dumpIR)
+    ir.dump(stdout);
 
   lon::Generator generator;
-  generator.generate(parser.getAST(), fopen("out.asm", "w+"));
+  FILE* asmFile = writeAsm ? fopen("out.asm", "w+") : nullptr;
+  generator.generate(ir, asmFile, optimize);
+  if (asmFile)
+    fclose(asmFile);
+
+  std::vector<uint8_t> image;
+  try {
+    image = lon::link(generator.object(), linkOptions);
+  }
+  catch (lon::LinkerError& error) {
+    fprintf(stderr, "Linker error: %s\n", error.what());
+    return 1;
+  }
+
+  FILE* exeFile = fopen("out.exe", "wb");
+  if (!exeFile) {
+    fprintf(stderr, "can't write out.exe\n");
+    return 1;
+  }
+  fwrite(image.data(), 1, image.size(), exeFile);
+  fclose(exeFile);
+
+  if (optimize && optStats) {
+    printf("Peephole: %u rewrites\n", generator.peepholeRewrites());
+    printf("Code: %zu bytes\n", generator.object().sections[lon::SECTION_TEXT].bytes.size());
+  }
 
   return 0;
 }